@@ -0,0 +1,331 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * automation.c - Recording and playback of parameter changes over time.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* Parameter changes are recorded in a timeline of compact events, each
+ * with the time in ms since recording started. The timeline is sorted by
+ * time, as events are only ever appended.
+ *
+ * During playback, events are handed to the synth's parameter handler for
+ * scheduling on the MIDI scheduler queue a little ahead of time, so that
+ * they are sent at exactly the right time even if the main loop is busy.
+ * The scheduler queue runs at MIDI_SCHED_TICKS_PER_SEC, i.e. one tick per
+ * ms of timeline at normal tempo; other tempos are handled by changing the
+ * queue's tempo. A position in the timeline, origin, is mapped to a queue
+ * tick, offset, and advanced each time playback loops. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "automation.h"
+#include "midi.h"
+#include "param_bus.h"
+#include "timestamp.h"
+
+#include "debug.h"
+
+struct automation_event {
+  unsigned int time; /* ms since start of recording */
+  unsigned short parnum;
+  unsigned char buf_no;
+  unsigned char value;
+};
+
+/* Timeline */
+static struct automation_event *events = NULL;
+static int events_size = 0; /* allocated */
+static int event_count = 0;
+static unsigned int length = 0; /* ms */
+
+static int recording = 0;
+static long long record_started;
+
+/* Max number of events scheduled but not yet sent */
+#define PENDING_MAX 256
+
+struct pending_event {
+  unsigned int tick;
+  int index; /* in timeline */
+};
+
+/* State of playback */
+static struct {
+  int active;
+  int tempo;
+  int next; /* next event to schedule */
+  unsigned int origin; /* timeline time which corresponds to ... */
+  unsigned int offset; /* ... this scheduler tick */
+  unsigned int loop_start;
+  unsigned int loop_end; /* 0 => no looping */
+  automation_sched_func sched;
+  automation_show_func show;
+  void *ref;
+  struct pending_event pending[PENDING_MAX];
+  unsigned int pending_head; /* next free */
+  unsigned int pending_tail; /* oldest */
+} play = { .tempo = 100 };
+
+static automation_status_cb status_cb = NULL;
+static void *status_ref = NULL;
+
+/* Register status callback */
+void
+automation_register_status_cb(automation_status_cb cb, void *ref)
+{
+  status_cb = cb;
+  status_ref = ref;
+}
+
+/* Get current status */
+void
+automation_get_status(struct automation_status *status)
+{
+  status->recording = recording;
+  status->playing = play.active;
+  status->events = event_count;
+  status->length = recording ? timestamp_ms() - record_started : length;
+  status->position = 0;
+  if (play.active) {
+    unsigned int now = midi_sched_time();
+    if (now >= play.offset)
+      status->position = play.origin + now - play.offset;
+    else if (play.loop_end) /* loop already wrapped in the schedule */
+      status->position = play.loop_end - (play.offset - now);
+    else
+      status->position = play.origin;
+  }
+}
+
+/* Tell status callback something has happened */
+static void
+report_status(void)
+{
+  struct automation_status status;
+
+  if (!status_cb) return;
+  automation_get_status(&status);
+  status_cb(&status, status_ref);
+}
+
+/* Start recording */
+void
+automation_record_start(void)
+{
+  automation_stop();
+  event_count = 0;
+  length = 0;
+  record_started = timestamp_ms();
+  recording = 1;
+  xprintf("Automation: recording\n");
+  report_status();
+}
+
+/* Stop recording */
+void
+automation_record_stop(void)
+{
+  if (!recording) return;
+
+  recording = 0;
+  length = timestamp_ms() - record_started;
+  xprintf("Automation: recorded %d events, %u ms\n", event_count, length);
+  report_status();
+}
+
+/* Record parameter change */
+void
+automation_record(int buf_no, int parnum, int value)
+{
+  struct automation_event *event;
+
+  if (!recording) return;
+
+  if (event_count >= events_size) {
+    int new_size = events_size ? events_size * 2 : 1024;
+    struct automation_event *new_events;
+
+    if (new_size > AUTOMATION_EVENTS_MAX) {
+      eprintf("Automation timeline full, recording stopped\n");
+      automation_record_stop();
+      return;
+    }
+    new_events = realloc(events, new_size * sizeof(*events));
+    if (!new_events) {
+      eprintf("Out of memory for automation, recording stopped\n");
+      automation_record_stop();
+      return;
+    }
+    events = new_events;
+    events_size = new_size;
+  }
+
+  event = &events[event_count++];
+  event->time = timestamp_ms() - record_started;
+  event->parnum = parnum;
+  event->buf_no = buf_no;
+  event->value = value;
+}
+
+/* Return index of first event at or after given time */
+static int
+first_event_at(unsigned int time)
+{
+  int lo = 0, hi = event_count;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (events[mid].time < time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Set loop points */
+void
+automation_set_loop(unsigned int loop_start, unsigned int loop_end)
+{
+  if (loop_end && loop_end <= loop_start)
+    return; /* nonsense */
+  play.loop_start = loop_start;
+  play.loop_end = loop_end;
+}
+
+/* Start playback */
+int
+automation_play(int tempo, automation_sched_func sched,
+                automation_show_func show, void *ref)
+{
+  automation_record_stop();
+  automation_stop();
+
+  if (!length || !sched) return -1;
+
+  play.tempo = tempo > 0 ? tempo : 100;
+  play.sched = sched;
+  play.show = show;
+  play.ref = ref;
+  play.origin = play.loop_end ? play.loop_start : 0;
+  play.offset = 0;
+  play.next = first_event_at(play.origin);
+  play.pending_head = play.pending_tail = 0;
+
+  if (midi_sched_start(play.tempo) < 0) return -1;
+
+  play.active = 1;
+  xprintf("Automation: playing %d events at %d%%\n", event_count, play.tempo);
+  automation_timer(); /* get the first events out right away */
+  report_status();
+
+  return 0;
+}
+
+/* Stop playback */
+void
+automation_stop(void)
+{
+  if (!play.active) return;
+
+  midi_sched_stop();
+  play.active = 0;
+  xprintf("Automation: stopped\n");
+  report_status();
+}
+
+/* Change tempo */
+void
+automation_set_tempo(int tempo)
+{
+  if (tempo <= 0) return;
+
+  play.tempo = tempo;
+  if (play.active)
+    midi_sched_tempo(tempo);
+}
+
+/* Schedule events up to horizon, looping as needed */
+static void
+schedule_events(unsigned int now, unsigned int horizon)
+{
+  while (play.pending_head - play.pending_tail < PENDING_MAX) {
+    struct automation_event *event;
+    struct pending_event *pending;
+    unsigned int tick;
+
+    if (play.loop_end &&
+        (play.next >= event_count || events[play.next].time >= play.loop_end)) {
+      unsigned int wrap = play.offset + (play.loop_end - play.origin);
+      if (wrap > horizon) break;
+      /* If looping was switched on after passing the loop end, we
+       * start the loop now rather than in the past. */
+      play.offset = wrap > now ? wrap : now;
+      play.origin = play.loop_start;
+      play.next = first_event_at(play.loop_start);
+      continue;
+    }
+    if (play.next >= event_count) break;
+
+    event = &events[play.next];
+    tick = play.offset + (event->time - play.origin);
+    if (tick > horizon) break;
+    if (play.sched(event->buf_no, event->parnum, event->value, tick,
+                   play.ref) < 0)
+      break; /* try again next time */
+
+    pending = &play.pending[play.pending_head++ % PENDING_MAX];
+    pending->tick = tick;
+    pending->index = play.next++;
+  }
+}
+
+/* Called periodically; schedule events that are due soon, and show those
+ * which have been sent. */
+void
+automation_timer(void)
+{
+  unsigned int now, horizon;
+
+  if (!play.active) return;
+
+  now = midi_sched_time();
+
+  param_bus_begin_batch();
+  while (play.pending_tail != play.pending_head &&
+         play.pending[play.pending_tail % PENDING_MAX].tick <= now) {
+    struct automation_event *event =
+      &events[play.pending[play.pending_tail++ % PENDING_MAX].index];
+    if (play.show)
+      play.show(event->buf_no, event->parnum, event->value, play.ref);
+  }
+  param_bus_end_batch();
+
+  /* The horizon is in ticks, which go faster at higher tempos */
+  horizon = now + AUTOMATION_AHEAD_MS * play.tempo / 100;
+  schedule_events(now, horizon);
+
+  /* Without looping, we're done when the end of the timeline has passed */
+  if (!play.loop_end && play.next >= event_count &&
+      play.pending_tail == play.pending_head &&
+      now >= play.offset + (length - play.origin))
+    automation_stop();
+}
+
+/************************** End of file automation.c ************************/
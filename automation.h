@@ -0,0 +1,93 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * automation.h - Recording and playback of parameter changes over time.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _AUTOMATION_H_
+#define _AUTOMATION_H_
+
+/* Max number of events in timeline */
+#define AUTOMATION_EVENTS_MAX (1 << 20)
+
+/* How far ahead of time events are scheduled during playback, in ms */
+#define AUTOMATION_AHEAD_MS 200
+
+/* Function called to schedule an event for sending at the given tick of
+ * the MIDI scheduler queue. Returns -1 if it could not be scheduled, in
+ * which case it is tried again later. */
+typedef int (*automation_sched_func)(int buf_no, int parnum, int value,
+                                     unsigned int tick, void *ref);
+
+/* Function called when a scheduled event has been sent, e.g. to show
+ * it in the UI. */
+typedef void (*automation_show_func)(int buf_no, int parnum, int value,
+                                     void *ref);
+
+/* Status of recorder, passed to status callback */
+struct automation_status {
+  int recording;
+  int playing;
+  int events; /* # events in timeline */
+  unsigned int length; /* length of timeline, in ms */
+  unsigned int position; /* playback position in timeline, in ms */
+};
+
+/* Status callback, called when recording or playback starts or stops */
+typedef void (*automation_status_cb)(const struct automation_status *status,
+                                     void *ref);
+
+/* Register status callback */
+void automation_register_status_cb(automation_status_cb cb, void *ref);
+
+/* Start recording, discarding the previous timeline. */
+void automation_record_start(void);
+
+/* Stop recording. The timeline ends at the time recording stopped. */
+void automation_record_stop(void);
+
+/* Record parameter change, if recording. */
+void automation_record(int buf_no, int parnum, int value);
+
+/* Start playback of timeline from the beginning (or loop start, if
+ * looping), at tempo percent of the recorded speed. Returns 0 if ok,
+ * -1 if there is nothing to play or the scheduler could not be started. */
+int automation_play(int tempo, automation_sched_func sched,
+                    automation_show_func show, void *ref);
+
+/* Stop playback. */
+void automation_stop(void);
+
+/* Set loop points, in ms from the start of the timeline. When looping,
+ * playback continues from loop_start after reaching loop_end. Setting
+ * loop_end to 0 turns looping off. */
+void automation_set_loop(unsigned int loop_start, unsigned int loop_end);
+
+/* Change playback tempo, in percent of the recorded speed. */
+void automation_set_tempo(int tempo);
+
+/* Get current status */
+void automation_get_status(struct automation_status *status);
+
+/* Called periodically to drive playback. */
+void automation_timer(void);
+
+#endif /* _AUTOMATION_H_ */
+
+/************************** End of file automation.h ************************/
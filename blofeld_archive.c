@@ -0,0 +1,622 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_archive.c - Compact archives of Blofeld sounds.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+/* An archive stores sounds column by column rather than sound by sound:
+ * first the values of the first parameter for a number of sounds, then
+ * the second parameter, and so on. As most parameters have the same or
+ * only a few values across a collection of sounds, each column is very
+ * repetitive. Each value is stored as its difference from that of a base
+ * sound, the first one in the archive, so that the values which are the
+ * same as in the base sound are all 0, and each column is then run
+ * length encoded.
+ *
+ * To allow random access to any sound without decoding the whole
+ * archive, sounds are stored in blocks of BLOCK_SOUNDS, with an index
+ * of where each block starts. Each block starts with a table of where
+ * each column starts in the block.
+ *
+ * All numbers in the file are little endian. The file consists of:
+ *
+ *   header     HEADER_SIZE bytes, see H_* below
+ *   base       COLUMNS bytes: the base sound
+ *   blocks     for each block:
+ *                COLUMNS 16 bit offsets of each column from block start
+ *                the columns, run length encoded
+ *   index      blocks + 1 32 bit offsets of each block from file start;
+ *              the last one is the end of the last block
+ *
+ * In the run length encoding, a byte with bit 7 clear is a single value,
+ * whereas one with bit 7 set is followed by a value which is repeated
+ * RUN_MIN plus the low 7 bits times. Thus no column can be longer than
+ * BLOCK_SOUNDS bytes, so with 128 sounds per block the 16 bit offsets
+ * are always sufficient. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "param.h"
+#include "blofeld_params.h"
+#include "blofeld_archive.h"
+#include "syx_file.h"
+
+#include "debug.h"
+
+#define ARCHIVE_MAGIC "XTSA"
+#define ARCHIVE_VERSION 1
+
+/* Sounds per block */
+#define BLOCK_SOUNDS 128
+
+/* Columns: the sound parameters, then where the sound was in the dump */
+#define COL_BANK BLOFELD_PARAMS
+#define COL_PROGRAM (BLOFELD_PARAMS + 1)
+#define COLUMNS (BLOFELD_PARAMS + 2)
+
+/* Header fields, all 32 bit */
+#define H_MAGIC 0
+#define H_VERSION 4
+#define H_SOUNDS 8
+#define H_BLOCK_SOUNDS 12 /* BLOCK_SOUNDS */
+#define H_COLUMNS 16 /* COLUMNS */
+#define H_BLOCKS 20
+#define H_INDEX 24 /* offset of index */
+#define HEADER_SIZE 32
+
+#define BASE_OFFSET HEADER_SIZE
+#define BLOCKS_OFFSET (BASE_OFFSET + COLUMNS)
+
+/* Run length encoding */
+#define RUN 0x80
+#define RUN_MIN 2
+#define RUN_MAX (0x7f + RUN_MIN)
+
+/* Max size of block */
+#define BLOCK_SIZE_MAX (2 * COLUMNS + BLOCK_SOUNDS * COLUMNS)
+
+struct blofeld_archive_writer {
+  FILE *f;
+  char *filename;
+  int sounds;
+  unsigned char base[COLUMNS];
+  unsigned char rows[BLOCK_SOUNDS][COLUMNS]; /* sounds in current block */
+  int rows_used;
+  unsigned char block[BLOCK_SIZE_MAX]; /* current block, encoded */
+  unsigned int offset; /* where next block goes */
+  unsigned int *index; /* offset of each block */
+  int blocks, index_size;
+};
+
+static void
+put16(unsigned char *p, unsigned int value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static void
+put32(unsigned char *p, unsigned int value)
+{
+  put16(p, value);
+  put16(p + 2, value >> 16);
+}
+
+static unsigned int
+get16(const unsigned char *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static unsigned int
+get32(const unsigned char *p)
+{
+  return get16(p) | get16(p + 2) << 16;
+}
+
+/* Create archive */
+struct blofeld_archive_writer *
+blofeld_archive_create(const char *filename)
+{
+  struct blofeld_archive_writer *writer = calloc(1, sizeof(*writer));
+  unsigned char header[BLOCKS_OFFSET] = { 0 };
+
+  if (!writer)
+    return NULL;
+  writer->filename = strdup(filename);
+  writer->f = fopen(filename, "wb");
+  /* The header is filled in when we're done */
+  if (!writer->filename || !writer->f ||
+      fwrite(header, sizeof(header), 1, writer->f) != 1) {
+    if (writer->f) {
+      fclose(writer->f);
+      unlink(filename);
+    }
+    free(writer->filename);
+    free(writer);
+    return NULL;
+  }
+  writer->offset = BLOCKS_OFFSET;
+  return writer;
+}
+
+/* Add offset to block index */
+static int
+add_to_index(struct blofeld_archive_writer *writer, unsigned int offset)
+{
+  if (writer->blocks >= writer->index_size) {
+    int new_size = writer->index_size ? writer->index_size * 2 : 64;
+    unsigned int *new_index = realloc(writer->index,
+                                      new_size * sizeof(*new_index));
+    if (!new_index)
+      return -1;
+    writer->index = new_index;
+    writer->index_size = new_size;
+  }
+  writer->index[writer->blocks++] = offset;
+  return 0;
+}
+
+/* Run length encode count values into out. Returns # bytes used. */
+static int
+encode_run_length(const unsigned char *values, int count, unsigned char *out)
+{
+  int used = 0, i = 0;
+
+  while (i < count) {
+    int run = 1;
+
+    while (i + run < count && run < RUN_MAX && values[i + run] == values[i])
+      run++;
+    if (run >= RUN_MIN)
+      out[used++] = RUN | (run - RUN_MIN);
+    out[used++] = values[i];
+    i += run;
+  }
+  return used;
+}
+
+/* Encode and write the sounds in the current block */
+static int
+write_block(struct blofeld_archive_writer *writer)
+{
+  unsigned char values[BLOCK_SOUNDS];
+  int size = 2 * COLUMNS, col, row;
+
+  for (col = 0; col < COLUMNS; col++) {
+    for (row = 0; row < writer->rows_used; row++)
+      values[row] = (writer->rows[row][col] - writer->base[col]) & 0x7f;
+    put16(&writer->block[2 * col], size);
+    size += encode_run_length(values, writer->rows_used,
+                              &writer->block[size]);
+  }
+  if (add_to_index(writer, writer->offset) < 0 ||
+      fwrite(writer->block, size, 1, writer->f) != 1)
+    return -1;
+  writer->offset += size;
+  writer->rows_used = 0;
+  return 0;
+}
+
+/* Add sound to archive */
+int
+blofeld_archive_add(struct blofeld_archive_writer *writer,
+                    const unsigned char *params, int bank, int program)
+{
+  unsigned char *row = writer->rows[writer->rows_used];
+  int i;
+
+  /* Values are 7 bit, as in the sysex dump */
+  for (i = 0; i < BLOFELD_PARAMS; i++)
+    row[i] = params[i] & 0x7f;
+  row[COL_BANK] = bank & 0x7f;
+  row[COL_PROGRAM] = program & 0x7f;
+  if (!writer->sounds)
+    memcpy(writer->base, row, COLUMNS);
+  writer->sounds++;
+
+  if (++writer->rows_used == BLOCK_SOUNDS)
+    return write_block(writer);
+  return 0;
+}
+
+/* Write rest of archive, and free writer */
+int
+blofeld_archive_finish(struct blofeld_archive_writer *writer)
+{
+  unsigned char header[BLOCKS_OFFSET] = { 0 };
+  unsigned char offset[4];
+  int ok, i;
+
+  ok = !writer->rows_used || write_block(writer) == 0;
+  ok = ok && add_to_index(writer, writer->offset) == 0; /* end */
+  for (i = 0; i < writer->blocks && ok; i++) {
+    put32(offset, writer->index[i]);
+    ok = fwrite(offset, sizeof(offset), 1, writer->f) == 1;
+  }
+
+  memcpy(&header[H_MAGIC], ARCHIVE_MAGIC, 4);
+  put32(&header[H_VERSION], ARCHIVE_VERSION);
+  put32(&header[H_SOUNDS], writer->sounds);
+  put32(&header[H_BLOCK_SOUNDS], BLOCK_SOUNDS);
+  put32(&header[H_COLUMNS], COLUMNS);
+  put32(&header[H_BLOCKS], writer->blocks - 1);
+  put32(&header[H_INDEX], writer->offset);
+  memcpy(&header[BASE_OFFSET], writer->base, COLUMNS);
+  ok = ok && fseek(writer->f, 0, SEEK_SET) == 0 &&
+       fwrite(header, sizeof(header), 1, writer->f) == 1;
+  ok = (fclose(writer->f) == 0) && ok;
+  if (!ok)
+    unlink(writer->filename);
+  else
+    xprintf("Archive: wrote %d sounds to %s, %u bytes\n", writer->sounds,
+            writer->filename, writer->offset + 4 * writer->blocks);
+
+  i = writer->sounds;
+  free(writer->index);
+  free(writer->filename);
+  free(writer);
+  return ok ? i : -1;
+}
+
+/* Check if file is an archive */
+int
+blofeld_archive_is_archive(const struct syx_file *file)
+{
+  return file->size >= BLOCKS_OFFSET &&
+         !memcmp(&file->data[H_MAGIC], ARCHIVE_MAGIC, 4);
+}
+
+/* Open archive */
+int
+blofeld_archive_open(struct blofeld_archive *archive, const char *filename)
+{
+  const unsigned char *data;
+  unsigned int index, prev;
+  int i;
+
+  memset(archive, 0, sizeof(*archive));
+  if (syx_file_open(&archive->file, filename) < 0)
+    return -1;
+  if (!blofeld_archive_is_archive(&archive->file))
+    goto invalid;
+
+  data = archive->file.data;
+  archive->sounds = get32(&data[H_SOUNDS]);
+  archive->blocks = get32(&data[H_BLOCKS]);
+  index = get32(&data[H_INDEX]);
+  if (get32(&data[H_VERSION]) != ARCHIVE_VERSION ||
+      get32(&data[H_BLOCK_SOUNDS]) != BLOCK_SOUNDS ||
+      get32(&data[H_COLUMNS]) != COLUMNS || archive->sounds < 0 ||
+      archive->blocks != (archive->sounds + BLOCK_SOUNDS - 1) / BLOCK_SOUNDS ||
+      index < BLOCKS_OFFSET || index > archive->file.size ||
+      (archive->file.size - index) / 4 < archive->blocks + 1)
+    goto invalid;
+  archive->base = &data[BASE_OFFSET];
+  archive->index = &data[index];
+
+  /* Blocks must be in order, and between the base sound and the index */
+  prev = BLOCKS_OFFSET;
+  for (i = 0; i <= archive->blocks; i++) {
+    unsigned int offset = get32(&archive->index[4 * i]);
+
+    if (offset < prev || offset > index ||
+        (i < archive->blocks && offset + 2 * COLUMNS > index))
+      goto invalid;
+    prev = offset;
+  }
+  return 0;
+
+invalid:
+  syx_file_close(&archive->file);
+  errno = EINVAL;
+  return -1;
+}
+
+/* Close archive */
+void
+blofeld_archive_close(struct blofeld_archive *archive)
+{
+  syx_file_close(&archive->file);
+  memset(archive, 0, sizeof(*archive));
+}
+
+/* Return number of sounds in block */
+static int
+block_sounds(const struct blofeld_archive *archive, int block)
+{
+  int left = archive->sounds - block * BLOCK_SOUNDS;
+
+  return left < BLOCK_SOUNDS ? left : BLOCK_SOUNDS;
+}
+
+/* Find column col of block in archive. Returns pointer to its data, and
+ * sets *size to its size, or returns NULL if the block is corrupt. */
+static const unsigned char *
+find_column(const struct blofeld_archive *archive, int block, int col,
+            unsigned int *size)
+{
+  unsigned int start = get32(&archive->index[4 * block]);
+  unsigned int block_size = get32(&archive->index[4 * (block + 1)]) - start;
+  const unsigned char *data = &archive->file.data[start];
+  unsigned int pos = get16(&data[2 * col]);
+  unsigned int end = col + 1 < COLUMNS ? get16(&data[2 * (col + 1)]) :
+                                         block_size;
+
+  if (pos < 2 * COLUMNS || pos > end || end > block_size)
+    return NULL;
+  *size = end - pos;
+  return &data[pos];
+}
+
+/* Decode the first count values of column col in block. Returns 0 if ok,
+ * -1 if the block is corrupt. */
+static int
+decode_column(const struct blofeld_archive *archive, int block, int col,
+              unsigned char *values, int count)
+{
+  unsigned int size, pos = 0;
+  const unsigned char *data = find_column(archive, block, col, &size);
+  int base = archive->base[col], i = 0;
+
+  if (!data)
+    return -1;
+  while (i < count && pos < size) {
+    int run = 1, value = data[pos++];
+
+    if (value & RUN) {
+      if (pos >= size)
+        return -1;
+      run = (value & ~RUN) + RUN_MIN;
+      value = data[pos++];
+    }
+    if (run > count - i)
+      run = count - i;
+    memset(&values[i], (value + base) & 0x7f, run);
+    i += run;
+  }
+  return i == count ? 0 : -1;
+}
+
+/* Decode value of column col for sound row in block, without decoding
+ * the whole column. Returns value, or -1 if the block is corrupt. */
+static int
+decode_value(const struct blofeld_archive *archive, int block, int col,
+             int row)
+{
+  unsigned int size, pos = 0;
+  const unsigned char *data = find_column(archive, block, col, &size);
+
+  if (!data)
+    return -1;
+  while (pos < size) {
+    int run = 1, value = data[pos++];
+
+    if (value & RUN) {
+      if (pos >= size)
+        return -1;
+      run = (value & ~RUN) + RUN_MIN;
+      value = data[pos++];
+    }
+    if (row < run)
+      return (value + archive->base[col]) & 0x7f;
+    row -= run;
+  }
+  return -1;
+}
+
+/* Decode count sounds of block into rows */
+static int
+decode_block(const struct blofeld_archive *archive, int block,
+             unsigned char (*rows)[COLUMNS], int count)
+{
+  unsigned char values[BLOCK_SOUNDS];
+  int col, row;
+
+  for (col = 0; col < COLUMNS; col++) {
+    if (decode_column(archive, block, col, values, count) < 0)
+      return -1;
+    for (row = 0; row < count; row++)
+      rows[row][col] = values[row];
+  }
+  return 0;
+}
+
+/* Get sound n from archive */
+int
+blofeld_archive_get(const struct blofeld_archive *archive, int n,
+                    unsigned char *msg, int dev_no)
+{
+  unsigned char row[COLUMNS];
+  int col;
+
+  if (n < 0 || n >= archive->sounds)
+    return -1;
+  for (col = 0; col < COLUMNS; col++) {
+    int value = decode_value(archive, n / BLOCK_SOUNDS, col,
+                             n % BLOCK_SOUNDS);
+    if (value < 0)
+      return -1;
+    row[col] = value;
+  }
+  blofeld_sound_dump(msg, row[COL_BANK], row[COL_PROGRAM], dev_no, row);
+  return 0;
+}
+
+/* Index archive. Only the columns of the name, category and where each
+ * sound was in the dump need to be decoded. */
+int
+blofeld_archive_index(const struct blofeld_archive *archive,
+                      struct blofeld_syx_entry **index)
+{
+  unsigned char (*rows)[COLUMNS] = malloc(BLOCK_SOUNDS * sizeof(*rows));
+  unsigned char values[BLOCK_SOUNDS];
+  struct blofeld_syx_entry *entries;
+  int block, row, col;
+
+  entries = calloc(archive->sounds ? archive->sounds : 1, sizeof(*entries));
+  if (!entries || !rows)
+    goto error;
+  /* The rest of the parameters are left as in the base sound */
+  for (row = 0; row < BLOCK_SOUNDS; row++)
+    memcpy(rows[row], archive->base, COLUMNS);
+  for (block = 0; block < archive->blocks; block++) {
+    int count = block_sounds(archive, block);
+
+    for (col = 0; col < COLUMNS; col++) {
+      if (col < BLOFELD_PARAMS && !blofeld_is_name_param(col))
+        continue;
+      if (decode_column(archive, block, col, values, count) < 0)
+        goto error;
+      for (row = 0; row < count; row++)
+        rows[row][col] = values[row];
+    }
+    for (row = 0; row < count; row++) {
+      struct blofeld_syx_entry *entry =
+        &entries[block * BLOCK_SOUNDS + row];
+
+      entry->offset = block * BLOCK_SOUNDS + row;
+      entry->bank = rows[row][COL_BANK];
+      entry->program = rows[row][COL_PROGRAM];
+      blofeld_syx_entry_name(entry, rows[row]);
+    }
+  }
+  free(rows);
+  *index = entries;
+  return archive->sounds;
+
+error:
+  free(rows);
+  free(entries);
+  *index = NULL;
+  return -1;
+}
+
+/* Export all sounds in archive */
+int
+blofeld_archive_export(const struct blofeld_archive *archive, int dev_no,
+                       send_func sender, int userdata)
+{
+  unsigned char (*rows)[COLUMNS] = malloc(BLOCK_SOUNDS * sizeof(*rows));
+  unsigned char msg[BLOFELD_SOUND_MSG_LEN];
+  int block, row;
+
+  if (!rows)
+    return -1;
+  /* A block at a time, so only one is ever decoded in memory */
+  for (block = 0; block < archive->blocks; block++) {
+    int count = block_sounds(archive, block);
+
+    if (decode_block(archive, block, rows, count) < 0)
+      goto error;
+    for (row = 0; row < count; row++) {
+      blofeld_sound_dump(msg, rows[row][COL_BANK], rows[row][COL_PROGRAM],
+                         dev_no, rows[row]);
+      if (sender((char *) msg, sizeof(msg), userdata) < 0)
+        goto error;
+    }
+  }
+  free(rows);
+  return archive->sounds;
+
+error:
+  free(rows);
+  return -1;
+}
+
+/* Pack sound dumps in .syx files into new archive */
+int
+blofeld_archive_pack(const char *filename, char * const *files, int count)
+{
+  struct blofeld_archive_writer *writer = blofeld_archive_create(filename);
+  int i, j, ok = 1;
+
+  if (!writer) {
+    eprintf("Can't create %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  for (i = 0; i < count && ok; i++) {
+    struct blofeld_syx_entry *index;
+    struct syx_file file;
+    int sounds;
+
+    if (syx_file_open(&file, files[i]) < 0) {
+      eprintf("Can't open %s: %s\n", files[i], strerror(errno));
+      ok = 0;
+      break;
+    }
+    sounds = blofeld_syx_index(&file, &index);
+    if (sounds < 0)
+      ok = 0;
+    for (j = 0; j < sounds && ok; j++)
+      ok = blofeld_archive_add(writer, index[j].params, index[j].bank,
+                               index[j].program) == 0;
+    xprintf("Archive: %s: %d sounds\n", files[i], sounds);
+    free(index);
+    syx_file_close(&file);
+  }
+  if (!ok) {
+    eprintf("Error writing %s\n", filename);
+    blofeld_archive_finish(writer);
+    unlink(filename);
+    return -1;
+  }
+  return blofeld_archive_finish(writer);
+}
+
+/* Send function for writing dumps to file descriptor */
+static int
+write_dump(char *buf, int len, int fd)
+{
+  return write(fd, buf, len) == len ? 0 : -1;
+}
+
+/* Write all sounds in archive to .syx file */
+int
+blofeld_archive_unpack(const char *filename, const char *syx_filename,
+                       int dev_no)
+{
+  struct blofeld_archive archive;
+  FILE *f;
+  int res;
+
+  if (blofeld_archive_open(&archive, filename) < 0) {
+    eprintf("Can't open archive %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  f = fopen(syx_filename, "wb");
+  if (!f) {
+    eprintf("Can't create %s: %s\n", syx_filename, strerror(errno));
+    blofeld_archive_close(&archive);
+    return -1;
+  }
+  res = blofeld_archive_export(&archive, dev_no, write_dump, fileno(f));
+  if (fclose(f) != 0)
+    res = -1;
+  if (res < 0)
+    eprintf("Error writing %s\n", syx_filename);
+  blofeld_archive_close(&archive);
+  return res;
+}
+
+/*********************** End of file blofeld_archive.c **********************/
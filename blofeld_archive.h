@@ -0,0 +1,97 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_archive.h - Compact archives of Blofeld sounds.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+#ifndef _BLOFELD_ARCHIVE_H_
+#define _BLOFELD_ARCHIVE_H_
+
+#include "syx_file.h"
+#include "blofeld_params.h"
+
+/* Archive opened for reading. The whole file is mapped into memory. */
+struct blofeld_archive {
+  struct syx_file file;
+  int sounds; /* # sounds in archive */
+  int blocks; /* # blocks of sounds */
+  const unsigned char *base; /* base sound, which others are stored against */
+  const unsigned char *index; /* offset of each block */
+};
+
+/* Archive being written */
+struct blofeld_archive_writer;
+
+/* Create archive. Returns NULL if the file could not be created. */
+struct blofeld_archive_writer *blofeld_archive_create(const char *filename);
+
+/* Add sound, with the given parameters (BLOFELD_PARAMS bytes), and bank
+ * and program as in the sound dump. Returns 0 if ok, -1 if write error. */
+int blofeld_archive_add(struct blofeld_archive_writer *writer,
+                        const unsigned char *params, int bank, int program);
+
+/* Finish writing archive, and free writer. Returns number of sounds in
+ * archive, or -1 if the archive could not be written. */
+int blofeld_archive_finish(struct blofeld_archive_writer *writer);
+
+/* Return TRUE (1) if file is an archive */
+int blofeld_archive_is_archive(const struct syx_file *file);
+
+/* Open archive. Returns 0 if ok, -1 if the file could not be opened or is
+ * not an archive (errno is EINVAL). */
+int blofeld_archive_open(struct blofeld_archive *archive,
+                         const char *filename);
+
+/* Close archive */
+void blofeld_archive_close(struct blofeld_archive *archive);
+
+/* Get sound number n in archive. The sound dump (BLOFELD_SOUND_MSG_LEN
+ * bytes) is built in msg, for device dev_no. Returns 0 if ok, -1 if n is
+ * out of range or the archive is corrupt. */
+int blofeld_archive_get(const struct blofeld_archive *archive, int n,
+                        unsigned char *msg, int dev_no);
+
+/* Index archive like blofeld_syx_index, so that a sound can be picked
+ * from it. Only the name and category of each sound are filled in, and
+ * offset is set to its number in the archive, to pass to
+ * blofeld_archive_get. Returns number of entries, or -1 if out of memory
+ * or the archive is corrupt. */
+int blofeld_archive_index(const struct blofeld_archive *archive,
+                          struct blofeld_syx_entry **index);
+
+/* Build dump for each sound in archive in turn, for device dev_no, and
+ * hand it to sender. Returns number of sounds, or -1 if the archive is
+ * corrupt or sender fails. */
+int blofeld_archive_export(const struct blofeld_archive *archive,
+                           int dev_no, send_func sender, int userdata);
+
+/* Pack all sound dumps in the given .syx files into a new archive.
+ * Returns number of sounds packed, or -1 on error. */
+int blofeld_archive_pack(const char *filename, char * const *files,
+                         int count);
+
+/* Write all sounds in archive to .syx file, for device dev_no. Returns
+ * number of sounds written, or -1 on error. */
+int blofeld_archive_unpack(const char *filename, const char *syx_filename,
+                           int dev_no);
+
+#endif /* _BLOFELD_ARCHIVE_H_ */
+
+/*********************** End of file blofeld_archive.h **********************/
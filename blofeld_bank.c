@@ -0,0 +1,424 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_bank.c - Sound bank management for Waldorf Blofeld.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* The Blofeld has 8 banks (A..H) of 128 sounds each. We keep a copy of
+ * the sounds we have fetched from the synth, in order to be able to
+ * back them up, or send them back to the synth at a later time. */
+
+/* Uploading is different from fetching in that the synth does not
+ * acknowledge the sounds we send it, and if we send them too quickly
+ * (it needs to write them to flash) some are silently dropped. So we
+ * send the sounds in groups, and after each group read back the last sound
+ * sent, to check that it arrived intact. If it did, we decrease the time
+ * between sounds a bit, if not, we double it and send the group again. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "param.h"
+#include "blofeld_params.h"
+#include "blofeld_bank.h"
+#include "request_tracker.h"
+#include "syx_file.h"
+#include "timestamp.h"
+
+#include "debug.h"
+
+#define BANK_SOUNDS (BLOFELD_BANKS * BLOFELD_BANK_SIZE)
+
+/* Sound store, indexed by bank * BLOFELD_BANK_SIZE + program */
+struct bank_sound {
+  unsigned char params[BLOFELD_PARAMS];
+  int valid;
+};
+
+static struct bank_sound bank_sounds[BANK_SOUNDS];
+
+/* State of ongoing bank transfer */
+struct bank_transfer {
+  int active;
+  int dev_no;
+  int window; /* max number of requests in flight */
+  int first; /* first sound (index in bank_sounds) in transfer */
+  int last; /* last sound in transfer */
+  int next; /* next sound to request */
+  int in_flight;
+  int generation; /* passed as request ref, to tell transfers apart */
+  long long started; /* timestamp_ms() when transfer started */
+  struct bank_progress progress;
+  bank_progress_cb cb;
+  void *ref;
+};
+
+static struct bank_transfer transfer = { 0 };
+
+/* Generation of latest transfer. Requests from a canceled transfer may
+ * still be in flight when the next one starts, so we ignore replies
+ * tagged with any other generation than the current one. */
+static int fetch_generation = 0;
+
+/* Upload timing, all in ms */
+#define UPLOAD_GAP_START 100 /* initial time between sounds */
+#define UPLOAD_GAP_MIN 20
+#define UPLOAD_GAP_MAX 1000
+#define UPLOAD_GAP_STEP 5 /* decrease after each successful verification */
+/* Number of sounds sent between each verification */
+#define UPLOAD_VERIFY_INTERVAL 8
+
+/* State of ongoing bank upload */
+struct bank_upload {
+  int active;
+  int dev_no;
+  int last; /* last sound in upload */
+  int next; /* next sound to send */
+  int group_start; /* first sound in group currently being sent */
+  int group_sent; /* number of sounds sent so far in group */
+  int last_sent; /* last sound sent, for verification */
+  int verifying; /* set while waiting for readback */
+  int gap;
+  long long next_send; /* timestamp_ms() when to send next sound */
+  long long started;
+  unsigned char expected[BLOFELD_PARAMS]; /* copy of sound being verified */
+  struct bank_progress progress;
+  bank_progress_cb cb;
+  void *ref;
+};
+
+static struct bank_upload upload = { 0 };
+
+/* Forward declaration as request_done and fetch_more call each other */
+static void fetch_more(void);
+
+/* Call progress callback with updated figures */
+static void
+report_progress(void)
+{
+  long long elapsed = timestamp_ms() - transfer.started;
+  struct bank_progress *progress = &transfer.progress;
+
+  progress->rate = elapsed > 0 ? progress->done * 1000.0 / elapsed : 0;
+  if (transfer.cb)
+    transfer.cb(progress, transfer.ref);
+}
+
+/* Called by request tracker when a requested sound has arrived (in which
+ * case it has already been stored by blofeld_bank_store), or the request
+ * has timed out. */
+static void
+request_done(int device, int bank, int buffer, enum request_status status,
+             void *ref)
+{
+  if (!transfer.active) return; /* canceled */
+  if ((long) ref != transfer.generation) return; /* earlier transfer */
+
+  transfer.in_flight--;
+  transfer.progress.done++;
+  if (status != REQUEST_DONE)
+    transfer.progress.failed++;
+
+  if (transfer.progress.done >= transfer.progress.total) {
+    transfer.active = 0;
+    transfer.progress.finished = 1;
+    xprintf("Bank fetch done: %d sounds, %d failed, %.1f sounds/s\n",
+            transfer.progress.done, transfer.progress.failed,
+            transfer.progress.rate);
+  } else
+    fetch_more();
+
+  report_progress();
+}
+
+/* Fill up request window */
+static void
+fetch_more(void)
+{
+  while (transfer.active && transfer.in_flight < transfer.window &&
+         transfer.next <= transfer.last) {
+    int bank = transfer.next / BLOFELD_BANK_SIZE;
+    int program = transfer.next % BLOFELD_BANK_SIZE;
+    int res = blofeld_request_dump(bank, program, transfer.dev_no,
+                                   transfer.in_flight, request_done,
+                                   (void *) (long) transfer.generation);
+    if (res < 0) /* request table full; try again when something arrives */
+      break;
+    /* If the sound had already been requested, our callback has been
+     * attached to that request, so count it as in flight either way. */
+    transfer.next++;
+    transfer.in_flight++;
+  }
+}
+
+/* Start fetching banks from the synth */
+void
+blofeld_bank_fetch(int first_bank, int last_bank, int dev_no, int window,
+                   bank_progress_cb cb, void *ref)
+{
+  if (first_bank < 0 || last_bank >= BLOFELD_BANKS || first_bank > last_bank)
+    return;
+
+  blofeld_bank_cancel();
+
+  memset(&transfer, 0, sizeof(transfer));
+  transfer.dev_no = dev_no;
+  transfer.first = first_bank * BLOFELD_BANK_SIZE;
+  transfer.last = (last_bank + 1) * BLOFELD_BANK_SIZE - 1;
+  transfer.next = transfer.first;
+  transfer.progress.total = transfer.last + 1 - transfer.first;
+  transfer.cb = cb;
+  transfer.ref = ref;
+  transfer.started = timestamp_ms();
+  transfer.generation = ++fetch_generation;
+  transfer.active = 1;
+  blofeld_bank_set_window(window);
+
+  xprintf("Fetching banks %c..%c, window %d\n",
+          'A' + first_bank, 'A' + last_bank, transfer.window);
+
+  fetch_more();
+}
+
+/* Set request window size, taking effect as soon as the next sound
+ * arrives (or immediately, if it was increased). */
+void
+blofeld_bank_set_window(int window)
+{
+  if (window < 1)
+    window = 1;
+  if (window > BLOFELD_BANK_WINDOW_MAX)
+    window = BLOFELD_BANK_WINDOW_MAX;
+  transfer.window = window;
+
+  fetch_more();
+}
+
+/* Cancel ongoing transfer. Any requests already in flight are left to
+ * complete (or time out) by themselves; when they do we ignore them. */
+void
+blofeld_bank_cancel(void)
+{
+  if (transfer.active || upload.active)
+    xprintf("Bank transfer canceled\n");
+  transfer.active = 0;
+  upload.active = 0;
+}
+
+/* Call upload progress callback with updated figures */
+static void
+report_upload_progress(void)
+{
+  long long elapsed = timestamp_ms() - upload.started;
+  struct bank_progress *progress = &upload.progress;
+
+  progress->rate = elapsed > 0 ? progress->done * 1000.0 / elapsed : 0;
+  progress->gap = upload.gap;
+  if (upload.cb)
+    upload.cb(progress, upload.ref);
+}
+
+/* Called by request tracker when the readback of the last sound in a group
+ * has arrived, or timed out. */
+static void
+verify_done(int device, int bank, int buffer, enum request_status status,
+            void *ref)
+{
+  struct bank_sound *sound = &bank_sounds[upload.last_sent];
+  int ok;
+
+  if (!upload.active || !upload.verifying) return; /* canceled */
+
+  upload.verifying = 0;
+  ok = status == REQUEST_DONE &&
+       !memcmp(sound->params, upload.expected, BLOFELD_PARAMS);
+  /* The readback ended up in the bank store; if it was corrupt, put back
+   * what should have been there. */
+  memcpy(sound->params, upload.expected, BLOFELD_PARAMS);
+  sound->valid = 1;
+
+  if (ok) {
+    upload.progress.done += upload.group_sent;
+    upload.gap -= UPLOAD_GAP_STEP;
+    if (upload.gap < UPLOAD_GAP_MIN)
+      upload.gap = UPLOAD_GAP_MIN;
+  } else {
+    upload.progress.failed++;
+    xprintf("Bank upload: verification of %c%03d failed at gap %d ms\n",
+            'A' + upload.last_sent / BLOFELD_BANK_SIZE,
+            upload.last_sent % BLOFELD_BANK_SIZE + 1, upload.gap);
+    if (upload.gap < UPLOAD_GAP_MAX) {
+      /* Slow down and send the whole group again */
+      upload.gap *= 2;
+      if (upload.gap > UPLOAD_GAP_MAX)
+        upload.gap = UPLOAD_GAP_MAX;
+      upload.next = upload.group_start;
+    } else /* Already as slow as we go; give up on this group */
+      upload.progress.done += upload.group_sent;
+  }
+  upload.group_start = upload.next;
+  upload.group_sent = 0;
+  upload.next_send = timestamp_ms() + upload.gap;
+
+  report_upload_progress();
+}
+
+/* Start reading back last sound sent */
+static void
+start_verify(void)
+{
+  memcpy(upload.expected, bank_sounds[upload.last_sent].params,
+         BLOFELD_PARAMS);
+  upload.verifying = 1;
+  if (blofeld_request_dump(upload.last_sent / BLOFELD_BANK_SIZE,
+                           upload.last_sent % BLOFELD_BANK_SIZE,
+                           upload.dev_no, 0, verify_done, NULL) < 0)
+    upload.verifying = 0; /* try again next tick */
+}
+
+/* Called periodically; send next sound or start verification when it's
+ * time to do so. */
+void
+blofeld_bank_timer(void)
+{
+  if (!upload.active || upload.verifying) return;
+  if (timestamp_ms() < upload.next_send) return;
+
+  /* Skip sounds we don't have */
+  while (upload.next <= upload.last && !bank_sounds[upload.next].valid)
+    upload.next++;
+
+  if (upload.group_sent >= UPLOAD_VERIFY_INTERVAL ||
+      (upload.next > upload.last && upload.group_sent > 0)) {
+    start_verify();
+    return;
+  }
+
+  if (upload.next > upload.last) {
+    upload.active = 0;
+    upload.progress.finished = 1;
+    report_upload_progress();
+    xprintf("Bank upload done: %d sounds, %d failed verifications, "
+            "%.1f sounds/s, final gap %d ms\n",
+            upload.progress.done, upload.progress.failed,
+            upload.progress.rate, upload.gap);
+    return;
+  }
+
+  blofeld_send_sound(upload.next / BLOFELD_BANK_SIZE,
+                     upload.next % BLOFELD_BANK_SIZE, upload.dev_no,
+                     bank_sounds[upload.next].params);
+  upload.last_sent = upload.next++;
+  upload.group_sent++;
+  upload.next_send = timestamp_ms() + upload.gap;
+}
+
+/* Start uploading banks to the synth */
+void
+blofeld_bank_upload(int first_bank, int last_bank, int dev_no,
+                    bank_progress_cb cb, void *ref)
+{
+  int sound;
+
+  if (first_bank < 0 || last_bank >= BLOFELD_BANKS || first_bank > last_bank)
+    return;
+
+  blofeld_bank_cancel();
+
+  memset(&upload, 0, sizeof(upload));
+  upload.dev_no = dev_no;
+  upload.next = upload.group_start = first_bank * BLOFELD_BANK_SIZE;
+  upload.last = (last_bank + 1) * BLOFELD_BANK_SIZE - 1;
+  for (sound = upload.next; sound <= upload.last; sound++)
+    if (bank_sounds[sound].valid)
+      upload.progress.total++;
+  upload.gap = UPLOAD_GAP_START;
+  upload.cb = cb;
+  upload.ref = ref;
+  upload.started = upload.next_send = timestamp_ms();
+  upload.active = 1;
+
+  xprintf("Uploading %d sounds to banks %c..%c\n",
+          upload.progress.total, 'A' + first_bank, 'A' + last_bank);
+}
+
+/* Store sound in bank store */
+void
+blofeld_bank_store(int bank, int program, const unsigned char *params)
+{
+  if (bank < 0 || bank >= BLOFELD_BANKS ||
+      program < 0 || program >= BLOFELD_BANK_SIZE)
+    return;
+
+  struct bank_sound *sound = &bank_sounds[bank * BLOFELD_BANK_SIZE + program];
+
+  memcpy(sound->params, params, BLOFELD_PARAMS);
+  sound->valid = 1;
+}
+
+/* Get sound from bank store */
+const unsigned char *
+blofeld_bank_sound(int bank, int program)
+{
+  if (bank < 0 || bank >= BLOFELD_BANKS ||
+      program < 0 || program >= BLOFELD_BANK_SIZE)
+    return NULL;
+
+  struct bank_sound *sound = &bank_sounds[bank * BLOFELD_BANK_SIZE + program];
+
+  return sound->valid ? sound->params : NULL;
+}
+
+/* Save sounds in bank store to .syx file. All dumps are built in one
+ * buffer, so the whole file is written in one go. */
+int
+blofeld_bank_save(int first_bank, int last_bank, int dev_no,
+                  const char *filename)
+{
+  unsigned char *buf, *msg;
+  int i, count = 0, res;
+
+  if (first_bank < 0 || last_bank >= BLOFELD_BANKS || first_bank > last_bank)
+    return -1;
+
+  buf = malloc((last_bank - first_bank + 1) * BLOFELD_BANK_SIZE *
+               BLOFELD_SOUND_MSG_LEN);
+  if (!buf)
+    return -1;
+  msg = buf;
+  for (i = first_bank * BLOFELD_BANK_SIZE;
+       i < (last_bank + 1) * BLOFELD_BANK_SIZE; i++) {
+    if (!bank_sounds[i].valid)
+      continue;
+    blofeld_sound_dump(msg, i / BLOFELD_BANK_SIZE, i % BLOFELD_BANK_SIZE,
+                       dev_no, bank_sounds[i].params);
+    msg += BLOFELD_SOUND_MSG_LEN;
+    count++;
+  }
+  res = count ? syx_file_write(filename, buf, msg - buf) : 0;
+  free(buf);
+  if (res < 0)
+    return -1;
+
+  xprintf("Saved %d sounds in banks %c..%c to %s\n",
+          count, 'A' + first_bank, 'A' + last_bank, filename);
+  return count;
+}
+
+/************************ End of file blofeld_bank.c ************************/
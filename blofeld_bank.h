@@ -0,0 +1,78 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_bank.h - Sound bank management for Waldorf Blofeld.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _BLOFELD_BANK_H_
+#define _BLOFELD_BANK_H_
+
+/* Default and max number of requests in flight during bank transfers */
+#define BLOFELD_BANK_WINDOW_DEFAULT 4
+#define BLOFELD_BANK_WINDOW_MAX 32
+
+/* Progress of bank transfer, passed to progress callback */
+struct bank_progress {
+  int done;     /* number of sounds handled so far, including failed ones */
+  int total;    /* total number of sounds in transfer */
+  int failed;   /* fetch: sounds which timed out; upload: failed verifications */
+  double rate;  /* sounds per second so far */
+  int gap;      /* upload: current time between sounds, in ms */
+  int finished; /* set when the transfer has finished */
+};
+
+/* Progress callback, called each time a sound has been transferred */
+typedef void (*bank_progress_cb)(const struct bank_progress *progress,
+                                 void *ref);
+
+/* Fetch all sounds in banks first_bank..last_bank (0 = A .. 7 = H) from
+ * Blofeld, with max 'window' requests in flight at any time. */
+void blofeld_bank_fetch(int first_bank, int last_bank, int dev_no, int window,
+                        bank_progress_cb cb, void *ref);
+
+/* Upload all sounds we have in banks first_bank..last_bank to Blofeld,
+ * adapting the upload rate to what the synth can take. */
+void blofeld_bank_upload(int first_bank, int last_bank, int dev_no,
+                         bank_progress_cb cb, void *ref);
+
+/* Called periodically to drive uploads. */
+void blofeld_bank_timer(void);
+
+/* Set max number of requests in flight. Can be changed during transfer. */
+void blofeld_bank_set_window(int window);
+
+/* Cancel fetch or upload in progress. */
+void blofeld_bank_cancel(void);
+
+/* Store sound dump data received from synth in bank store. */
+void blofeld_bank_store(int bank, int program, const unsigned char *params);
+
+/* Return stored sound parameters, or NULL if we don't have the sound. */
+const unsigned char *blofeld_bank_sound(int bank, int program);
+
+/* Save all sounds we have in banks first_bank..last_bank to .syx file,
+ * replacing it atomically if it exists. Returns number of sounds saved,
+ * or -1 if the file could not be written, with errno set. If there are
+ * no sounds, nothing is written. */
+int blofeld_bank_save(int first_bank, int last_bank, int dev_no,
+                      const char *filename);
+
+#endif /* _BLOFELD_BANK_H_ */
+
+/************************ End of file blofeld_bank.h ************************/
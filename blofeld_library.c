@@ -0,0 +1,1159 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_library.c - Index of a library of Blofeld sound files.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* A library is a directory tree of .syx files. For each sound dump in
+ * them, the index records the file it is in and where, its name and
+ * category, hashes of its contents, and the sound parameters themselves.
+ * The index file consists of a header followed by the file records, the
+ * sound records, the sound parameters and the path names, exactly as they
+ * are kept in memory, so at startup it is just
+ * mapped into memory, and the library can be browsed right away. The
+ * mapping is private, so changes to the records don't touch the file;
+ * the records are only copied to allocated memory when they need to grow.
+ *
+ * While we run, changes to the library are picked up using inotify, and
+ * only the files that change are read. Since files can also change while
+ * we're not running, the tree is walked in the background after startup,
+ * a batch of directory entries per timer tick, comparing each file's
+ * modification time and size with the index; again, only files which
+ * differ are read. The index is saved some time after the last change,
+ * leaving out removed files and sounds.
+ *
+ * Reading and indexing files is done by the worker pool, so that even
+ * a library of thousands of new files doesn't hold up the UI or MIDI.
+ * The worker only reads the file; the sounds are added to the library
+ * in the main thread when it is done, so the library itself is only
+ * ever touched by the main thread. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include "param.h"
+#include "blofeld_params.h"
+#include "blofeld_library.h"
+#include "syx_file.h"
+#include "timestamp.h"
+#include "worker_pool.h"
+
+#include "debug.h"
+
+#define INDEX_MAGIC "XTLB"
+#define INDEX_VERSION 4
+
+/* Max number of directory entries looked at per timer tick when walking */
+#define WALK_BATCH 200
+
+/* Max number of files being indexed at a time; walking waits when there
+ * are this many, so as not to queue up the whole library at once. */
+#define JOBS_MAX 64
+
+/* Index is saved this long (ms) after the last change */
+#define SAVE_DELAY 5000
+
+/* Events we want to know about for each directory in the library */
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+                    IN_DELETE | IN_CREATE | IN_ONLYDIR)
+
+/* Header of index file */
+struct index_header {
+  char magic[4];
+  int version;
+  unsigned long long root_hash; /* of library root path */
+  int files;
+  int patches;
+  int strings; /* bytes of path names */
+};
+
+/* File record */
+struct library_file {
+  long long mtime; /* in ns, as a whole second isn't enough to go by */
+  long long size;
+  int path; /* offset in path names */
+  int first; /* first sound record */
+  int count; /* # sound records; -1 if file has been removed */
+  unsigned int job; /* serial of job that read the sounds; 0 in index file */
+};
+
+static struct {
+  char root[PATH_MAX];
+  unsigned long long root_hash;
+  char index_file[PATH_MAX];
+  void *map; /* mapped index file, if any */
+  size_t map_size;
+  /* Records, either in the mapping, or allocated if size is nonzero */
+  struct library_file *files;
+  int nfiles, files_size;
+  struct blofeld_library_patch *patches;
+  int npatches, patches_size;
+  unsigned char *params; /* BLOFELD_PARAMS per sound record */
+  int params_size; /* in sound records */
+  char *strings;
+  int nstrings, strings_size;
+  int live_patches; /* # patches not removed */
+  /* Hash table of paths, for finding file records; file index + 1 */
+  int *table;
+  int table_size; /* power of 2 */
+  unsigned int generation; /* bumped on every change */
+  unsigned int session; /* bumped when library is closed */
+  /* Indexing */
+  struct worker_group *jobs;
+  unsigned int job_serial; /* of latest job started */
+  int pending; /* # files being indexed */
+  blofeld_library_status_cb status_cb;
+  void *status_ref;
+  /* Saving */
+  int dirty;
+  long long changed; /* timestamp_ms() of last change */
+  /* Walking */
+  char **dirs; /* directories left to walk */
+  int ndirs, dirs_size;
+  DIR *dir; /* directory being walked */
+  char dir_path[PATH_MAX];
+  int walking;
+  int full_walk; /* walking whole tree; files not seen have been removed */
+  unsigned char *seen; /* per file, during full walk */
+  int seen_size;
+  /* inotify */
+  int inotify_fd;
+  char **watches; /* directory path per watch descriptor */
+  int watches_size;
+} lib = { .inotify_fd = -1 };
+
+/* 64 bit FNV-1a hash of string */
+static unsigned long long
+hash_string(const char *s)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+
+  while (*s) {
+    hash ^= (unsigned char) *s++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* Make room for at least needed elements of elem_size in *array, which
+ * currently has count elements and room for *size. If *size is 0, the
+ * array is in the mapped index, and is copied. Returns 0 if ok. */
+static int
+grow(void *array, int *size, int count, int needed, size_t elem_size)
+{
+  void **p = array;
+  void *new_array;
+  int new_size;
+
+  if (needed <= *size)
+    return 0;
+  new_size = *size ? *size : 64;
+  while (new_size < needed)
+    new_size *= 2;
+  if (*size)
+    new_array = realloc(*p, new_size * elem_size);
+  else {
+    new_array = malloc(new_size * elem_size);
+    if (new_array && count)
+      memcpy(new_array, *p, count * elem_size);
+  }
+  if (!new_array) {
+    eprintf("Out of memory for library index\n");
+    return -1;
+  }
+  *p = new_array;
+  *size = new_size;
+  return 0;
+}
+
+/* Return path of file record */
+static const char *
+file_path(int file)
+{
+  return &lib.strings[lib.files[file].path];
+}
+
+/* Build full path name from path relative to library root */
+static const char *
+full_path(char *buf, int size, const char *path)
+{
+  if (snprintf(buf, size, "%s%s%s", lib.root, path[0] ? "/" : "", path) >=
+      size)
+    return NULL;
+  return buf;
+}
+
+/* Insert file record in hash table, which must have room for it */
+static void
+table_insert(int file)
+{
+  unsigned int mask = lib.table_size - 1;
+  unsigned int i = hash_string(file_path(file)) & mask;
+
+  while (lib.table[i])
+    i = (i + 1) & mask;
+  lib.table[i] = file + 1;
+}
+
+/* Make room in hash table for at least files entries, keeping it at most
+ * half full. Returns 0 if ok. */
+static int
+table_reserve(int files)
+{
+  int size = lib.table_size ? lib.table_size : 256;
+  int file;
+
+  while (size < files * 2)
+    size *= 2;
+  if (size == lib.table_size)
+    return 0;
+
+  free(lib.table);
+  lib.table = calloc(size, sizeof(*lib.table));
+  if (!lib.table) {
+    lib.table_size = 0;
+    eprintf("Out of memory for library index\n");
+    return -1;
+  }
+  lib.table_size = size;
+  for (file = 0; file < lib.nfiles; file++)
+    table_insert(file);
+  return 0;
+}
+
+/* Find file record for path, returning -1 if there isn't one */
+static int
+find_file(const char *path)
+{
+  unsigned int mask = lib.table_size - 1;
+  unsigned int i;
+
+  if (!lib.table_size)
+    return -1;
+  for (i = hash_string(path) & mask; lib.table[i]; i = (i + 1) & mask)
+    if (!strcmp(file_path(lib.table[i] - 1), path))
+      return lib.table[i] - 1;
+  return -1;
+}
+
+/* Add file record for path. Returns file index, or -1 if out of memory. */
+static int
+add_file(const char *path)
+{
+  int len = strlen(path) + 1;
+  struct library_file *file;
+
+  if (grow(&lib.files, &lib.files_size, lib.nfiles, lib.nfiles + 1,
+           sizeof(*lib.files)) < 0 ||
+      grow(&lib.strings, &lib.strings_size, lib.nstrings, lib.nstrings + len,
+           1) < 0 ||
+      table_reserve(lib.nfiles + 1) < 0)
+    return -1;
+
+  file = &lib.files[lib.nfiles];
+  memset(file, 0, sizeof(*file));
+  file->path = lib.nstrings;
+  file->count = -1;
+  memcpy(&lib.strings[lib.nstrings], path, len);
+  lib.nstrings += len;
+  table_insert(lib.nfiles);
+
+  return lib.nfiles++;
+}
+
+/* Return modification time of file, in ns */
+static long long
+stat_mtime(const struct stat *st)
+{
+  return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/* Note that the library has changed */
+static void
+changed(void)
+{
+  lib.dirty = 1;
+  lib.changed = timestamp_ms();
+  lib.generation++;
+}
+
+/* Remove sounds of file from library */
+static void
+remove_patches(struct library_file *file)
+{
+  int i;
+
+  for (i = 0; i < file->count; i++)
+    lib.patches[file->first + i].file = -1;
+  if (file->count > 0)
+    lib.live_patches -= file->count;
+  file->count = 0;
+}
+
+/* Remove file from library */
+static void
+remove_file(int file)
+{
+  if (lib.files[file].count < 0)
+    return;
+  xprintf("Library: removed %s\n", file_path(file));
+  remove_patches(&lib.files[file]);
+  lib.files[file].count = -1;
+  changed();
+}
+
+/* File being indexed by worker */
+struct index_job {
+  unsigned int session; /* lib.session when started */
+  unsigned int serial; /* jobs started later have higher serials */
+  long long mtime, size; /* of file when started */
+  char *path; /* relative to library root */
+  char name[PATH_MAX]; /* full path */
+  /* Result */
+  int count; /* # sounds, or -1 if out of memory */
+  struct blofeld_syx_entry *index;
+  unsigned char *params; /* BLOFELD_PARAMS per sound */
+};
+
+/* Tell status callback something has happened */
+static void
+report_status(void)
+{
+  struct blofeld_library_status status;
+
+  if (!lib.status_cb)
+    return;
+  blofeld_library_get_status(&status);
+  lib.status_cb(&status, lib.status_ref);
+}
+
+/* Free index job */
+static void
+free_job(struct index_job *job)
+{
+  free(job->path);
+  free(job->index);
+  free(job->params);
+  free(job);
+}
+
+/* Read and index file; run by worker. Only the job is touched here. */
+static void
+index_job_work(void *data)
+{
+  struct index_job *job = data;
+  struct syx_file syx;
+  int i;
+
+  if (syx_file_open(&syx, job->name) < 0)
+    memset(&syx, 0, sizeof(syx)); /* keep the file record, with no sounds */
+  job->count = blofeld_syx_index(&syx, &job->index);
+  /* The index entries point into the file, so the sounds are copied
+   * before it is unmapped. */
+  if (job->count > 0) {
+    job->params = malloc(job->count * BLOFELD_PARAMS);
+    if (!job->params)
+      job->count = -1;
+    for (i = 0; i < job->count; i++)
+      memcpy(&job->params[i * BLOFELD_PARAMS], job->index[i].params,
+             BLOFELD_PARAMS);
+  }
+  syx_file_close(&syx);
+}
+
+/* Add sounds of indexed file to library, replacing any sounds we already
+ * had for it. The new sound records are added at the end. */
+static void
+add_sounds(struct index_job *job)
+{
+  struct library_file *file;
+  int f = find_file(job->path);
+  int i;
+
+  if (f < 0 && (f = add_file(job->path)) < 0)
+    return;
+  /* Jobs can finish in any order; don't let an earlier job for the file
+   * replace what a later one has found. */
+  if (lib.files[f].job > job->serial)
+    return;
+  if (grow(&lib.patches, &lib.patches_size, lib.npatches,
+           lib.npatches + job->count, sizeof(*lib.patches)) < 0 ||
+      grow(&lib.params, &lib.params_size, lib.npatches,
+           lib.npatches + job->count, BLOFELD_PARAMS) < 0)
+    return;
+
+  file = &lib.files[f];
+  remove_patches(file);
+  file->mtime = job->mtime;
+  file->size = job->size;
+  file->job = job->serial;
+  file->first = lib.npatches;
+  file->count = job->count;
+  if (job->count)
+    memcpy(&lib.params[lib.npatches * BLOFELD_PARAMS], job->params,
+           job->count * BLOFELD_PARAMS);
+  for (i = 0; i < job->count; i++) {
+    struct blofeld_library_patch *patch = &lib.patches[lib.npatches++];
+    const struct blofeld_syx_entry *entry = &job->index[i];
+
+    patch->hash = entry->hash;
+    patch->sound_hash = entry->sound_hash;
+    patch->file = f;
+    patch->offset = entry->offset;
+    memcpy(patch->name, entry->name, sizeof(patch->name));
+    patch->category = entry->category;
+    patch->bank = entry->bank;
+    patch->program = entry->program;
+  }
+  lib.live_patches += job->count;
+  xprintf("Library: indexed %s, %d sounds\n", job->path, job->count);
+  changed();
+}
+
+/* Indexing of file done; called in main thread */
+static void
+index_job_done(void *data, int canceled)
+{
+  struct index_job *job = data;
+  struct stat st;
+
+  /* Jobs for a library which has since been closed are just dropped */
+  if (job->session == lib.session) {
+    lib.pending--;
+    /* If the file has changed while being read, we'll hear about it, and
+     * index it again. */
+    if (!canceled && job->count >= 0 && stat(job->name, &st) == 0 &&
+        stat_mtime(&st) == job->mtime && st.st_size == job->size)
+      add_sounds(job);
+  }
+  free_job(job);
+}
+
+/* Progress of indexing; called in main thread */
+static void
+index_progress(const struct worker_progress *progress, void *ref)
+{
+  report_status();
+}
+
+/* (Re)index file, with the given stat data. The file is read by a
+ * worker, and the sounds added to the library when it is done. */
+static void
+index_file(const char *path, const struct stat *st)
+{
+  struct index_job *job = calloc(1, sizeof(*job));
+
+  if (!job)
+    return;
+  job->session = lib.session;
+  job->serial = ++lib.job_serial;
+  job->mtime = stat_mtime(st);
+  job->size = st->st_size;
+  job->path = strdup(path);
+  if (!job->path || !full_path(job->name, sizeof(job->name), path)) {
+    free_job(job);
+    return;
+  }
+  lib.pending++;
+  if (worker_submit(lib.jobs, index_job_work, index_job_done, job) < 0) {
+    lib.pending--;
+    free_job(job);
+  }
+}
+
+/* Return 1 if name ends in .syx */
+static int
+is_syx(const char *name)
+{
+  int len = strlen(name);
+
+  return len > 4 && !strcasecmp(&name[len - 4], ".syx");
+}
+
+/* Add directory to list of directories to walk */
+static void
+push_dir(const char *path)
+{
+  char *dir = strdup(path);
+
+  if (!dir || grow(&lib.dirs, &lib.dirs_size, lib.ndirs, lib.ndirs + 1,
+                   sizeof(*lib.dirs)) < 0) {
+    free(dir);
+    return;
+  }
+  lib.dirs[lib.ndirs++] = dir;
+  lib.walking = 1;
+}
+
+/* Look at directory entry found when walking, or reported by inotify */
+static void
+check_entry(const char *path)
+{
+  char name[PATH_MAX];
+  struct stat st;
+  int f;
+
+  if (!full_path(name, sizeof(name), path) || lstat(name, &st) < 0)
+    return;
+  if (S_ISDIR(st.st_mode)) {
+    push_dir(path);
+    return;
+  }
+  if (!S_ISREG(st.st_mode) || !is_syx(path))
+    return;
+
+  f = find_file(path);
+  if (f < 0 || lib.files[f].count < 0 ||
+      lib.files[f].mtime != stat_mtime(&st) ||
+      lib.files[f].size != st.st_size) {
+    index_file(path, &st);
+    f = find_file(path); /* if it was new, and indexed right away */
+  }
+  if (f >= 0 && f < lib.seen_size)
+    lib.seen[f] = 1;
+}
+
+/* Start watching directory for changes */
+static void
+add_watch(const char *path)
+{
+  static int warned = 0;
+  char name[PATH_MAX];
+  int wd;
+
+  if (lib.inotify_fd < 0 || !full_path(name, sizeof(name), path))
+    return;
+  wd = inotify_add_watch(lib.inotify_fd, name, WATCH_MASK);
+  if (wd < 0) {
+    if (!warned++)
+      eprintf("Warning: Can't watch library directory %s: %s\n",
+              name, strerror(errno));
+    return;
+  }
+  if (wd >= lib.watches_size) {
+    int new_size = lib.watches_size ? lib.watches_size : 64;
+    char **new_watches;
+
+    while (new_size <= wd)
+      new_size *= 2;
+    new_watches = realloc(lib.watches, new_size * sizeof(*new_watches));
+    if (!new_watches)
+      return;
+    memset(&new_watches[lib.watches_size], 0,
+           (new_size - lib.watches_size) * sizeof(*new_watches));
+    lib.watches = new_watches;
+    lib.watches_size = new_size;
+  }
+  free(lib.watches[wd]); /* same directory watched again */
+  lib.watches[wd] = strdup(path);
+}
+
+/* Start walking whole library, to find changes made while we were not
+ * watching it. */
+static void
+walk_start(void)
+{
+  free(lib.seen);
+  lib.seen_size = lib.nfiles;
+  lib.seen = calloc(lib.seen_size ? lib.seen_size : 1, 1);
+  if (!lib.seen) {
+    lib.seen_size = 0;
+    return;
+  }
+  lib.full_walk = 1;
+  push_dir("");
+  xprintf("Library: walking %s\n", lib.root);
+}
+
+/* Done walking. After a full walk, files we haven't seen are gone. */
+static void
+walk_done(void)
+{
+  int f;
+
+  lib.walking = 0;
+  if (!lib.full_walk)
+    return;
+  for (f = 0; f < lib.seen_size; f++)
+    if (!lib.seen[f])
+      remove_file(f);
+  free(lib.seen);
+  lib.seen = NULL;
+  lib.seen_size = 0;
+  lib.full_walk = 0;
+  xprintf("Library: %d sounds in %d files\n", lib.live_patches, lib.nfiles);
+  report_status();
+}
+
+/* Walk a batch of directory entries */
+static void
+walk_step(void)
+{
+  char path[PATH_MAX];
+  int n;
+
+  for (n = 0; n < WALK_BATCH && lib.pending < JOBS_MAX; n++) {
+    struct dirent *entry;
+
+    if (!lib.dir) {
+      char name[PATH_MAX];
+      char *dir;
+
+      if (!lib.ndirs) {
+        walk_done();
+        return;
+      }
+      dir = lib.dirs[--lib.ndirs];
+      snprintf(lib.dir_path, sizeof(lib.dir_path), "%s", dir);
+      free(dir);
+      if (full_path(name, sizeof(name), lib.dir_path))
+        lib.dir = opendir(name);
+      if (!lib.dir)
+        continue;
+      add_watch(lib.dir_path);
+    }
+
+    entry = readdir(lib.dir);
+    if (!entry) {
+      closedir(lib.dir);
+      lib.dir = NULL;
+      continue;
+    }
+    if (entry->d_name[0] == '.') /* also skips . and .. */
+      continue;
+    if (snprintf(path, sizeof(path), "%s%s%s", lib.dir_path,
+                 lib.dir_path[0] ? "/" : "", entry->d_name) < sizeof(path))
+      check_entry(path);
+  }
+}
+
+/* Remove all files in directory tree which has disappeared */
+static void
+remove_tree(const char *path)
+{
+  int len = strlen(path);
+  int f;
+
+  for (f = 0; f < lib.nfiles; f++)
+    if (!strncmp(file_path(f), path, len) && file_path(f)[len] == '/')
+      remove_file(f);
+}
+
+/* Handle changes reported by inotify */
+static void
+handle_events(void)
+{
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  char path[PATH_MAX];
+  const struct inotify_event *event;
+  ssize_t len;
+  char *p;
+
+  if (lib.inotify_fd < 0)
+    return;
+
+  while ((len = read(lib.inotify_fd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; p += sizeof(*event) + event->len) {
+      event = (const struct inotify_event *) p;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        /* Lost track; find out what has changed the hard way */
+        if (!lib.full_walk)
+          walk_start();
+        continue;
+      }
+      if (event->wd < 0 || event->wd >= lib.watches_size ||
+          !lib.watches[event->wd])
+        continue;
+      if (event->mask & IN_IGNORED) { /* watch removed */
+        free(lib.watches[event->wd]);
+        lib.watches[event->wd] = NULL;
+        continue;
+      }
+      if (!event->len || event->name[0] == '.' ||
+          snprintf(path, sizeof(path), "%s%s%s", lib.watches[event->wd],
+                   lib.watches[event->wd][0] ? "/" : "", event->name) >=
+          sizeof(path))
+        continue;
+
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (event->mask & IN_ISDIR)
+          remove_tree(path);
+        else if (find_file(path) >= 0)
+          remove_file(find_file(path));
+      } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO) ||
+                 (event->mask & (IN_CREATE | IN_ISDIR)) ==
+                 (IN_CREATE | IN_ISDIR))
+        check_entry(path);
+    }
+  }
+}
+
+/* Load index file, if it is there and valid */
+static void
+load_index(void)
+{
+  const struct index_header *h;
+  struct stat st;
+  size_t size;
+  char *p;
+  int fd, i;
+
+  fd = open(lib.index_file, O_RDONLY);
+  if (fd < 0)
+    return;
+  if (fstat(fd, &st) < 0 || st.st_size < sizeof(*h)) {
+    close(fd);
+    return;
+  }
+  /* Private and writable: changes stay in memory */
+  lib.map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fd, 0);
+  close(fd);
+  if (lib.map == MAP_FAILED) {
+    lib.map = NULL;
+    return;
+  }
+  lib.map_size = st.st_size;
+
+  h = lib.map;
+  if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) ||
+      h->version != INDEX_VERSION || h->root_hash != lib.root_hash ||
+      h->files < 0 || h->patches < 0 || h->strings < 0)
+    goto invalid;
+  size = sizeof(*h) + (size_t) h->files * sizeof(*lib.files) +
+         (size_t) h->patches * (sizeof(*lib.patches) + BLOFELD_PARAMS) +
+         h->strings;
+  if (size != lib.map_size)
+    goto invalid;
+
+  p = (char *) lib.map + sizeof(*h);
+  lib.files = (struct library_file *) p;
+  p += h->files * sizeof(*lib.files);
+  lib.patches = (struct blofeld_library_patch *) p;
+  p += h->patches * sizeof(*lib.patches);
+  lib.params = (unsigned char *) p;
+  p += h->patches * BLOFELD_PARAMS;
+  lib.strings = p;
+  if (h->strings && lib.strings[h->strings - 1])
+    goto invalid;
+
+  for (i = 0; i < h->files; i++) {
+    const struct library_file *file = &lib.files[i];
+    if (file->path < 0 || file->path >= h->strings || file->count < -1 ||
+        file->first < 0 || file->first + file->count > h->patches)
+      goto invalid;
+  }
+  lib.nfiles = h->files;
+  lib.npatches = h->patches;
+  lib.nstrings = h->strings;
+  for (i = 0; i < h->patches; i++) {
+    if (lib.patches[i].file < -1 || lib.patches[i].file >= h->files)
+      goto invalid;
+    if (lib.patches[i].file >= 0)
+      lib.live_patches++;
+  }
+  if (table_reserve(lib.nfiles) < 0)
+    goto invalid;
+  xprintf("Library: loaded index, %d sounds in %d files\n",
+          lib.live_patches, lib.nfiles);
+  return;
+
+invalid:
+  xprintf("Library: ignoring invalid index %s\n", lib.index_file);
+  munmap(lib.map, lib.map_size);
+  lib.map = NULL;
+  lib.files = NULL;
+  lib.patches = NULL;
+  lib.params = NULL;
+  lib.strings = NULL;
+  lib.nfiles = lib.npatches = lib.nstrings = lib.live_patches = 0;
+}
+
+/* Save index, leaving out removed files and sounds. We write to a
+ * temporary file first, so that the index is always complete. */
+static void
+save_index(void)
+{
+  struct index_header h;
+  char tmp_file[PATH_MAX];
+  FILE *f;
+  int i, ok = 1;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+  h.version = INDEX_VERSION;
+  h.root_hash = lib.root_hash;
+  for (i = 0; i < lib.nfiles; i++)
+    if (lib.files[i].count >= 0) {
+      h.files++;
+      h.patches += lib.files[i].count;
+      h.strings += strlen(file_path(i)) + 1;
+    }
+  if (snprintf(tmp_file, sizeof(tmp_file), "%s.%d", lib.index_file,
+               getpid()) >= sizeof(tmp_file))
+    return;
+  f = fopen(tmp_file, "w");
+  if (!f) {
+    xprintf("Can't write library index %s\n", lib.index_file);
+    return;
+  }
+
+  ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  { /* file records, renumbered */
+    int first = 0, path = 0;
+
+    for (i = 0; i < lib.nfiles && ok; i++) {
+      struct library_file file = lib.files[i];
+
+      if (file.count < 0) continue;
+      file.first = first;
+      file.path = path;
+      file.job = 0; /* job serials start over next time */
+      ok = fwrite(&file, sizeof(file), 1, f) == 1;
+      first += file.count;
+      path += strlen(file_path(i)) + 1;
+    }
+  }
+  { /* sound records, pointing to renumbered file records */
+    int file_no = 0;
+
+    for (i = 0; i < lib.nfiles && ok; i++) {
+      const struct library_file *file = &lib.files[i];
+      int j;
+
+      if (file->count < 0) continue;
+      for (j = 0; j < file->count && ok; j++) {
+        struct blofeld_library_patch patch = lib.patches[file->first + j];
+
+        patch.file = file_no;
+        ok = fwrite(&patch, sizeof(patch), 1, f) == 1;
+      }
+      file_no++;
+    }
+  }
+  for (i = 0; i < lib.nfiles && ok; i++) /* sound parameters */
+    if (lib.files[i].count > 0)
+      ok = fwrite(&lib.params[lib.files[i].first * BLOFELD_PARAMS],
+                  BLOFELD_PARAMS, lib.files[i].count, f) ==
+           lib.files[i].count;
+  for (i = 0; i < lib.nfiles && ok; i++)
+    if (lib.files[i].count >= 0)
+      ok = fwrite(file_path(i), strlen(file_path(i)) + 1, 1, f) == 1;
+
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp_file, lib.index_file) < 0) {
+    xprintf("Can't write library index %s\n", lib.index_file);
+    unlink(tmp_file);
+    return;
+  }
+  lib.dirty = 0;
+  xprintf("Library: saved index, %d sounds in %d files\n",
+          h.patches, h.files);
+}
+
+/* Open library */
+int
+blofeld_library_open(const char *root)
+{
+  char cache_dir[PATH_MAX];
+  struct stat st;
+  int len;
+
+  blofeld_library_close();
+
+  if (stat(root, &st) < 0 || !S_ISDIR(st.st_mode)) {
+    eprintf("Library %s is not a directory\n", root);
+    return -1;
+  }
+  if (!realpath(root, lib.root))
+    return -1;
+  len = strlen(lib.root);
+  if (len > 1 && lib.root[len - 1] == '/')
+    lib.root[len - 1] = '\0';
+  lib.root_hash = hash_string(lib.root);
+
+  /* One index per library root */
+  if (!blofeld_cache_dirname(cache_dir, sizeof(cache_dir)) &&
+      snprintf(lib.index_file, sizeof(lib.index_file),
+               "%s/library-%016llx.idx", cache_dir, lib.root_hash) <
+      sizeof(lib.index_file)) {
+    mkdir(cache_dir, 0755); /* usually there already */
+    load_index();
+  } else
+    lib.index_file[0] = '\0';
+
+  lib.jobs = worker_group_new(index_progress, NULL);
+  if (!lib.jobs) {
+    eprintf("Out of memory for library\n");
+    blofeld_library_close();
+    return -1;
+  }
+
+  lib.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (lib.inotify_fd < 0)
+    eprintf("Warning: Can't watch library for changes: %s\n",
+            strerror(errno));
+
+  walk_start();
+
+  return 0;
+}
+
+/* Save index and close library */
+void
+blofeld_library_close(void)
+{
+  unsigned int generation, session;
+  blofeld_library_status_cb status_cb;
+  void *status_ref;
+  int i;
+
+  if (!lib.root[0])
+    return;
+
+  /* Files still being read are not waited for */
+  if (lib.jobs)
+    worker_group_free(lib.jobs);
+
+  if (lib.dirty && lib.index_file[0])
+    save_index();
+
+  if (lib.inotify_fd >= 0)
+    close(lib.inotify_fd);
+  for (i = 0; i < lib.watches_size; i++)
+    free(lib.watches[i]);
+  free(lib.watches);
+  if (lib.dir)
+    closedir(lib.dir);
+  for (i = 0; i < lib.ndirs; i++)
+    free(lib.dirs[i]);
+  free(lib.dirs);
+  free(lib.seen);
+  free(lib.table);
+  if (lib.files_size) free(lib.files);
+  if (lib.patches_size) free(lib.patches);
+  if (lib.params_size) free(lib.params);
+  if (lib.strings_size) free(lib.strings);
+  if (lib.map)
+    munmap(lib.map, lib.map_size);
+
+  generation = lib.generation;
+  session = lib.session;
+  status_cb = lib.status_cb;
+  status_ref = lib.status_ref;
+  memset(&lib, 0, sizeof(lib));
+  lib.inotify_fd = -1;
+  lib.generation = generation + 1; /* whatever we had is gone */
+  lib.session = session + 1;
+  lib.status_cb = status_cb;
+  lib.status_ref = status_ref;
+}
+
+/* Return number of sound records */
+int
+blofeld_library_size(void)
+{
+  return lib.npatches;
+}
+
+/* Return sound record */
+const struct blofeld_library_patch *
+blofeld_library_patch(int index)
+{
+  if (index < 0 || index >= lib.npatches || lib.patches[index].file < 0)
+    return NULL;
+  return &lib.patches[index];
+}
+
+/* Return sound parameters */
+const unsigned char *
+blofeld_library_params(int index)
+{
+  if (!blofeld_library_patch(index))
+    return NULL;
+  return &lib.params[index * BLOFELD_PARAMS];
+}
+
+/* Return number which changes every time the library changes */
+unsigned int
+blofeld_library_generation(void)
+{
+  return lib.generation;
+}
+
+/* Return path of file containing sound, relative to library root */
+const char *
+blofeld_library_file(const struct blofeld_library_patch *patch)
+{
+  if (!patch)
+    return "";
+  return file_path(patch->file);
+}
+
+/* Read sound from file and hand it to loader */
+int
+blofeld_library_load(int index, int (*loader)(void *buffer, int len,
+                                              int buf_no),
+                     int buf_no)
+{
+  const struct blofeld_library_patch *patch = blofeld_library_patch(index);
+  char name[PATH_MAX];
+  struct syx_file syx;
+  const unsigned char *msg;
+  size_t pos, len;
+  int res = -1;
+
+  if (!patch || !full_path(name, sizeof(name), file_path(patch->file)) ||
+      syx_file_open(&syx, name) < 0)
+    return -1;
+  pos = patch->offset;
+  /* If the file has changed and we haven't noticed yet, there might not
+   * be a sound dump where we expect it. */
+  if (syx_file_next(&syx, &pos, &msg, &len) &&
+      msg == &syx.data[patch->offset])
+    res = loader((void *) msg, len, buf_no);
+  syx_file_close(&syx);
+
+  return res;
+}
+
+/* Return hash to compare sounds by */
+static unsigned long long
+patch_hash(const struct blofeld_library_patch *patch, int ignore_name)
+{
+  return ignore_name ? patch->sound_hash : patch->hash;
+}
+
+/* Find identical sounds. Each sound is looked up by its hash in a hash
+ * table holding the first sound seen with each hash, so the time taken is
+ * linear in the size of the library. With 64 bit hashes, the odds of two
+ * different sounds in even a very large library having the same hash are
+ * negligible, so the sounds themselves are not compared. */
+int
+blofeld_library_find_dups(struct blofeld_library_dups *dups, int ignore_name)
+{
+  unsigned int size = 256, mask;
+  int *table;
+  int i;
+
+  memset(dups, 0, sizeof(*dups));
+  while (size < lib.live_patches * 2)
+    size *= 2;
+  mask = size - 1;
+
+  table = calloc(size, sizeof(*table)); /* sound index + 1 */
+  dups->first = malloc((lib.npatches + 1) * sizeof(*dups->first));
+  dups->copies = calloc(lib.npatches + 1, sizeof(*dups->copies));
+  if (!table || !dups->first || !dups->copies) {
+    free(table);
+    blofeld_library_free_dups(dups);
+    return -1;
+  }
+
+  for (i = 0; i < lib.npatches; i++) {
+    const struct blofeld_library_patch *patch = &lib.patches[i];
+    unsigned long long hash;
+    unsigned int slot;
+
+    dups->first[i] = -1;
+    if (patch->file < 0)
+      continue;
+    hash = patch_hash(patch, ignore_name);
+    for (slot = (hash ^ hash >> 32) & mask; table[slot];
+         slot = (slot + 1) & mask)
+      if (patch_hash(&lib.patches[table[slot] - 1], ignore_name) == hash)
+        break;
+    if (table[slot]) { /* seen it before */
+      int first = table[slot] - 1;
+      dups->first[i] = first;
+      if (dups->copies[first]++ == 1)
+        dups->groups++;
+      dups->duplicates++;
+    } else {
+      table[slot] = i + 1;
+      dups->first[i] = i;
+      dups->copies[i] = 1;
+    }
+  }
+  free(table);
+
+  xprintf("Library: %d duplicates of %d sounds\n",
+          dups->duplicates, dups->groups);
+  return 0;
+}
+
+/* Free result of blofeld_library_find_dups */
+void
+blofeld_library_free_dups(struct blofeld_library_dups *dups)
+{
+  free(dups->first);
+  free(dups->copies);
+  memset(dups, 0, sizeof(*dups));
+}
+
+/* Get library status */
+void
+blofeld_library_get_status(struct blofeld_library_status *status)
+{
+  int f;
+
+  status->files = 0;
+  for (f = 0; f < lib.nfiles; f++)
+    if (lib.files[f].count >= 0)
+      status->files++;
+  status->patches = lib.live_patches;
+  status->scanning = lib.walking || lib.pending;
+  status->pending = lib.pending;
+}
+
+/* Register status callback */
+void
+blofeld_library_register_status_cb(blofeld_library_status_cb cb, void *ref)
+{
+  lib.status_cb = cb;
+  lib.status_ref = ref;
+}
+
+/* Called periodically to pick up changes */
+void
+blofeld_library_timer(void)
+{
+  if (!lib.root[0])
+    return;
+
+  handle_events();
+  if (lib.walking)
+    walk_step();
+  if (lib.dirty && !lib.walking && !lib.pending && lib.index_file[0] &&
+      timestamp_ms() - lib.changed >= SAVE_DELAY)
+    save_index();
+}
+
+/*********************** End of file blofeld_library.c **********************/
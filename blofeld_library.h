@@ -0,0 +1,118 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_library.h - Index of a library of Blofeld sound files.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _BLOFELD_LIBRARY_H_
+#define _BLOFELD_LIBRARY_H_
+
+#include "blofeld_params.h"
+
+/* Sound in library. This is also the record format of the index file. */
+struct blofeld_library_patch {
+  unsigned long long hash; /* of sound parameters */
+  unsigned long long sound_hash; /* same, excluding name */
+  int file; /* file record; -1 if sound has been removed */
+  unsigned int offset; /* of sound dump in file */
+  char name[BLOFELD_PATCH_NAME_LEN_MAX + 1];
+  unsigned char category;
+  unsigned char bank; /* as in sound dump: 0..7 = A..H, 0x7f edit buffer */
+  unsigned char program;
+};
+
+/* Library status */
+struct blofeld_library_status {
+  int files; /* # .syx files */
+  int patches; /* # sounds */
+  int scanning; /* set while looking for changes, or indexing files */
+  int pending; /* # files being indexed */
+};
+
+/* Status callback, called when files have been indexed, and when the
+ * library has been checked for changes after startup. */
+typedef void (*blofeld_library_status_cb)(
+  const struct blofeld_library_status *status, void *ref);
+
+/* Open library of .syx files in directory tree under root. The index
+ * of the library is loaded from the cache, and kept up to date from then
+ * on. Returns 0 if ok, -1 if root is not a directory. */
+int blofeld_library_open(const char *root);
+
+/* Save index and close library */
+void blofeld_library_close(void);
+
+/* Return number of sound records, including removed ones, or 0 if there
+ * is no library. */
+int blofeld_library_size(void);
+
+/* Return sound record, or NULL if removed or out of range. The record is
+ * only valid until the library changes, i.e. the next timer call. */
+const struct blofeld_library_patch *blofeld_library_patch(int index);
+
+/* Return parameters of sound (BLOFELD_PARAMS bytes), or NULL if removed
+ * or out of range. Only valid until the library changes. */
+const unsigned char *blofeld_library_params(int index);
+
+/* Return number which changes every time the library changes */
+unsigned int blofeld_library_generation(void);
+
+/* Return path of file containing sound, relative to the library root,
+ * or "" if patch is NULL */
+const char *blofeld_library_file(const struct blofeld_library_patch *patch);
+
+/* Read sound from its file and hand it to loader, like load_patch_file
+ * in the UI. Returns -1 if the sound could not be read, or what loader
+ * returns. */
+int blofeld_library_load(int index, int (*loader)(void *buffer, int len,
+                                                  int buf_no),
+                         int buf_no);
+
+/* Identical sounds in library */
+struct blofeld_library_dups {
+  int *first; /* per sound record: first identical sound, -1 if removed */
+  int *copies; /* per sound record: # identical sounds, including itself,
+                * for the first one of each set; 0 for the others */
+  int groups; /* # sounds which have copies */
+  int duplicates; /* # sounds which are copies of an earlier one */
+};
+
+/* Find identical sounds in library, using the hashes in the index. If
+ * ignore_name is set, sounds which only differ in name are considered
+ * identical. Returns 0 if ok, -1 if out of memory. */
+int blofeld_library_find_dups(struct blofeld_library_dups *dups,
+                              int ignore_name);
+
+/* Free result of blofeld_library_find_dups */
+void blofeld_library_free_dups(struct blofeld_library_dups *dups);
+
+/* Get library status */
+void blofeld_library_get_status(struct blofeld_library_status *status);
+
+/* Register status callback. It stays registered if the library is
+ * closed and opened again. */
+void blofeld_library_register_status_cb(blofeld_library_status_cb cb,
+                                        void *ref);
+
+/* Called periodically to pick up changes */
+void blofeld_library_timer(void);
+
+#endif /* _BLOFELD_LIBRARY_H_ */
+
+/*********************** End of file blofeld_library.h **********************/
@@ -21,23 +21,37 @@
  ****************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "param.h"
 #include "blofeld_params.h"
 #include "midi.h"
+#include "timestamp.h"
+#include "request_tracker.h"
+#include "blofeld_bank.h"
+#include "blofeld_wave.h"
+#include "blofeld_library.h"
+#include "journal.h"
+#include "automation.h"
+#include "param_bus.h"
+#include "synth_def.h"
 
 #include "debug.h"
 
 /* Blofeld patch and parameter dump sysex definitions.
  * These are taken from blofeld_sysex_v1_04.txt */
 
+/* Default sysex ids; the synth definition file has the final say */
 #define SYSEX_ID_WALDORF 0x3E
 #define EQUIPMENT_ID_BLOFELD 0x13
 #define SNDR 0x00 /* Sound Request */
 #define SNDD 0x10 /* Sound Dump */
 #define SNDP 0x20 /* Sound Parameter Change */
 #define GLBR 0x04 /* Global Request */
+#define MULR 0x01 /* Multi Request */
+#define MULD 0x11 /* Multi Dump */
 #define GLBD 0x14 /* Global Dump */
+#define WTBD 0x12 /* Wavetable Dump */
 
 /* Offsets in Waldorf dumps, see sysex manual */
 #define EXC 0
@@ -58,9 +72,50 @@
 /* Parameter buffers: 00..19h are banks A..Z (not all banks exist) */
 #define EDIT_BUF 0x7f
 
+/* Device number which all devices respond to */
+#define BROADCAST_DEV 0x7f
+
+/* Time (ms) it takes the Blofeld to send one sound dump at DIN MIDI speed */
+#define SOUND_DUMP_TIME 130
+
+/* Max # of parameter bytes in a global dump */
+#define GLOBAL_DUMP_MAX 128
+
+/* Global requests are tracked using a bank number which doesn't exist
+ * for sound requests. */
+#define GLOBAL_REQUEST_BANK 0x100
+#define MULTI_REQUEST_BANK 0x101
+
+/* Multi dump layout, offsets from SDATA */
+#define MULTI_DUMP_LEN 416
+#define MULTI_NAME 0
+#define MULTI_VOLUME 17
+#define MULTI_TEMPO 18
+#define MULTI_PART 32 /* first part */
+#define MULTI_PART_LEN 24
+
+/* offsets within each part */
+#define PART_BANK 0
+#define PART_PROGRAM 1
+#define PART_VOLUME 2
+#define PART_PAN 3
+#define PART_TRANSPOSE 5
+#define PART_DETUNE 6
+#define PART_CHANNEL 7
+#define PART_KEY_LOW 8
+#define PART_KEY_HIGH 9
+#define PART_VEL_LOW 10
+#define PART_VEL_HIGH 11
+
+/* Longest sysex message we receive is a multi dump. Anything longer is
+ * truncated by the MIDI handler, so allow an extra byte in order for
+ * the length checks to see that it was too long. */
+#define SYSEX_RECEIVE_MAX (SDATA + MULTI_DUMP_LEN + 2 + 1)
+
 struct limits {
   int min;
   int max;
+  int enumerated; /* values are choices rather than amounts, see morph */
 };
 
 /* Structure for parameter definitions */
@@ -70,557 +125,155 @@ struct blofeld_param {
   struct limits *limits;
   struct blofeld_param *child;
   struct blofeld_bitmap_param *bm_param; /* NULL for ordinary parameters */
+  int global_offset; /* global params: offset in global dump, else -1 */
   /* More to come, such as CC number, where applicable */
 };
 
 /* Extra definitions for bitmapped parameters */
 struct blofeld_bitmap_param {
-  const char *parent_param_name; /* Name of parent; searched during init */
   struct blofeld_param *parent_param; /* Pointer to parent */
   int bitmask;
   int bitshift;
 };
 
-/* Limit structures */
-struct limits norm = { 0, 127 };
-struct limits oct = { 12, 112 };
-struct limits bend = { -24, 24 };
-struct limits bipolar = { -64, 63 };
-struct limits semitone = { -12, 12 };
-struct limits keytrack = { -200, 196 };
-struct limits fmsource = { 0, 11 };
-struct limits modsource = { 0, 30 };
-struct limits moddest = { 0, 53 };
-struct limits filterdrive = { 0, 12 };
-struct limits fxdrive = { 0, 11 };
-struct limits fx1type = { 0, 5 };
-struct limits fx2type = { 0, 8 };
-struct limits lfoshape = { 0, 5 };
-struct limits lfophase = { 0, 355 };
-struct limits envmode = { 0, 4 };
-struct limits wave = { 0, 72 };
-struct limits wave3 = { 0, 4 };
-struct limits onoff = { 0, 1 };
-struct limits threebit = { 0, 7 };
-struct limits sixbit = { 0, 63 };
-struct limits modop = { 0, 7 };
-struct limits arpmode = { 0, 3 };
-struct limits arppat = { 0, 15 };
-struct limits arpclock = { 0, 42 };
-struct limits arplength = { 0, 43 };
-struct limits arpoct = { 0, 9 };
-struct limits arpdir = { 0, 3 };
-struct limits arpsortord = { 0, 5 };
-struct limits arpvel = { 0, 6 };
-struct limits arpplen = { 0, 15 };
-struct limits arptempo = { 40, 300 };
-struct limits ascii = { 32, 127 };
-struct limits category = { 0, 12 };
-
-/* Bitmapped parameters additional structures */
-struct blofeld_bitmap_param unison = { "Allocation Mode", NULL, 0x70, 4 };
-struct blofeld_bitmap_param allocation = { "Allocation Mode", NULL, 0x01, 0 };
-
-struct blofeld_bitmap_param fenvmode = { "Filter Envelope Trig+Mode", NULL, 0x07, 0 };
-struct blofeld_bitmap_param fenvtrig = { "Filter Envelope Trig+Mode", NULL, 0x20, 5 };
-struct blofeld_bitmap_param aenvmode = { "Amplifier Envelope Trig+Mode", NULL, 0x07, 0 };
-struct blofeld_bitmap_param aenvtrig = { "Amplifier Envelope Trig+Mode", NULL, 0x20, 5 };
-struct blofeld_bitmap_param env3mode = { "Envelope 3 Trig+Mode", NULL, 0x07, 0 };
-struct blofeld_bitmap_param env4trig = { "Envelope 4 Trig+Mode", NULL, 0x20, 5 };
-struct blofeld_bitmap_param env4mode = { "Envelope 4 Trig+Mode", NULL, 0x07, 0 };
-struct blofeld_bitmap_param env3trig = { "Envelope 3 Trig+Mode", NULL, 0x20, 5 };
-
-/* LFO speed and clock are the same parameter viewed in different ways
- * depending on the Clocked parameter. Speed is normal 0..127, but clock
- * is every second value, i.e. 0->0..1, 1->2..3, etc , so suitable for bitmap
- * parameter.
- */
-struct blofeld_bitmap_param lfo1speed = { "LFO 1 Clock+Speed", NULL, 0x7f, 0 };
-struct blofeld_bitmap_param lfo1clock = { "LFO 1 Clock+Speed", NULL, 0x7e, 1 };
-struct blofeld_bitmap_param lfo2speed = { "LFO 2 Clock+Speed", NULL, 0x7f, 0 };
-struct blofeld_bitmap_param lfo2clock = { "LFO 2 Clock+Speed", NULL, 0x7e, 1 };
-struct blofeld_bitmap_param lfo3speed = { "LFO 3 Clock+Speed", NULL, 0x7f, 0 };
-struct blofeld_bitmap_param lfo3clock = { "LFO 3 Clock+Speed", NULL, 0x7e, 1 };
-
-/* FX 2 has two parameters with different data types */
-/* Damping is continuous 0..127, polarity is 0..1 */
-struct blofeld_bitmap_param fx2damping = { "Effect 2 Parameter 154.", NULL, 0x7f, 0 };
-struct blofeld_bitmap_param fx2polarity = { "Effect 2 Parameter 154.", NULL, 0x7f, 0 };
-/* Spread is continuous -64..+63, curve is 0..11 */
-struct blofeld_bitmap_param fx2spread = { "Effect 2 Parameter 155.", NULL, 0x7f, 0 };
-struct blofeld_bitmap_param fx2curve = { "Effect 2 Parameter 155.", NULL, 0x7f, 0 };
-
-#define ARP_STEP_BITMAPS(N) \
-struct blofeld_bitmap_param arpstep ## N = { "Arpeggiator Pattern StGlAcc " #N, NULL, 0x70, 4 }; \
-struct blofeld_bitmap_param arpglide ## N = { "Arpeggiator Pattern StGlAcc " #N, NULL, 0x08, 3 }; \
-struct blofeld_bitmap_param arpacc ## N = { "Arpeggiator Pattern StGlAcc " #N, NULL, 0x07, 0 }; \
-struct blofeld_bitmap_param arplen ## N = { "Arpeggiator Pattern TimLen " #N, NULL, 0x70, 4 }; \
-struct blofeld_bitmap_param arptim ## N = { "Arpeggiator Pattern TimLen " #N, NULL, 0x07, 0 }
-
-ARP_STEP_BITMAPS(1);
-ARP_STEP_BITMAPS(2);
-ARP_STEP_BITMAPS(3);
-ARP_STEP_BITMAPS(4);
-ARP_STEP_BITMAPS(5);
-ARP_STEP_BITMAPS(6);
-ARP_STEP_BITMAPS(7);
-ARP_STEP_BITMAPS(8);
-ARP_STEP_BITMAPS(9);
-ARP_STEP_BITMAPS(10);
-ARP_STEP_BITMAPS(11);
-ARP_STEP_BITMAPS(12);
-ARP_STEP_BITMAPS(13);
-ARP_STEP_BITMAPS(14);
-ARP_STEP_BITMAPS(15);
-ARP_STEP_BITMAPS(16);
-
-/* string parameter: bitmask == 0, bitshift == string length */
-struct blofeld_bitmap_param patchname = { "Name Char 1", NULL, 0, 16 };
-
-#define BLOFELD_PARAMS_ALL (sizeof(blofeld_params) / \
-                            sizeof(blofeld_params[0]))
-
-/* Some definitions for tedious parameters that occur multiple times */
-
-#define MODIFIER(N) \
-  { "Modifier " #N " Source A", &modsource, NULL, NULL }, \
-  { "Modifier " #N " Source B", &modsource, NULL, NULL }, \
-  { "Modifier " #N " Operation", &modop, NULL, NULL }, \
-  { "Modifier " #N " Constant", &bipolar, NULL, NULL }
-
-#define MODULATION(N) \
-  { "Modulation " #N " Source", &modsource, NULL, NULL }, \
-  { "Modulation " #N " Destination", &moddest, NULL, NULL }, \
-  { "Modulation " #N " Amount", &bipolar, NULL, NULL } \
-
-#define ARPSTEP(N) \
-  { "Arp Step Type " #N ".", &threebit, NULL, &arpstep ## N }, \
-  { "Arp Step Glide " #N ".", &onoff, NULL, &arpglide ## N }, \
-  { "Arp Step Accent " #N ".", &threebit, NULL, &arpacc ## N }, \
-  { "Arp Step Timing " #N ".", &threebit, NULL, &arptim ## N }, \
-  { "Arp Step Length " #N ".", &threebit, NULL, &arplen ## N }
+/* Name of synth definition file, and of its cache directory
+ * relative to the user's cache directory. */
+#define DEF_FILENAME "blofeld.def"
+#define DEF_CACHE_DIR "xtor"
 
 /* Names of certain parameters, for interfacing with xtor core. */
 static char patch_name[] = "Patch Name";
 static char device_name[] = "Device Name";
 static char device_number_name[] = "Device ID";
 
-/* The Parameter Definition List */
-/* Note: Owing to the design of the UI, in order to have the same parameter
- * appear in more than one place, parameters who are references by the UI
- * cannot have names that end with a digit,
- * This is because glade suffixes widget names with numbers when copying,
- * which we filter out in the main ui driver in order to have widgets
- * with the same base name (i.e. without the number suffix) that control the
- * same parameter.
- */
-struct blofeld_param blofeld_params[] = {
-  /* name, limits, child, bm_param */
-  { "reserved", NULL, NULL, NULL }, /* 0 */
-  { "Osc 1 Octave", &oct, NULL, NULL },
-  { "Osc 1 Semitone", &semitone, NULL, NULL },
-  { "Osc 1 Detune", &bipolar, NULL, NULL },
-  { "Osc 1 Bend Range", &bend, NULL, NULL },
-  { "Osc 1 Keytrack", &keytrack, NULL, NULL },
-  { "Osc 1 FM Source", &fmsource, NULL, NULL },
-  { "Osc 1 FM Amount", &norm, NULL, NULL },
-  { "Osc 1 Wave", &wave, NULL, NULL },
-  { "Osc 1 Waveshape", &norm, NULL, NULL },
-  { "Osc 1 Shape Source", &modsource, NULL, NULL },
-  { "Osc 1 Shape Amount", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc 1 Limit WT", &onoff, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc 1 Brilliance", &norm, NULL, NULL }, /* 16 */
-  { "Osc 2 Octave", &oct, NULL, NULL },
-  { "Osc 2 Semitone", &semitone, NULL, NULL },
-  { "Osc 2 Detune", &bipolar, NULL, NULL },
-  { "Osc 2 Bend Range", &bend, NULL, NULL },
-  { "Osc 2 Keytrack", &keytrack, NULL, NULL },
-  { "Osc 2 FM Source", &fmsource, NULL, NULL },
-  { "Osc 2 FM Amount", &norm, NULL, NULL },
-  { "Osc 2 Wave", &wave, NULL, NULL },
-  { "Osc 2 Waveshape", &norm, NULL, NULL },
-  { "Osc 2 Shape Source", &modsource, NULL, NULL },
-  { "Osc 2 Shape Amount", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc 2 Limit WT", &onoff, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc 2 Brilliance", &norm, NULL, NULL }, /* 32 */
-  { "Osc 3 Octave", &oct, NULL, NULL },
-  { "Osc 3 Semitone", &semitone, NULL, NULL },
-  { "Osc 3 Detune", &bipolar, NULL, NULL },
-  { "Osc 3 Bend Range", &bend, NULL, NULL },
-  { "Osc 3 Keytrack", &keytrack, NULL, NULL },
-  { "Osc 3 FM Source", &fmsource, NULL, NULL },
-  { "Osc 3 FM Amount", &norm, NULL, NULL },
-  { "Osc 3 Wave", &wave3, NULL, NULL },
-  { "Osc 3 Waveshape", &norm, NULL, NULL },
-  { "Osc 3 Shape Source", &modsource, NULL, NULL },
-  { "Osc 3 Shape Amount", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc 3 Brilliance", &norm, NULL, NULL }, /* 48 */
-  { "Osc 2 to 3 Sync", &norm, NULL, NULL },
-  { "Osc Common Pitch Source", &norm, NULL, NULL },
-  { "Osc Common Pitch Amount", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc Common Glide Enable", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc Common Glide Mode", &norm, NULL, NULL },
-  { "Osc Common Glide Rate", &norm, NULL, NULL },
-  { "Allocation Mode", NULL, NULL, NULL },
-  { "Osc Common Unison Amount", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Osc 1 Level", &norm, NULL, NULL },
-  { "Osc 1 Balance", &bipolar, NULL, NULL },
-  { "Osc 2 Level", &norm, NULL, NULL },
-  { "Osc 2 Balance", &bipolar, NULL, NULL },
-  { "Osc 3 Level", &norm, NULL, NULL },
-  { "Osc 3 Balance", &bipolar, NULL, NULL },
-  { "Noise Level", &norm, NULL, NULL },
-  { "Noise Balance", &bipolar, NULL, NULL },
-  { "Noise Color", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Ringmod Level", &norm, NULL, NULL },
-  { "Ringmod Balance", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter 1 Type", &norm, NULL, NULL }, /* 77 */
-  { "Filter 1 Cutoff", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter 1 Resonance", &norm, NULL, NULL },
-  { "Filter 1 Drive", &norm, NULL, NULL },
-  { "Filter 1 Drive Curve", &filterdrive, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter 1 Keytrack", &keytrack, NULL, NULL },
-  { "Filter 1 Env Amount", &bipolar, NULL, NULL },
-  { "Filter 1 Env Velocity", &bipolar, NULL, NULL },
-  { "Filter 1 Mod Source", &norm, NULL, NULL },
-  { "Filter 1 Mod Amount", &bipolar, NULL, NULL },
-  { "Filter 1 FM Source", &fmsource, NULL, NULL },
-  { "Filter 1 FM Amount", &norm, NULL, NULL },
-  { "Filter 1 Pan", &bipolar, NULL, NULL },
-  { "Filter 1 Pan Source", &norm, NULL, NULL },
-  { "Filter 1 Pan Amount", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter 2 Type", &norm, NULL, NULL }, /* 97 */
-  { "Filter 2 Cutoff", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter 2 Resonance", &norm, NULL, NULL },
-  { "Filter 2 Drive", &norm, NULL, NULL },
-  { "Filter 2 Drive Curve", &filterdrive, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter 2 Keytrack", &keytrack, NULL, NULL },
-  { "Filter 2 Env Amount", &bipolar, NULL, NULL },
-  { "Filter 2 Env Velocity", &bipolar, NULL, NULL },
-  { "Filter 2 Mod Source", &norm, NULL, NULL },
-  { "Filter 2 Mod Amount", &bipolar, NULL, NULL },
-  { "Filter 2 FM Source", &fmsource, NULL, NULL },
-  { "Filter 2 FM Amount", &norm, NULL, NULL },
-  { "Filter 2 Pan", &bipolar, NULL, NULL },
-  { "Filter 2 Pan Source", &norm, NULL, NULL },
-  { "Filter 2 Pan Amount", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter Routing", &onoff, NULL, NULL }, /* 117 */
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Amplifier Volume", &norm, NULL, NULL }, /* 121 */
-  { "Amplifier Velocity", &bipolar, NULL, NULL },
-  { "Amplifier Mod Source", &norm, NULL, NULL },
-  { "Amplifier Mod Amount", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Effect 1 Type", &fx1type, NULL, NULL }, /* 128 */
-  { "Effect 1 Mix", &norm, NULL, NULL },
-  { "Effect 1 Parameter 130.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 131.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 132.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 133.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 134.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 135.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 136.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 137.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 138.", &onoff, NULL, NULL },
-  { "Effect 1 Parameter 139.", &fxdrive, NULL, NULL },
-  { "Effect 1 Parameter 140.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 141.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 142.", &norm, NULL, NULL },
-  { "Effect 1 Parameter 143.", &norm, NULL, NULL },
-  { "Effect 2 Type", &fx2type, NULL, NULL }, /* 144 */
-  { "Effect 2 Mix", &norm, NULL, NULL },
-  { "Effect 2 Parameter 146.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 147.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 148.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 149.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 150.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 151.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 152.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 153.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 154.", &onoff, NULL, NULL },
-  { "Effect 2 Parameter 155.", &fxdrive, NULL, NULL },
-  { "Effect 2 Parameter 156.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 157.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 158.", &norm, NULL, NULL },
-  { "Effect 2 Parameter 159.", &norm, NULL, NULL },
-  { "LFO 1 Shape", &lfoshape, NULL, NULL }, /* 160 */
-  { "LFO 1 Clock+Speed", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 1 Sync", &onoff, NULL, NULL },
-  { "LFO 1 Clocked", &onoff, NULL, NULL },
-  { "LFO 1 Phase", &lfophase, NULL, NULL },
-  { "LFO 1 Delay", &norm, NULL, NULL },
-  { "LFO 1 Fade", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 1 Keytrack", &keytrack, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 2 Shape", &lfoshape, NULL, NULL }, /* 172 */
-  { "LFO 2 Clock+Speed", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 2 Sync", &onoff, NULL, NULL },
-  { "LFO 2 Clocked", &onoff, NULL, NULL },
-  { "LFO 2 Phase", &lfophase, NULL, NULL },
-  { "LFO 2 Delay", &norm, NULL, NULL },
-  { "LFO 2 Fade", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 2 Keytrack", &keytrack, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 3 Shape", &lfoshape, NULL, NULL }, /* 184 */
-  { "LFO 3 Clock+Speed", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 3 Sync", &onoff, NULL, NULL },
-  { "LFO 3 Clocked", &onoff, NULL, NULL },
-  { "LFO 3 Phase", &lfophase, NULL, NULL },
-  { "LFO 3 Delay", &norm, NULL, NULL },
-  { "LFO 3 Fade", &bipolar, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "LFO 3 Keytrack", &keytrack, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter Envelope Trig+Mode", &envmode, NULL, NULL }, /* 196 */
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Filter Envelope Attack", &norm, NULL, NULL },
-  { "Filter Envelope Attack Level", &norm, NULL, NULL },
-  { "Filter Envelope Decay", &norm, NULL, NULL },
-  { "Filter Envelope Sustain", &norm, NULL, NULL },
-  { "Filter Envelope Decay Two", &norm, NULL, NULL },
-  { "Filter Envelope Sustain Two", &norm, NULL, NULL },
-  { "Filter Envelope Release", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Amplifier Envelope Trig+Mode", &envmode, NULL, NULL }, /* 208 */
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Amplifier Envelope Attack", &norm, NULL, NULL },
-  { "Amplifier Envelope Attack Level", &norm, NULL, NULL },
-  { "Amplifier Envelope Decay", &norm, NULL, NULL },
-  { "Amplifier Envelope Sustain", &norm, NULL, NULL },
-  { "Amplifier Envelope Decay Two", &norm, NULL, NULL },
-  { "Amplifier Envelope Sustain Two", &norm, NULL, NULL },
-  { "Amplifier Envelope Release", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Envelope 3 Trig+Mode", &envmode, NULL, NULL }, /* 220 */
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Envelope 3 Attack", &norm, NULL, NULL },
-  { "Envelope 3 Attack Level", &norm, NULL, NULL },
-  { "Envelope 3 Decay", &norm, NULL, NULL },
-  { "Envelope 3 Sustain", &norm, NULL, NULL },
-  { "Envelope 3 Decay Two", &norm, NULL, NULL },
-  { "Envelope 3 Sustain Two", &norm, NULL, NULL },
-  { "Envelope 3 Release", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Envelope 4 Trig+Mode", &envmode, NULL, NULL }, /* 232 */
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Envelope 4 Attack", &norm, NULL, NULL },
-  { "Envelope 4 Attack Level", &norm, NULL, NULL },
-  { "Envelope 4 Decay", &norm, NULL, NULL },
-  { "Envelope 4 Sustain", &norm, NULL, NULL },
-  { "Envelope 4 Decay Two", &norm, NULL, NULL },
-  { "Envelope 4 Sustain Two", &norm, NULL, NULL },
-  { "Envelope 4 Release", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  MODIFIER(1), /* 245 */
-  MODIFIER(2),
-  MODIFIER(3),
-  MODIFIER(4),
-  MODULATION(1), /* 261 */
-  MODULATION(2),
-  MODULATION(3),
-  MODULATION(4),
-  MODULATION(5),
-  MODULATION(6),
-  MODULATION(7),
-  MODULATION(8),
-  MODULATION(9),
-  MODULATION(10),
-  MODULATION(11),
-  MODULATION(12),
-  MODULATION(13),
-  MODULATION(14),
-  MODULATION(15),
-  MODULATION(16),
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Arpeggiator Mode", &arpmode, NULL, NULL }, /* 311 */
-  { "Arpeggiator Pattern", &arppat, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Arpeggiator Clock", &arpclock, NULL, NULL },
-  { "Arpeggiator Length", &arplength, NULL, NULL },
-  { "Arpeggiator Octave", &arpoct, NULL, NULL },
-  { "Arpeggiator Direction", &arpdir, NULL, NULL },
-  { "Arpeggiator Sort Order", &arpsortord, NULL, NULL },
-  { "Arpeggiator Arp Velocity", &arpvel, NULL, NULL },
-  { "Arpeggiator Timing Factor", &norm, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Arpeggiator Ptn Reset", &onoff, NULL, NULL },
-  { "Arpeggiator Ptn Length", &arpplen, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Arpeggiator Tempo", &arptempo, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 1", NULL, NULL, NULL }, /* 327 */
-  { "Arpeggiator Pattern StGlAcc 2", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 3", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 4", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 5", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 6", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 7", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 8", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 9", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 10", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 11", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 12", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 13", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 14", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 15", NULL, NULL, NULL },
-  { "Arpeggiator Pattern StGlAcc 16", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 1", NULL, NULL, NULL }, /* 343 */
-  { "Arpeggiator Pattern TimLen 2", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 3", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 4", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 5", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 6", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 7", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 8", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 9", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 10", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 11", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 12", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 13", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 14", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 15", NULL, NULL, NULL },
-  { "Arpeggiator Pattern TimLen 16", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL }, /* 359 */
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "Name Char 1", &ascii, NULL, NULL },
-  { "Name Char 2", &ascii, NULL, NULL },
-  { "Name Char 3", &ascii, NULL, NULL },
-  { "Name Char 4", &ascii, NULL, NULL },
-  { "Name Char 5", &ascii, NULL, NULL },
-  { "Name Char 6", &ascii, NULL, NULL },
-  { "Name Char 7", &ascii, NULL, NULL },
-  { "Name Char 8", &ascii, NULL, NULL },
-  { "Name Char 9", &ascii, NULL, NULL },
-  { "Name Char 10", &ascii, NULL, NULL },
-  { "Name Char 11", &ascii, NULL, NULL },
-  { "Name Char 12", &ascii, NULL, NULL },
-  { "Name Char 13", &ascii, NULL, NULL },
-  { "Name Char 14", &ascii, NULL, NULL },
-  { "Name Char 15", &ascii, NULL, NULL },
-  { "Name Char 16", &ascii, NULL, NULL },
-  { "Category", &category, NULL, NULL }, /* 379 */
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL },
-  { "reserved", NULL, NULL, NULL }, /* 382 */
-
-  /* Bitmap parameters. Originally devised for parameters which had
-   * bitfields, so that several 'bitmap parameters' would have the same
-   * parent parameter, but referencing different bitfields in the parent.
-   * (Note that the implementation allows for overlapping bitfields as well).
-   * However, the term 'Bitmap parameters' now also includes parameters
-   * which have multiple parents and one single child, which in our case
-   * is the patch name (only). */
-
-  { "Osc Common Unison Mode", &threebit, NULL, &unison },
-  { "Osc Common Allocation", &onoff, NULL, &allocation },
-  { "Filter Envelope Mode", &envmode, NULL, &fenvmode },
-  { "Filter Envelope Trig", &onoff, NULL, &fenvtrig },
-  { "Amplifier Envelope Mode", &envmode, NULL, &aenvmode },
-  { "Amplifier Envelope Trig", &onoff, NULL, &aenvtrig },
-  { "Envelope 3 Mode", &envmode, NULL, &env3mode },
-  { "Envelope 3 Trig", &onoff, NULL, &env3trig },
-  { "Envelope 4 Mode", &envmode, NULL, &env4mode },
-  { "Envelope 4 Trig", &onoff, NULL, &env4trig },
-  { "LFO 1 Speed", &norm, NULL, &lfo1speed },
-  { "LFO 1 Clock", &sixbit, NULL, &lfo1clock },
-  { "LFO 2 Speed", &norm, NULL, &lfo2speed },
-  { "LFO 2 Clock", &sixbit, NULL, &lfo2clock },
-  { "LFO 3 Speed", &norm, NULL, &lfo3speed },
-  { "LFO 3 Clock", &sixbit, NULL, &lfo3clock },
-  ARPSTEP(1),
-  ARPSTEP(2),
-  ARPSTEP(3),
-  ARPSTEP(4),
-  ARPSTEP(5),
-  ARPSTEP(6),
-  ARPSTEP(7),
-  ARPSTEP(8),
-  ARPSTEP(9),
-  ARPSTEP(10),
-  ARPSTEP(11),
-  ARPSTEP(12),
-  ARPSTEP(13),
-  ARPSTEP(14),
-  ARPSTEP(15),
-  ARPSTEP(16),
-  { "Effect 2 Spread", &bipolar, NULL, &fx2spread },
-  { "Effect 2 Curve", &filterdrive, NULL, &fx2curve },
-  { "Effect 2 Damping", &norm, NULL, &fx2damping },
-  { "Effect 2 Polarity", &onoff, NULL, &fx2polarity },
-  /* Not really a bit field, but needs special treatment, so we include it in
-   * the group. */
-  { patch_name, NULL, NULL, &patchname },
-  /* End of list marker. Do not remove. */
-  { "", NULL, NULL, NULL }
+/* The Parameter Definition List, set up from the synth definition file.
+ * Ends with an entry with an empty name. */
+struct blofeld_param *blofeld_params;
+
+/* # parameters in list, including end of list marker */
+static int blofeld_params_all;
+
+/* Parameters we look at in sound dumps found in files */
+static int name_parnum = -1;
+static int category_parnum = -1;
+
+/* Loaded synth definition */
+static struct synth_def synth_def;
+
+/* Sysex ids, from the synth definition */
+static int sysex_id = SYSEX_ID_WALDORF;
+static int equipment_id = EQUIPMENT_ID_BLOFELD;
+
+/* Parameter values for each part (buffer) in the synth, i.e. our
+ * Edit Buffers. Keeping all parts around means that switching part can
+ * show the part's parameters immediately, rather than waiting for a
+ * dump to arrive from the synth. */
+/* Alongside what the editor shows, we keep a shadow copy of what we
+ * believe the synth has in each part, i.e. what it last sent us or we last
+ * sent it. This lets us send just the differences when syncing the synth
+ * with the editor, for instance after loading a patch from file. */
+struct part_cache {
+  unsigned char params[BLOFELD_PARAMS];
+  int valid; /* params have been filled in from synth or file */
+  long long refreshed; /* timestamp_ms() of last dump received */
+  unsigned char synth[BLOFELD_PARAMS]; /* shadow of synth's parameters */
+  int synth_valid; /* shadow known to be in sync with synth */
 };
 
-/* These are the parameter values for all parameters, i.e. our Edit Buffer */
-int parameter_list[BLOFELD_PARAMS];
+struct part_cache parts[BLOFELD_BUFFERS];
+
+/* When selecting a part whose cache was refreshed less than this
+ * long ago (in ms), we don't bother asking the synth for a new dump. */
+#define PART_CACHE_MAX_AGE 2000
 
 /* We have one global paste buffer, and one for the arpeggiator */
 #define PASTE_BUFFERS 2
 
-int paste_buffer[PASTE_BUFFERS][BLOFELD_PARAMS];
+unsigned char paste_buffer[PASTE_BUFFERS][BLOFELD_PARAMS];
 
 /* Sysex device number */
 int device_number = 0;
 
-/* Callback and parameter for parameter updates */
-notify_cb notify_ui = NULL;
-void *notify_ref;
+/* Devices mirroring the one being edited */
+static struct blofeld_mirror mirrors[BLOFELD_MIRRORS_MAX];
+static int mirror_count = 0;
+static const char *mirror_midi_device = NULL;
+
+/* Buffer (part) currently selected for editing */
+static int selected_buffer = 0;
+
+/* Global parameters are not part of any sound, and are kept in a cache
+ * of their own, filled in from global dumps. The cache is used as long as
+ * it is valid, i.e. until a new global dump arrives, or we start talking
+ * to a different device. Since the only way to change a global parameter
+ * is to send a complete global dump, changes made in the editor are
+ * collected and sent at most every GLOBAL_SEND_INTERVAL ms. */
+struct global_cache {
+  unsigned char params[GLOBAL_DUMP_MAX];
+  int len; /* # parameter bytes in last global dump received */
+  int dev_no; /* device we got the dump from */
+  int valid;
+  int dirty; /* changed in editor, not yet sent to synth */
+  long long sent; /* timestamp_ms() of last global dump sent */
+};
+
+static struct global_cache globals = { .dev_no = -1 };
+
+#define GLOBAL_SEND_INTERVAL 100
+
+/* Last multi received. The parts' sounds are kept in the part caches. */
+static struct blofeld_multi multi;
+
+/* Parameter changes we have sent recently. Some setups echo what we send
+ * back to us, via MIDI thru or a merge box; an incoming parameter change
+ * which matches one we have sent for the same parameter during the last
+ * ECHO_WINDOW ms is taken to be an echo and dropped, rather than passed on
+ * to the UI, which already shows it. Echoes arrive in the order the changes
+ * were sent, so when one matches, that change and all earlier ones for the
+ * parameter are marked as matched, and don't match again. That way a change
+ * made on the synth itself is not mistaken for an echo just because we
+ * happened to send the same value earlier. */
+#define ECHO_SLOTS 64
+#define ECHO_WINDOW 500
+
+struct sent_param {
+  long long sent; /* timestamp_ms() when sent */
+  short parnum;
+  unsigned char buf_no;
+  unsigned char value;
+  int matched; /* set when echo of this or a later change has arrived */
+};
+
+static struct {
+  struct sent_param slot[ECHO_SLOTS];
+  unsigned int head; /* next slot to use */
+  int dropped; /* # echoes dropped */
+} echoes;
+
+/* Return cache for given buffer (part) number. Anything out of
+ * range ends up in part 0, which is what the synth uses when not in
+ * multi mode. */
+static struct part_cache *
+part_cache(int buf_no)
+{
+  if (buf_no < 0 || buf_no >= BLOFELD_BUFFERS)
+    buf_no = 0;
+  return &parts[buf_no];
+}
+
+/* Return parameter list for given buffer (part) number. */
+static unsigned char *
+parameter_list(int buf_no)
+{
+  return part_cache(buf_no)->params;
+}
+
+/* Return shadow of synth's parameters for given buffer (part) number. */
+static unsigned char *
+synth_list(int buf_no)
+{
+  return part_cache(buf_no)->synth;
+}
 
 /* Fint index in parameter list of parameter with a given name. */
 /* Used locally and also from xtor core during startup to find
@@ -634,7 +287,7 @@ blofeld_find_index(const char *param_name)
 
   if (!param_name) return idx;
 
-  for (i = 0; i < BLOFELD_PARAMS_ALL; i++) {
+  for (i = 0; i < blofeld_params_all; i++) {
     if (!strcmp(blofeld_params[i].name, param_name)) {
       idx = i;
       break;
@@ -651,7 +304,7 @@ int
 blofeld_get_param_properties(int param_num,
                              struct param_properties *props)
 {
-  if (param_num < BLOFELD_PARAMS_ALL && props) {
+  if (param_num < blofeld_params_all && props) {
     props->ui_min = blofeld_params[param_num].limits->min;
     props->ui_max = blofeld_params[param_num].limits->max;
     /* set sane values for step size */
@@ -673,24 +326,53 @@ midi_csum(const unsigned char *buf, int bytes)
   return (c & 127);
 }
 
-/* Send patch dump request to Blofeld. We hope to get an answer, but won't
- * hold our breath (i.e. we process the sound dump when it arrives
- * and don't hang around here waiting for it). */
-void
-blofeld_get_dump(int buf_no, int devno)
+/* Send sound dump request to Blofeld.
+ * Used as request_send_func by the request tracker, so called both for
+ * initial requests and retries. */
+static void
+send_sndr(int devno, int bank, int buf_no)
 {
+  if (devno == REQUEST_ANY_DEVICE)
+    devno = BROADCAST_DEV;
+
   unsigned char sndr[] = { SYSEX,
-                           SYSEX_ID_WALDORF,
-                           EQUIPMENT_ID_BLOFELD,
+                           sysex_id,
+                           equipment_id,
                            devno, /* device number */
                            SNDR,
-                           EDIT_BUF,
+                           bank,
                            buf_no,
                            EOX };
 
   midi_send_sysex(SYNTH_PORT, sndr, sizeof(sndr));
 }
 
+/* Request sound dump from Blofeld. The request tracker takes care of
+ * retrying if the synth does not answer, and makes sure we don't send
+ * the same request again while one is already in flight. The synth
+ * answers requests one at a time, so if there are queued requests ahead
+ * of this one, allow for their dumps before timing out. */
+int
+blofeld_request_dump(int bank, int buf_no, int dev_no, int queued,
+                     request_done_cb cb, void *ref)
+{
+  /* The Blofeld answers broadcast requests with its own device number */
+  if (dev_no == BROADCAST_DEV)
+    dev_no = REQUEST_ANY_DEVICE;
+
+  return request_submit_wait(dev_no, bank, buf_no, send_sndr, cb, ref,
+                             queued * SOUND_DUMP_TIME);
+}
+
+/* Send patch dump request to Blofeld. We hope to get an answer, but won't
+ * hold our breath (i.e. we process the sound dump when it arrives
+ * and don't hang around here waiting for it). */
+void
+blofeld_get_dump(int buf_no, int devno)
+{
+  blofeld_request_dump(EDIT_BUF, buf_no, devno, 0, NULL, NULL);
+}
+
 /* Patch dump routine for sending to synth.
  * Used as send_func_sender parameter in call to blofeld_xfer_dump. */
 static int
@@ -701,6 +383,121 @@ midi_send(char *buf, int size, int userdata)
   return 0;
 }
 
+/* Send edit to the device being edited, and to all mirrors, either right
+ * away, or if scheduled is set, at the given tick of the MIDI scheduler
+ * queue. The message is built once; for each mirror only the device number
+ * is changed, which is not covered by any checksum. Returns -1 if the
+ * message could not be sent to the device being edited. */
+static int
+mirror_output(unsigned char *buf, int len, int scheduled, unsigned int tick)
+{
+  int dev_no = buf[DEV];
+  int i;
+
+  if ((scheduled ? midi_sched_sysex(SYNTH_PORT, buf, len, tick)
+                 : midi_send_sysex(SYNTH_PORT, buf, len)) < 0)
+    return -1;
+  for (i = 0; i < mirror_count; i++) {
+    struct blofeld_mirror *mirror = &mirrors[i];
+    int res;
+
+    if (mirror->port == SYNTH_PORT && mirror->dev_no == dev_no)
+      continue; /* already got it */
+    buf[DEV] = mirror->dev_no;
+    res = scheduled ? midi_sched_sysex(mirror->port, buf, len, tick)
+                    : midi_send_sysex(mirror->port, buf, len);
+    if (res < 0) {
+      if (mirror->failed++ == 0)
+        eprintf("Warning: Can't send to mirror device %d\n", mirror->dev_no);
+    } else
+      mirror->sent++;
+  }
+  buf[DEV] = dev_no;
+
+  return 0;
+}
+
+/* Send edit to the device being edited, and to all mirrors, right away */
+static void
+mirror_send(unsigned char *buf, int len)
+{
+  mirror_output(buf, len, 0, 0);
+}
+
+/* Edit dump routine, for sending to synth and mirrors.
+ * Used as send_func_sender parameter in call to xfer_sound. */
+static int
+mirror_sender(char *buf, int size, int userdata)
+{
+  mirror_send((unsigned char *) buf, size);
+
+  return 0;
+}
+
+/* Add device to mirror set */
+int
+blofeld_mirror_add(int dev_no, const char *midi_device)
+{
+  struct blofeld_mirror *mirror;
+
+  if (mirror_count >= BLOFELD_MIRRORS_MAX)
+    return -1;
+  /* There is only one mirror port, which can only be connected to one
+   * device. */
+  if (midi_device && mirror_midi_device &&
+      strcmp(midi_device, mirror_midi_device) != 0)
+    return -2;
+
+  mirror = &mirrors[mirror_count++];
+  mirror->port = midi_device ? MIRROR_PORT : SYNTH_PORT;
+  mirror->dev_no = dev_no;
+  mirror->sent = mirror->failed = 0;
+  if (midi_device)
+    mirror_midi_device = midi_device;
+  xprintf("Mirroring to device %d on %s\n", dev_no,
+          midi_device ? midi_device : "synth port");
+
+  return 0;
+}
+
+/* Get mirror set */
+int
+blofeld_get_mirrors(const struct blofeld_mirror **mirror_set)
+{
+  *mirror_set = mirrors;
+
+  return mirror_count;
+}
+
+/* Build sound dump for given bank and buffer (or program, for sound banks)
+ * from parameter list 'params'. */
+void
+blofeld_sound_dump(unsigned char *msg, int bank, int program, int dev_no,
+                   const unsigned char *params)
+{
+  msg[0] = SYSEX;
+  msg[IDW] = sysex_id;
+  msg[IDE] = equipment_id;
+  msg[DEV] = dev_no;
+  msg[IDM] = SNDD;
+  msg[BB] = bank;
+  msg[NN] = program;
+  memcpy(&msg[SDATA], params, BLOFELD_PARAMS);
+  msg[SDATA + BLOFELD_PARAMS] = midi_csum(&msg[SDATA], BLOFELD_PARAMS);
+  msg[SDATA + BLOFELD_PARAMS + 1] = EOX;
+}
+
+/* Build sound dump, and hand it to sender. */
+static int
+xfer_sound(int bank, int buf_no, int dev_no, const unsigned char *params,
+           send_func sender, int userdata)
+{
+  unsigned char sndd[BLOFELD_SOUND_MSG_LEN];
+
+  blofeld_sound_dump(sndd, bank, buf_no, dev_no, params);
+  return sender(sndd, sizeof(sndd), userdata);
+}
+
 /* Send patch dump to Blofeld or file, depending on send_func sender */
 /* By using a function as parameter rather than returning a buffer and let
  * the caller do it, we can have the send buffer on the stack, rather
@@ -710,37 +507,126 @@ midi_send(char *buf, int size, int userdata)
 int
 blofeld_xfer_dump(int buf_no, int dev_no, send_func sender, int userdata)
 {
-  unsigned char sndd[BLOFELD_PARAMS + 9] = { SYSEX,
-                                             SYSEX_ID_WALDORF,
-                                             EQUIPMENT_ID_BLOFELD,
-                                             dev_no,
-                                             SNDD,
-                                             EDIT_BUF,
-                                             buf_no };
-  int parno;
-
-  for (parno = 0; parno < BLOFELD_PARAMS; parno++)
-    sndd[SDATA + parno] = parameter_list[parno];
-  sndd[SDATA + BLOFELD_PARAMS] = midi_csum(&sndd[SDATA], BLOFELD_PARAMS);
-  sndd[SDATA + BLOFELD_PARAMS + 1] = EOX;
-
-  return sender(sndd, sizeof(sndd), userdata);
+  return xfer_sound(EDIT_BUF, buf_no, dev_no, parameter_list(buf_no),
+                    sender, userdata);
 }
 
-/* Send patch dump to Blofeld. Used when user presses Send button in UI. */
+/* Send patch to Blofeld. Used when user presses Send button in UI.
+ * Only what differs from what the synth already has is actually sent. */
 void
 blofeld_send_dump(int buf_no, int dev_no)
 {
-  blofeld_xfer_dump(buf_no, dev_no, midi_send, 0);
+  blofeld_sync(buf_no, dev_no);
 }
 
-/* Send single parameter value to Blofeld. */
-static
-void send_parameter_update(int parnum, int buf_no, int devno, int value)
+/* Send sound to given bank and program in Blofeld. Note that this
+ * overwrites the sound stored in the synth. */
+void
+blofeld_send_sound(int bank, int program, int dev_no,
+                   const unsigned char *params)
+{
+  xfer_sound(bank, program, dev_no, params, midi_send, 0);
+}
+
+/* Queue one wave of a user wavetable for paced sending to Blofeld.
+ * Each sample is sent as a 21 bit two's complement value in three 7 bit
+ * bytes, most significant first. */
+int
+blofeld_queue_wave(int slot, int wave_no, int dev_no, const int *samples,
+                   const char *name)
+{
+  unsigned char wtbd[BLOFELD_WAVE_MSG_LEN] = {
+    SYSEX, sysex_id, equipment_id, dev_no, WTBD,
+    BLOFELD_USER_WAVETABLE_FIRST + slot, /* BB */
+    wave_no, /* NN */
+    0 };
+  unsigned char *data = &wtbd[SDATA + 1];
+  int i;
+
+  for (i = 0; i < BLOFELD_WAVE_LEN; i++) {
+    *data++ = (samples[i] >> 14) & 0x7f;
+    *data++ = (samples[i] >> 7) & 0x7f;
+    *data++ = samples[i] & 0x7f;
+  }
+  for (i = 0; i < BLOFELD_WAVETABLE_NAME_LEN; i++) {
+    unsigned char ch = *name ? *name++ : ' ';
+    *data++ = ch < 0x20 || ch > 0x7e ? ' ' : ch;
+  }
+  *data++ = 0; /* reserved */
+  *data++ = 0;
+  *data++ = midi_csum(&wtbd[SDATA], BLOFELD_WAVE_DATA_LEN);
+  *data = EOX;
+
+  return midi_queue_sysex(SYNTH_PORT, wtbd, sizeof(wtbd));
+}
+
+/* Remember parameter change being sent, for echo detection */
+static void
+echo_expect(int buf_no, int parnum, int value)
+{
+  struct sent_param *sent = &echoes.slot[echoes.head++ % ECHO_SLOTS];
+
+  sent->sent = timestamp_ms();
+  sent->parnum = parnum;
+  sent->buf_no = buf_no;
+  sent->value = value;
+  sent->matched = 0;
+}
+
+/* Return 1 if incoming parameter change is an echo of one recently sent */
+static int
+echo_check(int buf_no, int parnum, int value)
+{
+  long long now = timestamp_ms();
+  unsigned int i, match = 0;
+
+  /* Newest first; stop at the first expired (or never used) slot */
+  for (i = 1; i <= ECHO_SLOTS; i++) {
+    struct sent_param *sent = &echoes.slot[(echoes.head - i) % ECHO_SLOTS];
+
+    if (!sent->sent || now - sent->sent > ECHO_WINDOW)
+      break;
+    if (sent->parnum != parnum || sent->buf_no != buf_no)
+      continue;
+    if (sent->matched) /* and so are all earlier ones */
+      return 0;
+    if (sent->value == value) {
+      match = i;
+      break;
+    }
+  }
+  if (!match)
+    return 0;
+
+  /* Mark the change, and the earlier ones for the parameter, as echoed */
+  for (i = match; i <= ECHO_SLOTS; i++) {
+    struct sent_param *sent = &echoes.slot[(echoes.head - i) % ECHO_SLOTS];
+
+    if (!sent->sent || now - sent->sent > ECHO_WINDOW)
+      break;
+    if (sent->parnum == parnum && sent->buf_no == buf_no)
+      sent->matched = 1;
+  }
+  echoes.dropped++;
+  xprintf("Blofeld dropped echo: parnum %d, buf %d, value %d\n",
+          parnum, buf_no, value);
+  return 1;
+}
+
+/* Return number of echoed parameter changes dropped */
+int
+blofeld_get_echoes_dropped(void)
+{
+  return echoes.dropped;
+}
+
+/* Send single parameter value to Blofeld, without recording it */
+static void
+send_sndp(int parnum, int buf_no, int devno, int value)
 {
   unsigned char sndp[] = { SYSEX,
-                           SYSEX_ID_WALDORF,
-                           EQUIPMENT_ID_BLOFELD,
+                           sysex_id,
+                           equipment_id,
                            devno, /* device number */
                            SNDP,
                            buf_no,
@@ -750,15 +636,145 @@ void send_parameter_update(int parnum, int buf_no, int devno, int value)
 
   xprintf("Blofeld update param: parnum %d, buf %d, value %d\n",
           parnum, buf_no, value);
+  if (parnum < BLOFELD_PARAMS) {
+    mirror_send(sndp, sizeof(sndp));
+    synth_list(buf_no)[parnum] = value;
+    echo_expect(buf_no, parnum, value);
+  }
+}
+
+/* Send single parameter value to Blofeld. */
+static
+void send_parameter_update(int parnum, int buf_no, int devno, int value)
+{
+  send_sndp(parnum, buf_no, devno, value);
   if (parnum < BLOFELD_PARAMS)
-    midi_send_sysex(SYNTH_PORT, sndp, sizeof(sndp));
+    automation_record(buf_no, parnum, value);
+}
+
+/* Schedule single parameter value for sending to Blofeld at given tick.
+ * Used as automation_sched_func during automation playback. */
+static int
+sched_parameter_update(int buf_no, int parnum, int value, unsigned int tick,
+                       void *ref)
+{
+  unsigned char sndp[] = { SYSEX,
+                           sysex_id,
+                           equipment_id,
+                           device_number,
+                           SNDP,
+                           buf_no,
+                           parnum >> 7, parnum & 127, /* big endian */
+                           value,
+                           EOX };
+
+  return mirror_output(sndp, sizeof(sndp), 1, tick);
+}
+
+/* Prototype for forward declaration */
+static void update_ui(int parnum, int buf_no, int value);
+
+/* Show parameter value sent by automation playback.
+ * Used as automation_show_func. */
+static void
+show_parameter_update(int buf_no, int parnum, int value, void *ref)
+{
+  if (parnum >= BLOFELD_PARAMS) /* sanity check */
+    return;
+  synth_list(buf_no)[parnum] = value;
+  echo_expect(buf_no, parnum, value);
+  update_ui(parnum, buf_no, value);
+}
+
+/* Play back recorded automation */
+int
+blofeld_automation_play(int tempo)
+{
+  return automation_play(tempo, sched_parameter_update,
+                         show_parameter_update, NULL);
+}
+
+/* Send whole sound to edit buffer in Blofeld, updating our shadow of it */
+static void
+send_sndd(int buf_no, int dev_no, const unsigned char *params)
+{
+  struct part_cache *part = part_cache(buf_no);
+
+  xfer_sound(EDIT_BUF, buf_no, dev_no, params, mirror_sender, 0);
+  memcpy(part->synth, params, BLOFELD_PARAMS);
+  part->synth_valid = 1;
+}
+
+/* Cost model for sending several parameters at once. Each sysex message
+ * costs its length in bytes on the wire, plus some fixed overhead for
+ * getting it there (system call, ALSA event, and the synth's processing of
+ * each message), which we express as an equivalent number of bytes. */
+#define SNDP_BYTES 10
+#define SNDD_BYTES BLOFELD_SOUND_MSG_LEN
+#define MSG_OVERHEAD_BYTES 16
+
+/* Send all parameters that differ between old_params (what the synth has)
+ * and new_params (what we want it to have) for a given buffer, using
+ * either one SNDP for each differing parameter or a single SNDD for the
+ * whole sound, whichever is cheaper. Returns the path taken. */
+static enum delta_path
+send_param_delta(int buf_no, int dev_no,
+                 const unsigned char *old_params,
+                 const unsigned char *new_params)
+{
+  int parnum;
+  int changed = 0;
+
+  /* Changes are recorded the same way whichever way they are sent */
+  for (parnum = 0; parnum < BLOFELD_PARAMS; parnum++)
+    if (old_params[parnum] != new_params[parnum]) {
+      automation_record(buf_no, parnum, new_params[parnum]);
+      changed++;
+    }
+
+  if (!changed)
+    return DELTA_NONE;
+
+  if (changed * (SNDP_BYTES + MSG_OVERHEAD_BYTES) <
+      SNDD_BYTES + MSG_OVERHEAD_BYTES) {
+    xprintf("Blofeld delta: %d params for buf %d sent as SNDP\n",
+            changed, buf_no);
+    for (parnum = 0; parnum < BLOFELD_PARAMS; parnum++)
+      if (old_params[parnum] != new_params[parnum])
+        send_sndp(parnum, buf_no, dev_no, new_params[parnum]);
+    return DELTA_SNDP;
+  }
+
+  xprintf("Blofeld delta: %d params for buf %d sent as SNDD\n",
+          changed, buf_no);
+  send_sndd(buf_no, dev_no, new_params);
+  return DELTA_SNDD;
 }
 
+/* Bring synth in line with what the editor shows for given buffer,
+ * sending as little as possible. If we don't know what the synth has,
+ * send the whole sound. Returns the path taken. */
+enum delta_path
+blofeld_sync(int buf_no, int dev_no)
+{
+  struct part_cache *part = part_cache(buf_no);
+
+  if (!part->synth_valid) {
+    xprintf("Blofeld sync: synth state for buf %d unknown, sending SNDD\n",
+            buf_no);
+    send_sndd(buf_no, dev_no, part->params);
+    return DELTA_SNDD;
+  }
+  return send_param_delta(buf_no, dev_no, part->synth, part->params);
+}
 
 /* Prototype for forward declaration */
 static void update_ui_int_param_children(struct blofeld_param *param,
                                          struct blofeld_param *excepted_child,
                                          int buf_no, int value, int mask);
+static void update_ui_int_param(struct blofeld_param *param, int buf_no,
+                                int parval);
+static void update_global_param(struct blofeld_param *param, int value);
 
 
 /* Convert UI representation of value to MIDI parameter value */
@@ -786,12 +802,121 @@ ui_to_param_value(struct blofeld_param *param, int value)
   return value;
 }
 
+/* While a batch is open, changes to integer parameters are applied to the
+ * parameter list as usual, but sending them to the synth, and updating
+ * the siblings of bitmapped parameters in the UI, is deferred until the
+ * batch ends. At that point, each parameter byte which has changed is sent
+ * exactly once, however many of its bitmapped children were changed, and
+ * each set of siblings is refreshed once. */
+struct batch_entry {
+  int parnum; /* parameter byte, i.e. parent of bitmapped parameters */
+  int buf_no;
+  int old_value; /* value before the batch */
+  int mask; /* union of bitmasks of changed children */
+  unsigned int changed_children; /* bit n set => parent->child[n] changed */
+};
+
+static struct {
+  int depth;
+  int entries;
+  struct batch_entry entry[BLOFELD_PARAMS];
+} batch;
+
+/* Send parameter byte, and update UI for the siblings of the changed
+ * children, if any. */
+static void
+flush_batch_entry(struct batch_entry *entry)
+{
+  struct blofeld_param *parent = &blofeld_params[entry->parnum];
+  int value = parameter_list(entry->buf_no)[entry->parnum];
+  struct blofeld_param *child;
+  int n;
+
+  if (value == entry->old_value) return;
+
+  if (entry->mask) {
+    /* Like update_ui_int_param_children(), but skipping all the
+     * children that were changed rather than just one. */
+    for (child = parent->child, n = 0;
+         child->bm_param && child->bm_param->parent_param == parent;
+         child++, n++) {
+      int bitmask = child->bm_param->bitmask;
+      if ((bitmask & entry->mask) &&
+          (n >= 32 || !(entry->changed_children & (1u << n))))
+        update_ui_int_param(child, entry->buf_no,
+                            (value & bitmask) >> child->bm_param->bitshift);
+    }
+  }
+  send_parameter_update(entry->parnum, entry->buf_no, device_number, value);
+}
+
+/* Add change to open batch. Returns 0 if the batch is full, in which case
+ * the caller has to send the change right away. */
+static int
+batch_add(struct blofeld_param *param, int parnum, int buf_no, int old_value)
+{
+  struct batch_entry *entry;
+  int i;
+
+  for (i = 0; i < batch.entries; i++)
+    if (batch.entry[i].parnum == parnum && batch.entry[i].buf_no == buf_no)
+      break;
+  if (i == batch.entries) {
+    if (batch.entries >= BLOFELD_PARAMS) return 0;
+    entry = &batch.entry[batch.entries++];
+    entry->parnum = parnum;
+    entry->buf_no = buf_no;
+    entry->old_value = old_value;
+    entry->mask = 0;
+    entry->changed_children = 0;
+  } else
+    entry = &batch.entry[i];
+
+  if (param->bm_param) {
+    int n = param - param->bm_param->parent_param->child;
+    entry->mask |= param->bm_param->bitmask;
+    if (n < 32)
+      entry->changed_children |= 1u << n;
+  }
+  return 1;
+}
+
+/* Begin batch of parameter changes. Batches may be nested, in which case
+ * nothing is sent until the outermost one ends. The changes are recorded
+ * as one undo step. */
+void
+blofeld_batch_begin(void)
+{
+  if (batch.depth++ == 0) {
+    batch.entries = 0;
+    journal_begin_group();
+    param_bus_begin_batch();
+  }
+}
+
+/* End batch of parameter changes, sending whatever has changed. */
+void
+blofeld_batch_end(void)
+{
+  int i;
+
+  if (batch.depth == 0 || --batch.depth > 0) return;
+
+  xprintf("Blofeld batch: %d parameter bytes touched\n", batch.entries);
+  for (i = 0; i < batch.entries; i++)
+    flush_batch_entry(&batch.entry[i]);
+  batch.entries = 0;
+  param_bus_end_batch();
+  journal_end_group();
+}
+
 /* Update numeric (integer) parameter and send to Blofeld */
 static void
 update_int_param(struct blofeld_param *param,
                  int parnum, int buf_no, int value)
 {
   int parval = ui_to_param_value(param, value);
+  int old_value;
 
   /* If bitmap param, fetch parent, then update value */
   if (param->bm_param) {
@@ -804,16 +929,23 @@ update_int_param(struct blofeld_param *param,
     int mask = param->bm_param->bitmask;
     int shift = param->bm_param->bitshift;
     /* mask out non-changed bits, then or with new value */
-    parval = (parameter_list[parnum] & ~mask) | (parval << shift);
+    parval = (parameter_list(buf_no)[parnum] & ~mask) | (parval << shift);
+  }
 
+  /* Update parameter list, then send to Blofeld, unless it's part of
+   * a batch, in which case it's sent when the batch ends. */
+  old_value = parameter_list(buf_no)[parnum];
+  journal_record(buf_no, parnum, old_value, parval);
+  parameter_list(buf_no)[parnum] = parval;
+  if (batch.depth && batch_add(param, parnum, buf_no, old_value))
+    return;
+
+  if (param->bm_param)
     /* Update UI for all children that have a bitmask that overlaps,
      * (skipping the one we've just received the update for)  */
     /* This happens for for instance LFO Speed vs Clock */
-    update_ui_int_param_children(parent, param, buf_no, parval, mask);
-  }
-
-  /* Update parameter list, then send to Blofeld */
-  parameter_list[parnum] = parval;
+    update_ui_int_param_children(&blofeld_params[parnum], param, buf_no,
+                                 parval, param->bm_param->bitmask);
   send_parameter_update(parnum, buf_no, device_number, parval);
 }
 
@@ -832,9 +964,11 @@ update_str_param(struct blofeld_param *param, int parnum,
     return;
   }
   parnum = parent - blofeld_params; /* param no of first char of parent */
+  unsigned char *params = parameter_list(buf_no);
   /* Now update each char parameter in the param list, then
    * send it on to Blofeld. */
   int len = param->bm_param->bitshift; /* we use bitshift field as (max) len */
+  journal_begin_group();
   while (len--) {
     /* If we run out of the end of the string, the rest of the chars are ' ' */
     /* So once we hit \0, stay there, otherwise move on. */
@@ -843,12 +977,14 @@ update_str_param(struct blofeld_param *param, int parnum,
      * are changed. Otherwise, we send the whole string each time a single
      * character is updated. We could do this for ordinary parameters too,
      * but the gain would be much less. */
-    if (parameter_list[parnum] != ch) {
-      parameter_list[parnum] = ch;
+    if (params[parnum] != ch) {
+      journal_record(buf_no, parnum, params[parnum], ch);
+      params[parnum] = ch;
       send_parameter_update(parnum, buf_no, device_number, ch);
     }
     parnum++;
   }
+  journal_end_group();
 }
 
 /* called from UI when parameter updated */
@@ -856,12 +992,14 @@ update_str_param(struct blofeld_param *param, int parnum,
 static void
 blofeld_update_param(int parnum, int buf_no, const void *valptr)
 {
-  if (parnum >= BLOFELD_PARAMS_ALL || !valptr) /* sanity check */
+  if (parnum >= blofeld_params_all || !valptr) /* sanity check */
     return;
 
   struct blofeld_param *param = &blofeld_params[parnum];
 
-  if (param->limits) /* string parameters have limits set to NULL */
+  if (param->global_offset >= 0)
+    update_global_param(param, *(const int *)valptr);
+  else if (param->limits) /* string parameters have limits set to NULL */
     update_int_param(param, parnum, buf_no, *(const int *)valptr);
   else
     update_str_param(param, parnum, buf_no, valptr);
@@ -900,7 +1038,7 @@ update_ui_int_param(struct blofeld_param *param, int buf_no, int parval)
 {
   int parnum = param - blofeld_params;
   int value = param_value_to_ui(param, parval);
-  if (notify_ui) notify_ui(parnum, buf_no, &value, notify_ref);
+  param_bus_post(parnum, buf_no, value);
 }
 
 /* Update string parameter in UI. (Only one we have is patch name.) */
@@ -912,12 +1050,13 @@ update_ui_str_param(struct blofeld_param *param, int buf_no)
   unsigned char string[len + 1];
   int parnum = param - blofeld_params;
   int parent_parnum = param->bm_param->parent_param - blofeld_params;
+  unsigned char *params = parameter_list(buf_no);
   int i;
 
   for (i = 0; i < len; i++)
-    string[i] = (unsigned char) parameter_list[parent_parnum + i];
+    string[i] = params[parent_parnum + i];
   string[len] = '\0';
-  if (notify_ui) notify_ui(parnum, buf_no, string, notify_ref);
+  param_bus_post_string(parnum, buf_no, (const char *) string);
 }
 
 /* update the ui for all children of the supplied param but only if the
@@ -959,7 +1098,7 @@ update_ui(int parnum, int buf_no, int value)
   xprintf("Blofeld update ui: parno %d, buf %d, value %d\n",
           parnum, buf_no, value);
 
-  parameter_list[parnum] = value;
+  parameter_list(buf_no)[parnum] = value;
 
   if (!param->child) { /* no children => ordinary parameter ... */
     if (param->limits) /* ... unless it has no limits, then it's 'reserved' */
@@ -979,19 +1118,26 @@ update_ui(int parnum, int buf_no, int value)
 }
 
 /* Update all parameter values in UI when sound dump received. */
+/* If force is set, or we haven't got any valid parameters for the buffer
+ * yet, all parameters are updated, otherwise only those that differ. */
 static void
-update_ui_all(unsigned char *param_buf, int buf_no)
+update_ui_all(const unsigned char *param_buf, int buf_no, int force)
 {
   int parnum;
-  static int force = 1; /* force complete update first time called */
+  unsigned char *params = parameter_list(buf_no);
 
+  if (!parts[buf_no].valid)
+    force = 1;
+
+  param_bus_begin_batch();
   for (parnum = 0; parnum < BLOFELD_PARAMS; parnum++) {
     /* Only send UI updates for parameters that differ */
-    if (param_buf[parnum] != parameter_list[parnum] || force) {
+    if (param_buf[parnum] != params[parnum] || force) {
       update_ui(parnum, buf_no, param_buf[parnum]);
     }
   }
-  force = 0;
+  param_bus_end_batch();
+  parts[buf_no].valid = 1;
 }
 
 /* Cap a value at min and max limits */
@@ -1014,7 +1160,7 @@ update_ui_all(unsigned char *param_buf, int buf_no)
 static int
 blofeld_update_value(int parno, int old_val, int new_val, int delta)
 {
-  if (parno >= BLOFELD_PARAMS_ALL) return old_val; /* sanity check */
+  if (parno >= blofeld_params_all) return old_val; /* sanity check */
 
   struct blofeld_param *param = &blofeld_params[parno];
   int min = param->limits->min;
@@ -1055,20 +1201,22 @@ blofeld_update_value(int parno, int old_val, int new_val, int delta)
 
 /* Return pointer to parameter list for given parameter number. */
 /* We return this as a pointer, so that all parameter references, including
- * strings, can use the same type (void *) without too much type casting. */
+ * strings, can use the same type (void *) without too much type casting.
+ * Parameter values are stored as unsigned chars, just as in the dump. */
 /* Not referenced directly, but via struct, hence 'static' */
 void *
 blofeld_fetch_parameter(int parnum, int buf_no)
 {
   if (parnum < BLOFELD_PARAMS)
-    return &parameter_list[parnum];
+    return &parameter_list(buf_no)[parnum];
+  if (parnum < blofeld_params_all && blofeld_params[parnum].global_offset >= 0)
+    return &globals.params[blofeld_params[parnum].global_offset];
   return NULL;
 }
 
-/* Take sysex sound dump and update UI with all values. */
-/* Length checks etc expected to have been carried out by caller. */
+/* Verify checksum of sysex sound dump. Return 0 if ok, else -1. */
 static int
-receive_sndd(char *buf)
+check_sndd(const unsigned char *buf)
 {
   int checksum = midi_csum(&buf[SDATA], BLOFELD_PARAMS);
   int expected = buf[SDATA + BLOFELD_PARAMS];
@@ -1078,88 +1226,852 @@ receive_sndd(char *buf)
             checksum, expected);
    return -1;
   }
-  update_ui_all(&buf[SDATA], buf[NN]);
   return 0;
 }
 
-/* Function to register with MIDI handler to process incoming sysex.
- * MIDI handler has alreday verified sysex id when we get called. */
-/* Not referenced directly, but via function pointer, hence 'static' */
-static void
-blofeld_midi_sysex(void *buffer, int len)
+/* Take sysex sound dump and update UI with all values. */
+/* Length checks etc expected to have been carried out by caller. */
+static int
+receive_sndd(unsigned char *buf, int buf_no)
 {
-  unsigned char *buf = buffer;
-
-  xprintf("Blofeld received sysex, len %d\n", len);
-  if (len <= IDE || buf[IDE] != EQUIPMENT_ID_BLOFELD) return;
-  switch (buf[IDM]) {
-    case SNDP: update_ui(MIDI_2BYTE(buf[HH], buf[PP]), buf[LL], buf[XX]);
-               break;
-    case SNDD: if (buf[BB] == EDIT_BUF)
-                 receive_sndd(buf);
-               break;
-    case SNDR:
-    case GLBR:
-    case GLBD:
-    default: break; /* ignore these */
+  if (check_sndd(buf) < 0)
+    return -1;
+  if (buf_no < 0 || buf_no >= BLOFELD_BUFFERS) {
+    eprintf("Warning: Sound dump for nonexistent buffer %d\n", buf_no);
+    return -1;
   }
+  update_ui_all(&buf[SDATA], buf_no, 0);
+  return 0;
 }
 
-/* Reading patch dumps from file is slightly different than from MIDI,
- * as we don't care about the buffer number (BB) stored in the file,
- * and we only accept sound dumps (SNDD), not single parameter updates */
-int
-blofeld_file_sysex(void *buffer, int len)
+/* Handle sound dump arriving via MIDI. Edit buffer dumps go to the
+ * corresponding part, and dumps from the sound banks are handed over to
+ * the bank manager. Either way, we tell the request tracker that the
+ * dump has arrived. */
+static void
+receive_sound_dump(unsigned char *buf, int len)
 {
-  unsigned char *buf = buffer;
+  int bank = buf[BB];
+  int buf_no = buf[NN];
 
-  xprintf("Blofeld read sound dump from file\n");
-  if (len <= IDE || buf[IDE] != EQUIPMENT_ID_BLOFELD || buf[IDM] != SNDD)
-    return -1;
-  receive_sndd(buf);
-}
+  if (len < SDATA + BLOFELD_PARAMS + 1) {
+    eprintf("Warning: Short sound dump received, length %d\n", len);
+    return;
+  }
 
+  if (bank == EDIT_BUF) {
+    if (receive_sndd(buf, buf_no) < 0)
+      return;
+    parts[buf_no].refreshed = timestamp_ms();
+    /* This is now what the synth has */
+    memcpy(parts[buf_no].synth, &buf[SDATA], BLOFELD_PARAMS);
+    parts[buf_no].synth_valid = 1;
+  } else if (bank < BLOFELD_BANKS) {
+    if (check_sndd(buf) < 0)
+      return;
+    blofeld_bank_store(bank, buf_no, &buf[SDATA]);
+  } else
+    return; /* Not something we know how to handle */
 
-/* Called at UI startup to register UI callback which will be called when
- * we need to update parameter in UI (as a result of receiving parameter
- * update from Blofeld (single parameter update or patch dump), from file,
- * or from Paste operation. */
-void
-blofeld_register_notify_cb(notify_cb cb, void *ref)
-{
-  notify_ui = cb;
-  notify_ref = ref;
+  /* Replies are matched to requests using BB and NN, so
+   * it doesn't matter in which order they arrive. */
+  request_complete(buf[DEV], bank, buf_no);
 }
 
-/* Copy selected parameters to selected paste buffer */
-void
-blofeld_copy_to_paste(int par_from, int par_to, int buf_no, int paste_buf)
+/* Handle single parameter change arriving via MIDI */
+static void
+receive_sndp(const unsigned char *buf)
 {
-  if (paste_buf >= PASTE_BUFFERS) return;
-
-  void *src = &parameter_list[par_from];
-  void *dest = &paste_buffer[paste_buf][par_from];
-  int len = (par_to + 1 - par_from) * sizeof(parameter_list[0]);
+  int parnum = MIDI_2BYTE(buf[HH], buf[PP]);
 
-  memcpy(dest, src, len);
+  if (parnum >= BLOFELD_PARAMS) /* sanity check */
+    return;
+  if (echo_check(buf[LL], parnum, buf[XX]))
+    return;
+  synth_list(buf[LL])[parnum] = buf[XX];
+  update_ui(parnum, buf[LL], buf[XX]);
+  automation_record(buf[LL], parnum, buf[XX]);
+}
+
+/* Send global dump request to Blofeld.
+ * Used as request_send_func by the request tracker. */
+static void
+send_glbr(int devno, int bank, int buf_no)
+{
+  if (devno == REQUEST_ANY_DEVICE)
+    devno = BROADCAST_DEV;
+
+  unsigned char glbr[] = { SYSEX,
+                           sysex_id,
+                           equipment_id,
+                           devno, /* device number */
+                           GLBR,
+                           EOX };
+
+  midi_send_sysex(SYNTH_PORT, glbr, sizeof(glbr));
+}
+
+/* Send our global parameters to Blofeld */
+static void
+send_glbd(int devno)
+{
+  unsigned char glbd[SDATA + GLOBAL_DUMP_MAX + 2] = { SYSEX,
+                                                      sysex_id,
+                                                      equipment_id,
+                                                      devno,
+                                                      GLBD };
+  int len = globals.len;
+
+  /* Global dumps have no BB and NN, so the data starts right after IDM */
+  memcpy(&glbd[IDM + 1], globals.params, len);
+  glbd[IDM + 1 + len] = midi_csum(globals.params, len);
+  glbd[IDM + 1 + len + 1] = EOX;
+  midi_send_sysex(SYNTH_PORT, glbd, IDM + 1 + len + 2);
+}
+
+/* Update global parameter in UI */
+static void
+update_ui_global_param(struct blofeld_param *param, int parval)
+{
+  int parnum = param - blofeld_params;
+  param_bus_post(parnum, selected_buffer, param_value_to_ui(param, parval));
+}
+
+/* Update all global parameters in UI from cache. If force is not set,
+ * only those that differ from old_params are updated. */
+static void
+update_ui_globals(const unsigned char *old_params, int force)
+{
+  int parnum;
+
+  param_bus_begin_batch();
+  for (parnum = BLOFELD_PARAMS; parnum < blofeld_params_all; parnum++) {
+    struct blofeld_param *param = &blofeld_params[parnum];
+    int offset = param->global_offset;
+
+    if (offset < 0 || offset >= globals.len) continue;
+    if (force || old_params[offset] != globals.params[offset])
+      update_ui_global_param(param, globals.params[offset]);
+  }
+  param_bus_end_batch();
+}
+
+/* Handle global dump arriving via MIDI. This is the only thing that
+ * invalidates our cached global parameters, so we take them over
+ * regardless of whether we asked for them or not. */
+static void
+receive_global_dump(unsigned char *buf, int len)
+{
+  unsigned char old_params[GLOBAL_DUMP_MAX];
+  int data_len = len - (IDM + 1) - 2; /* minus checksum and EOX */
+  int force = !globals.valid;
+
+  if (data_len <= 0 || data_len > GLOBAL_DUMP_MAX) {
+    eprintf("Warning: Global dump with bad length %d received\n", len);
+    return;
+  }
+  if (midi_csum(&buf[IDM + 1], data_len) != buf[IDM + 1 + data_len]) {
+    eprintf("Warning: Incorrect checksum in received global dump\n");
+    return;
+  }
+
+  memcpy(old_params, globals.params, sizeof(old_params));
+  memcpy(globals.params, &buf[IDM + 1], data_len);
+  globals.len = data_len;
+  globals.dev_no = buf[DEV];
+  globals.valid = 1;
+  globals.dirty = 0;
+  update_ui_globals(old_params, force);
+
+  request_complete(buf[DEV], GLOBAL_REQUEST_BANK, 0);
+}
+
+/* Update global parameter from UI. The change is sent to the synth
+ * from global_timer(). */
+static void
+update_global_param(struct blofeld_param *param, int value)
+{
+  /* Sending a global dump without having received one first would
+   * overwrite the synth's settings with whatever we have. */
+  if (!globals.valid || param->global_offset >= globals.len) {
+    xprintf("No global dump yet, ignoring change of %s\n", param->name);
+    return;
+  }
+  globals.params[param->global_offset] = ui_to_param_value(param, value);
+  globals.dirty = 1;
+}
+
+/* Send changed global parameters, if it's time to do so. */
+static void
+global_timer(void)
+{
+  long long now;
+
+  if (!globals.dirty) return;
+
+  now = timestamp_ms();
+  if (now - globals.sent < GLOBAL_SEND_INTERVAL) return;
+
+  send_glbd(globals.dev_no);
+  globals.sent = now;
+  globals.dirty = 0;
 }
 
-/* Copy selected parameters from selected paste buffer */
+/* Get global parameters. If we have a valid cache for the device, the UI
+ * is updated from it, otherwise a global dump is requested. */
+int
+blofeld_get_globals(int dev_no, int force)
+{
+  if (!force && globals.valid &&
+      (globals.dev_no == dev_no || dev_no == BROADCAST_DEV)) {
+    update_ui_globals(globals.params, 1);
+    return 0;
+  }
+
+  /* The Blofeld answers broadcast requests with its own device number */
+  if (dev_no == BROADCAST_DEV)
+    dev_no = REQUEST_ANY_DEVICE;
+  return request_submit(dev_no, GLOBAL_REQUEST_BANK, 0, send_glbr,
+                        NULL, NULL);
+}
+
+/* Send multi dump request to Blofeld.
+ * Used as request_send_func by the request tracker. */
+static void
+send_mulr(int devno, int bank, int buf_no)
+{
+  if (devno == REQUEST_ANY_DEVICE)
+    devno = BROADCAST_DEV;
+
+  unsigned char mulr[] = { SYSEX,
+                           sysex_id,
+                           equipment_id,
+                           devno, /* device number */
+                           MULR,
+                           EDIT_BUF, /* multi edit buffer */
+                           buf_no,
+                           EOX };
+
+  midi_send_sysex(SYNTH_PORT, mulr, sizeof(mulr));
+}
+
+/* Fill in part configuration from multi dump data */
+static void
+parse_part_config(struct blofeld_part_config *part, const unsigned char *data)
+{
+  part->bank = data[PART_BANK];
+  part->program = data[PART_PROGRAM];
+  part->volume = data[PART_VOLUME];
+  part->pan = data[PART_PAN] - 64;
+  part->transpose = data[PART_TRANSPOSE] - 64;
+  part->detune = data[PART_DETUNE] - 64;
+  part->channel = data[PART_CHANNEL];
+  part->key_low = data[PART_KEY_LOW];
+  part->key_high = data[PART_KEY_HIGH];
+  part->vel_low = data[PART_VEL_LOW];
+  part->vel_high = data[PART_VEL_HIGH];
+}
+
+/* Handle multi dump arriving via MIDI. Apart from taking over the part
+ * configurations, we request sound dumps for all parts which we don't have
+ * recent parameters for. The requests are all submitted at once, so the
+ * synth can send the dumps back to back rather than us waiting for each
+ * one before asking for the next. */
+static void
+receive_multi_dump(unsigned char *buf, int len)
+{
+  unsigned char *data = &buf[SDATA];
+  int buf_no, queued = 0;
+  long long now;
+
+  if (len != SDATA + MULTI_DUMP_LEN + 2) {
+    eprintf("Warning: Multi dump with bad length %d received\n", len);
+    return;
+  }
+  if (midi_csum(data, MULTI_DUMP_LEN) != buf[SDATA + MULTI_DUMP_LEN]) {
+    eprintf("Warning: Incorrect checksum in received multi dump\n");
+    return;
+  }
+
+  memcpy(multi.name, &data[MULTI_NAME], BLOFELD_PATCH_NAME_LEN_MAX);
+  multi.name[BLOFELD_PATCH_NAME_LEN_MAX] = '\0';
+  multi.volume = data[MULTI_VOLUME];
+  multi.tempo = data[MULTI_TEMPO];
+  for (buf_no = 0; buf_no < BLOFELD_BUFFERS; buf_no++)
+    parse_part_config(&multi.part[buf_no],
+                      &data[MULTI_PART + buf_no * MULTI_PART_LEN]);
+  multi.valid = 1;
+  xprintf("Received multi %s\n", multi.name);
+
+  /* The synth answers the requests one at a time, so each one has to
+   * wait for the ones before it. */
+  now = timestamp_ms();
+  for (buf_no = 0; buf_no < BLOFELD_BUFFERS; buf_no++) {
+    struct part_cache *part = &parts[buf_no];
+    if (!part->valid || now - part->refreshed > PART_CACHE_MAX_AGE)
+      if (blofeld_request_dump(EDIT_BUF, buf_no, buf[DEV], queued,
+                               NULL, NULL) >= 0)
+        queued++;
+  }
+
+  request_complete(buf[DEV], MULTI_REQUEST_BANK, 0);
+}
+
+/* Get multi edit buffer from Blofeld, followed by the sounds of its parts */
+int
+blofeld_get_multi(int dev_no, request_done_cb cb, void *ref)
+{
+  /* The Blofeld answers broadcast requests with its own device number */
+  if (dev_no == BROADCAST_DEV)
+    dev_no = REQUEST_ANY_DEVICE;
+  return request_submit(dev_no, MULTI_REQUEST_BANK, 0, send_mulr, cb, ref);
+}
+
+/* Return last multi received */
+const struct blofeld_multi *
+blofeld_get_multi_config(void)
+{
+  return &multi;
+}
+
+/* Function to register with MIDI handler to process incoming sysex.
+ * MIDI handler has alreday verified sysex id when we get called. */
+/* Not referenced directly, but via function pointer, hence 'static' */
+static void
+blofeld_midi_sysex(void *buffer, int len)
+{
+  unsigned char *buf = buffer;
+
+  xprintf("Blofeld received sysex, len %d\n", len);
+  if (len <= IDE || buf[IDE] != equipment_id) return;
+  switch (buf[IDM]) {
+    case SNDP: receive_sndp(buf);
+               break;
+    case SNDD: receive_sound_dump(buf, len);
+               break;
+    case GLBD: receive_global_dump(buf, len);
+               break;
+    case MULD: receive_multi_dump(buf, len);
+               break;
+    case SNDR:
+    case GLBR:
+    case MULR:
+    default: break; /* ignore these */
+  }
+}
+
+/* Record all differences between two parameter lists as one undo step */
+static void
+journal_params(int buf_no, const unsigned char *old_params,
+               const unsigned char *new_params)
+{
+  int parnum;
+
+  journal_begin_group();
+  for (parnum = 0; parnum < BLOFELD_PARAMS; parnum++)
+    journal_record(buf_no, parnum, old_params[parnum], new_params[parnum]);
+  journal_end_group();
+}
+
+/* Parameters as they were before undo/redo, for each buffer touched */
+static unsigned char replay_old[BLOFELD_BUFFERS][BLOFELD_PARAMS];
+static int replay_touched; /* bitmap of buffers touched by undo/redo */
+
+/* Restore parameter during undo/redo. We just update the UI and our
+ * parameter list here; the synth is updated when all parameters have
+ * been restored. */
+static void
+replay_param(int buf_no, int parnum, int value, void *ref)
+{
+  if (buf_no >= BLOFELD_BUFFERS || parnum >= BLOFELD_PARAMS) /* sanity check */
+    return;
+  if (!(replay_touched & (1 << buf_no))) {
+    memcpy(replay_old[buf_no], parameter_list(buf_no), BLOFELD_PARAMS);
+    replay_touched |= 1 << buf_no;
+  }
+  update_ui(parnum, buf_no, value);
+}
+
+/* Send result of undo/redo to synth, as one batch per buffer touched */
+static void
+replay_send(int dev_no)
+{
+  int buf_no;
+
+  for (buf_no = 0; buf_no < BLOFELD_BUFFERS; buf_no++)
+    if (replay_touched & (1 << buf_no))
+      send_param_delta(buf_no, dev_no, replay_old[buf_no],
+                       parameter_list(buf_no));
+  replay_touched = 0;
+}
+
+/* Undo last change. Returns number of parameters restored. */
+int
+blofeld_undo(int dev_no)
+{
+  int count;
+
+  param_bus_begin_batch();
+  count = journal_undo(replay_param, NULL);
+  param_bus_end_batch();
+
+  replay_send(dev_no);
+  return count;
+}
+
+/* Redo last undone change. Returns number of parameters restored. */
+int
+blofeld_redo(int dev_no)
+{
+  int count;
+
+  param_bus_begin_batch();
+  count = journal_redo(replay_param, NULL);
+  param_bus_end_batch();
+
+  replay_send(dev_no);
+  return count;
+}
+
+/* Patch morphing. We morph from the patch in a buffer to a target patch
+ * (from the paste buffer or a file) as the morph position goes from 0
+ * to MORPH_MAX. Parameters with amounts are interpolated, whereas those
+ * which are choices (e.g. waveform or modulation source) switch at the
+ * midpoint. The position can be changed as fast as the user likes, but
+ * we only update the synth every MORPH_INTERVAL ms. */
+
+#define MORPH_MAX 127
+#define MORPH_INTERVAL 40
+
+struct morph {
+  int active;
+  int buf_no;
+  unsigned char from[BLOFELD_PARAMS];
+  unsigned char to[BLOFELD_PARAMS];
+  int position; /* requested position */
+  int applied; /* position last sent to synth */
+  long long next_update; /* timestamp_ms() when we may update synth again */
+};
+
+static struct morph morph = { 0 };
+
+/* Morph single (non-bitmapped) parameter value */
+static int
+morph_value(struct blofeld_param *param, int from, int to, int position)
+{
+  int ui_from, ui_to, ui, value;
+
+  if (position == 0 || from == to)
+    return from;
+  if (position == MORPH_MAX)
+    return to;
+  /* Reserved and string parameters have no limits */
+  if (!param->limits || param->limits->enumerated)
+    return position <= MORPH_MAX / 2 ? from : to;
+
+  /* Interpolate in the UI domain, as the parameter coding isn't always
+   * linear, e.g. for keytrack and arp tempo. */
+  ui_from = param_value_to_ui(param, from);
+  ui_to = param_value_to_ui(param, to);
+  ui = (ui_from * (MORPH_MAX - position) + ui_to * position +
+        MORPH_MAX / 2) / MORPH_MAX;
+  value = ui_to_param_value(param, ui);
+  CAP(value, 0, 127);
+  return value;
+}
+
+/* Morph parent of bitmapped parameters, field by field. Where the
+ * fields of several children overlap (e.g. LFO Speed and Clock), the first
+ * one is used and the rest are skipped. Bits not belonging to any
+ * child switch at the midpoint. */
+static int
+morph_bitmap(struct blofeld_param *parent, int from, int to, int position)
+{
+  struct blofeld_param *child = parent->child;
+  int value = position <= MORPH_MAX / 2 ? from : to;
+  int done_mask = 0;
+
+  do {
+    int bitmask = child->bm_param->bitmask;
+    int bitshift = child->bm_param->bitshift;
+    if (!(bitmask & done_mask)) {
+      int child_value = morph_value(child, (from & bitmask) >> bitshift,
+                                    (to & bitmask) >> bitshift, position);
+      value = (value & ~bitmask) | ((child_value << bitshift) & bitmask);
+      done_mask |= bitmask;
+    }
+    child++;
+  } while (child->bm_param && child->bm_param->parent_param == parent);
+
+  return value;
+}
+
+/* Calculate patch at current morph position and send what has changed */
+static void
+morph_apply(int dev_no)
+{
+  unsigned char *params = parameter_list(morph.buf_no);
+  unsigned char old_params[BLOFELD_PARAMS];
+  int parnum;
+
+  memcpy(old_params, params, BLOFELD_PARAMS);
+
+  param_bus_begin_batch();
+  for (parnum = 0; parnum < BLOFELD_PARAMS; parnum++) {
+    struct blofeld_param *param = &blofeld_params[parnum];
+    int from = morph.from[parnum];
+    int to = morph.to[parnum];
+    int value;
+
+    /* String parameters have a child with bitmask 0 */
+    if (param->child && param->child->bm_param->bitmask)
+      value = morph_bitmap(param, from, to, morph.position);
+    else
+      value = morph_value(param, from, to, morph.position);
+    if (value != params[parnum])
+      update_ui(parnum, morph.buf_no, value);
+  }
+  param_bus_end_batch();
+
+  send_param_delta(morph.buf_no, dev_no, old_params, params);
+  morph.applied = morph.position;
+}
+
+/* Start morph from current patch in buffer to target */
+static void
+morph_start(int buf_no, const unsigned char *target)
+{
+  morph.buf_no = buf_no;
+  memcpy(morph.from, parameter_list(buf_no), BLOFELD_PARAMS);
+  memcpy(morph.to, target, BLOFELD_PARAMS);
+  morph.position = morph.applied = 0;
+  morph.next_update = 0;
+  morph.active = 1;
+}
+
+/* Set up morph from current patch to paste buffer */
 void
+blofeld_morph_from_paste(int buf_no, int paste_buf)
+{
+  if (paste_buf >= PASTE_BUFFERS) return;
+
+  morph_start(buf_no, paste_buffer[paste_buf]);
+}
+
+/* Set up morph from current patch to patch in sysex buffer (from file) */
+int
+blofeld_morph_from_file(void *buffer, int len, int buf_no)
+{
+  unsigned char *buf = buffer;
+
+  if (len < SDATA + BLOFELD_PARAMS + 1 ||
+      buf[IDE] != equipment_id || buf[IDM] != SNDD)
+    return -1;
+  if (check_sndd(buf) < 0)
+    return -1;
+
+  morph_start(buf_no, &buf[SDATA]);
+  return 0;
+}
+
+/* Set morph position; the synth is updated from the timer */
+void
+blofeld_morph_set(int position)
+{
+  CAP(position, 0, MORPH_MAX);
+  morph.position = position;
+}
+
+/* Stop morphing, leaving parameters as they are */
+void
+blofeld_morph_stop(void)
+{
+  morph.active = 0;
+}
+
+/* Update synth if morph position has changed, but not too often */
+static void
+morph_timer(void)
+{
+  long long now;
+
+  if (!morph.active || morph.position == morph.applied)
+    return;
+  now = timestamp_ms();
+  if (now < morph.next_update)
+    return;
+  morph_apply(device_number);
+  morph.next_update = now + MORPH_INTERVAL;
+}
+
+/* Reading patch dumps from file is slightly different than from MIDI,
+ * as we don't care about the buffer number (BB/NN) stored in the file,
+ * loading it into the buffer the user has selected instead,
+ * and we only accept sound dumps (SNDD), not single parameter updates */
+int
+blofeld_file_sysex(void *buffer, int len, int buf_no)
+{
+  unsigned char *buf = buffer;
+
+  xprintf("Blofeld read sound dump from file\n");
+  if (len <= IDE || buf[IDE] != equipment_id || buf[IDM] != SNDD)
+    return -1;
+  if (len < SDATA + BLOFELD_PARAMS + 1)
+    return -1;
+  /* Don't journal a load that receive_sndd is going to reject */
+  if (check_sndd(buf) < 0 || buf_no < 0 || buf_no >= BLOFELD_BUFFERS)
+    return -1;
+
+  /* Loading a file can be undone, unless there was nothing there before */
+  if (part_cache(buf_no)->valid)
+    journal_params(buf_no, parameter_list(buf_no), &buf[SDATA]);
+  return receive_sndd(buf, buf_no);
+}
+
+/* Get how sound parameter is compared between sounds. Parameters are
+ * treated the same way as when morphing: enumerated ones are choices, and
+ * the rest amounts. Bitmap parents hold several unrelated fields, and are
+ * compared as a whole. The name and category don't affect the sound, and
+ * the arpeggiator matters less to how a sound sounds than the rest, in
+ * particular the 32 parameters of the pattern. */
+int
+blofeld_param_metric(int parnum, struct blofeld_param_metric *metric)
+{
+  struct blofeld_param *param;
+
+  if (parnum < 0 || parnum >= BLOFELD_PARAMS || blofeld_is_name_param(parnum))
+    return -1;
+  param = &blofeld_params[parnum];
+  metric->kind = BLOFELD_KIND_CHOICE;
+  metric->range = 0;
+  if (param->child) { /* string or bitmap parent */
+    if (!param->child->bm_param->bitmask)
+      return -1;
+  } else if (!param->limits) /* reserved */
+    return -1;
+  else if (!param->limits->enumerated) {
+    metric->kind = BLOFELD_KIND_AMOUNT;
+    /* Range of parameter values rather than UI values; some limits are
+     * only nominal, but the values are always 7 bit. */
+    metric->range = ui_to_param_value(param, param->limits->max) -
+                    ui_to_param_value(param, param->limits->min);
+    if (metric->range > 127)
+      metric->range = 127;
+    if (metric->range <= 0)
+      return -1;
+  }
+  if (!strncmp(param->name, "Arpeggiator Pattern ", 20))
+    metric->weight = BLOFELD_WEIGHT_MAX / 4;
+  else if (!strncmp(param->name, "Arpeggiator ", 12))
+    metric->weight = BLOFELD_WEIGHT_MAX / 2;
+  else
+    metric->weight = BLOFELD_WEIGHT_MAX;
+  return 0;
+}
+
+/* Return parameters of sound in buffer (part) */
+const unsigned char *
+blofeld_get_params(int buf_no)
+{
+  return parameter_list(buf_no);
+}
+
+/* 64 bit FNV-1a hash of sound parameters, optionally skipping the name.
+ * FNV-1a is quick, and good enough for telling sounds apart. */
+unsigned long long
+blofeld_sound_hash(const unsigned char *params, int with_name)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+  int i;
+
+  for (i = 0; i < BLOFELD_PARAMS; i++) {
+    if (!with_name && name_parnum >= 0 && i == name_parnum) {
+      i += BLOFELD_PATCH_NAME_LEN_MAX - 1;
+      continue;
+    }
+    hash ^= params[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* Return nonzero if parameter is part of the name or category of sound */
+int
+blofeld_is_name_param(int parnum)
+{
+  return parnum == category_parnum ||
+         (name_parnum >= 0 && parnum >= name_parnum &&
+          parnum < name_parnum + BLOFELD_PATCH_NAME_LEN_MAX);
+}
+
+/* Fill in name and category of index entry */
+void
+blofeld_syx_entry_name(struct blofeld_syx_entry *entry,
+                       const unsigned char *params)
+{
+  int i;
+
+  for (i = 0; i < BLOFELD_PATCH_NAME_LEN_MAX && name_parnum >= 0 &&
+              name_parnum + i < BLOFELD_PARAMS; i++) {
+    unsigned char ch = params[name_parnum + i];
+    entry->name[i] = ch < 0x20 || ch > 0x7e ? ' ' : ch;
+  }
+  entry->name[i] = '\0';
+  entry->category = category_parnum >= 0 &&
+                    category_parnum < BLOFELD_PARAMS ?
+                    params[category_parnum] : 0;
+}
+
+/* Fill in name, category, hashes and params of index entry */
+void
+blofeld_syx_entry_fill(struct blofeld_syx_entry *entry,
+                       const unsigned char *params)
+{
+  blofeld_syx_entry_name(entry, params);
+  entry->hash = blofeld_sound_hash(params, 1);
+  entry->sound_hash = blofeld_sound_hash(params, 0);
+  entry->params = params;
+}
+
+/* Index all sound dumps in sysex file, without copying them. Only the
+ * header and name of each dump are looked at; the checksum is verified
+ * if and when the dump is loaded. */
+int
+blofeld_syx_index(const struct syx_file *file,
+                  struct blofeld_syx_entry **index)
+{
+  struct blofeld_syx_entry *entries = NULL, *entry;
+  int count = 0, size = 0;
+  const unsigned char *msg;
+  size_t pos = 0, len;
+
+  while (syx_file_next(file, &pos, &msg, &len)) {
+    if (len < SDATA + BLOFELD_PARAMS + 2 || msg[IDW] != sysex_id ||
+        msg[IDE] != equipment_id || msg[IDM] != SNDD)
+      continue;
+    if (count >= size) {
+      struct blofeld_syx_entry *new_entries;
+
+      size = size ? size * 2 : BLOFELD_BANK_SIZE;
+      new_entries = realloc(entries, size * sizeof(*entries));
+      if (!new_entries) {
+        free(entries);
+        *index = NULL;
+        return -1;
+      }
+      entries = new_entries;
+    }
+    entry = &entries[count++];
+    entry->offset = msg - file->data;
+    entry->len = len;
+    entry->bank = msg[BB];
+    entry->program = msg[NN];
+    blofeld_syx_entry_fill(entry, &msg[SDATA]);
+  }
+  xprintf("Blofeld indexed %d sound dumps\n", count);
+
+  *index = entries;
+  return count;
+}
+
+/* Set device number of synth being edited. Our shadows are of the
+ * previous synth's parts, so the next sync has to send whole sounds. */
+void
+blofeld_set_device_number(int dev_no)
+{
+  int buf_no;
+
+  if (dev_no == device_number)
+    return;
+  device_number = dev_no;
+  for (buf_no = 0; buf_no < BLOFELD_BUFFERS; buf_no++)
+    parts[buf_no].synth_valid = 0;
+}
+
+/* Select buffer (part) to edit. If we already have the parameters for
+ * the part, update the UI with them right away. Unless they are fresh,
+ * we also request a dump so the UI gets updated with whatever has
+ * changed on the synth in the meantime. */
+void
+blofeld_select_buffer(int buf_no, int dev_no)
+{
+  if (buf_no < 0 || buf_no >= BLOFELD_BUFFERS) return;
+
+  struct part_cache *part = &parts[buf_no];
+
+  selected_buffer = buf_no;
+
+  if (part->valid) {
+    unsigned char *params = parameter_list(buf_no);
+    update_ui_all(params, buf_no, 1);
+  }
+
+  if (!part->valid || timestamp_ms() - part->refreshed > PART_CACHE_MAX_AGE)
+    blofeld_get_dump(buf_no, dev_no);
+}
+
+
+/* Called at UI startup to register UI callback which will be called when
+ * we need to update parameter in UI (as a result of receiving parameter
+ * update from Blofeld (single parameter update or patch dump), from file,
+ * or from Paste operation. The UI is just one of the listeners on the
+ * parameter bus; others can subscribe to it directly. */
+void
+blofeld_register_notify_cb(notify_cb cb, void *ref)
+{
+  param_bus_subscribe_single(cb, ref);
+}
+
+/* As blofeld_register_notify_cb, but the callback gets each batch of
+ * updates (e.g. a whole sound dump) in one call. */
+static void
+blofeld_register_batch_cb(param_batch_cb cb, void *ref)
+{
+  param_bus_subscribe(cb, ref);
+}
+
+/* Copy selected parameters to selected paste buffer */
+void
+blofeld_copy_to_paste(int par_from, int par_to, int buf_no, int paste_buf)
+{
+  if (paste_buf >= PASTE_BUFFERS) return;
+
+  void *src = &parameter_list(buf_no)[par_from];
+  void *dest = &paste_buffer[paste_buf][par_from];
+  int len = (par_to + 1 - par_from) * sizeof(paste_buffer[0][0]);
+
+  memcpy(dest, src, len);
+}
+
+/* Copy selected parameters from selected paste buffer.
+ * Returns the way the changes were sent to the synth. */
+enum delta_path
 blofeld_copy_from_paste(int par_from, int par_to, int buf_no, int paste_buf)
 {
   int parnum;
+  unsigned char old_params[BLOFELD_PARAMS];
 
-  if (paste_buf >= PASTE_BUFFERS) return;
+  if (paste_buf >= PASTE_BUFFERS) return DELTA_NONE;
+
+  unsigned char *params = parameter_list(buf_no);
+
+  memcpy(old_params, params, BLOFELD_PARAMS);
 
   /* update parameter_list ui with pasted parameters */
+  journal_begin_group();
+  param_bus_begin_batch();
   for (parnum = par_from; parnum <= par_to; parnum++) {
-    /* Only send updates for parameters that differ */
-    if (paste_buffer[paste_buf][parnum] != parameter_list[parnum]) {
+    /* Only update parameters that differ */
+    if (paste_buffer[paste_buf][parnum] != params[parnum]) {
+      journal_record(buf_no, parnum, params[parnum],
+                     paste_buffer[paste_buf][parnum]);
       update_ui(parnum, buf_no, paste_buffer[paste_buf][parnum]);
-      send_parameter_update(parnum, buf_no, device_number, parameter_list[parnum]);
     }
   }
+  param_bus_end_batch();
+  journal_end_group();
+
+  return send_param_delta(buf_no, device_number, old_params, params);
 }
 
 /* Called when ui wants to know what the patch name parameter is called */
@@ -1192,82 +2104,174 @@ static void
 blofeld_midi_init(struct param_handler *param_handler)
 {
   midi_connect(SYNTH_PORT, param_handler->remote_midi_device);
+  if (mirror_midi_device)
+    midi_connect(MIRROR_PORT, mirror_midi_device);
 
   /* Tell MIDI handler we want to receive sysex. */
-  midi_register_sysex(SYNTH_PORT, SYSEX_ID_WALDORF, blofeld_midi_sysex,
-                      BLOFELD_PARAMS + 10);
+  midi_register_sysex(SYNTH_PORT, sysex_id, blofeld_midi_sysex,
+                      SYSEX_RECEIVE_MAX);
+
+  /* Global parameters are only fetched once; see blofeld_get_globals() */
+  blofeld_get_globals(device_number, 0);
 }
 
-/* Initialize Blofeld-specific functionality */
-void
-blofeld_init(struct param_handler *param_handler)
+/* Called periodically from main loop */
+/* Not referenced directly, but via struct, hence 'static' */
+static void
+blofeld_timer(void)
 {
-  int idx;
+  request_timer();
+  blofeld_bank_timer();
+  blofeld_wave_timer();
+  automation_timer();
+  morph_timer();
+  global_timer();
+  blofeld_library_timer();
+}
 
-  /* Scan all params, searching for bm_params, signified by having the
-   * bm_param member !NULL (it's pointing to the struct blofeld_bitmap_param
-   * for the parameter).
-   * For each bm_param, we then fill in the parent, and fill in the current
-   * parameter as the child for the parent, if it is the first child
-   * (the rest of the parameters with the same parent are assumed to lie)
-   * sequentially after the first one).
-   */
-  for (idx = 0;
-       idx < sizeof(blofeld_params) / sizeof(struct blofeld_param);
-       idx++) {
-    struct blofeld_param *param = &blofeld_params[idx];
-    struct blofeld_bitmap_param *bm_param = param->bm_param;
+/* Set up parameter definition list from loaded synth definition.
+ * Links between bitmap parameters and their parents are resolved
+ * already in the definition, and just need to be turned into pointers.
+ * The 'limits' member of combined parameters is always NULL, since such
+ * parameters have no limits on their own, relying on the child limits
+ * for the individual fields.
+ * Returns 0 if ok, -1 on error. */
+static int
+setup_params(const struct synth_def *def)
+{
+  struct limits *limits;
+  struct blofeld_bitmap_param *bm_params;
+  int idx;
 
-    if (!bm_param) continue; /* not a bitmapped param, go to next */
+  /* One extra entry for the end of list marker */
+  blofeld_params = calloc(def->params + 1, sizeof(*blofeld_params));
+  limits = calloc(def->params, sizeof(*limits));
+  bm_params = calloc(def->params, sizeof(*bm_params));
+  if (!blofeld_params || !limits || !bm_params) {
+    free(blofeld_params);
+    free(limits);
+    free(bm_params);
+    blofeld_params = NULL;
+    return -1;
+  }
 
-    /* bitmapped/string param */
+  for (idx = 0; idx < def->params; idx++) {
+    const struct synth_def_param *def_param = &def->param[idx];
+    struct blofeld_param *param = &blofeld_params[idx];
 
-    int parent_parno = blofeld_find_index(bm_param->parent_param_name);
-    if (parent_parno < 0) {
-      xprintf("Invalid bitmap param %s\n", bm_param->parent_param_name);
-      continue;
+    param->name = def_param->name;
+    if (def_param->flags & SYNTH_DEF_LIMITS) {
+      limits[idx].min = def_param->min;
+      limits[idx].max = def_param->max;
+      limits[idx].enumerated = !!(def_param->flags & SYNTH_DEF_ENUMERATED);
+      param->limits = &limits[idx];
+    }
+    if (def_param->child >= 0)
+      param->child = &blofeld_params[def_param->child];
+    param->global_offset = -1;
+    if (def_param->flags & SYNTH_DEF_GLOBAL) {
+      if (def_param->offset >= GLOBAL_DUMP_MAX) {
+        eprintf("Global parameter %s: offset %d out of range\n",
+                param->name, def_param->offset);
+        return -1;
+      }
+      param->global_offset = def_param->offset;
     }
-    struct blofeld_param *parent_param = &blofeld_params[parent_parno];
-
-    /* Put link to parent in bitmap parameter */
-    bm_param->parent_param = parent_param;
-
-    xprintf("Param %s has parent %s\n", param->name, parent_param->name);
-
-    /* Put link to first child in parent. The 'limits' member of
-     * combined parameters must always be initialized to NULL, fairly
-     * logical since such parameters have no limits on their own, relying
-     * on the child limits for the individual fields.
-     * The other children are assumed to lie after the first one in the
-     * parameter definition list, with the same bm_param->parent.
-     */
-    /* For string parameters, we have many parents, one for each character,
-     * so update them all. The bitmask field is == 0 for string parameters,
-     * with the string length being in the bitshift field. */
-    int params = (bm_param->bitmask) ? 1 : (bm_param->bitshift);
-    while (params--) {
-      if (!parent_param->child) {
-        parent_param->child = param;
-        xprintf("Param %s has first child %s\n",
-                parent_param->name, param->bm_param->parent_param->child->name);
+    /* For string parameters, the bitmask field is == 0, with the string
+     * length being in the bitshift field. */
+    if (def_param->flags & (SYNTH_DEF_BITMAP | SYNTH_DEF_STRING)) {
+      if (def_param->parent < 0) {
+        eprintf("Parameter %s has no parent\n", param->name);
+        return -1;
       }
-      parent_param++; /* next parent */
+      bm_params[idx].parent_param = &blofeld_params[def_param->parent];
+      bm_params[idx].bitmask = def_param->bitmask;
+      bm_params[idx].bitshift = def_param->bitshift;
+      param->bm_param = &bm_params[idx];
     }
   }
+  blofeld_params[idx].name = ""; /* end of list marker */
+  blofeld_params[idx].global_offset = -1;
+  blofeld_params_all = def->params + 1;
+
+  name_parnum = blofeld_find_index("Name Char 1");
+  category_parnum = blofeld_find_index("Category");
+
+  return 0;
+}
+
+/* Build full name of installed file, prefixing with UI_DIR as applicable,
+ * the same way as the UI files. */
+static void
+data_filename(char *buf, int size, const char *filename)
+{
+  if (UI_DIR[0] == '.' || filename[0] == '/' || filename[0] == '.')
+    snprintf(buf, size, "%s", filename);
+  else
+    snprintf(buf, size, "%s/%s", UI_DIR, filename);
+}
+
+/* Build name of directory for cached synth definitions and other data.
+ * Returns 0 if ok, -1 if we can't find the user's cache directory. */
+int
+blofeld_cache_dirname(char *buf, int size)
+{
+  const char *dir = getenv("XDG_CACHE_HOME");
+
+  if (dir && dir[0])
+    return snprintf(buf, size, "%s/%s", dir, DEF_CACHE_DIR) < size ? 0 : -1;
+  dir = getenv("HOME");
+  if (dir && dir[0])
+    return snprintf(buf, size, "%s/.cache/%s", dir, DEF_CACHE_DIR) < size ?
+           0 : -1;
+  return -1;
+}
+
+/* Initialize Blofeld-specific functionality */
+int
+blofeld_init(struct param_handler *param_handler)
+{
+  char filename[256], cache_dir[256];
+  const char *def_filename = param_handler->def_filename;
+
+  if (!def_filename)
+    def_filename = DEF_FILENAME;
+  data_filename(filename, sizeof(filename), def_filename);
+
+  if (synth_def_load(&synth_def, filename,
+                     blofeld_cache_dirname(cache_dir, sizeof(cache_dir)) ?
+                     NULL : cache_dir) < 0) {
+    eprintf("Can't load synth definition %s\n", filename);
+    return -1;
+  }
+  /* Buffers and dumps are sized for the Blofeld */
+  if (synth_def.sound_params != BLOFELD_PARAMS) {
+    eprintf("%s: Definition has %d sound parameters, expected %d\n",
+            filename, synth_def.sound_params, BLOFELD_PARAMS);
+    synth_def_free(&synth_def);
+    return -1;
+  }
+  if (setup_params(&synth_def) < 0) {
+    synth_def_free(&synth_def);
+    return -1;
+  }
+  sysex_id = synth_def.sysex_id;
+  equipment_id = synth_def.equipment_id;
 
   /* Fill in param_handler struct */
 
   /* # parameters we have, including derived (e.g. "bitmapped") types */
-  param_handler->params = sizeof(blofeld_params)/sizeof(blofeld_params[0]);
+  param_handler->params = blofeld_params_all;
 
   /* Names of things */
-  param_handler->remote_midi_device = "Blofeld"; /* Default name */
+  param_handler->remote_midi_device = synth_def.device; /* Default name */
   param_handler->remote_midi_device_number = 0; /* Default device ID */
-  param_handler->name = "Blofeld";
-  param_handler->ui_filename = "blofeld.glade";
+  param_handler->name = synth_def.name;
+  param_handler->ui_filename = synth_def.ui_filename;
 
   /* Function pointers */
   param_handler->param_register_notify_cb = blofeld_register_notify_cb;
+  param_handler->param_register_batch_cb = blofeld_register_batch_cb;
   param_handler->param_find_index = blofeld_find_index;
   param_handler->param_get_properties = blofeld_get_param_properties;
   param_handler->param_update_parameter = blofeld_update_param;
@@ -1277,6 +2281,9 @@ blofeld_init(struct param_handler *param_handler)
   param_handler->param_get_device_name_id = blofeld_get_device_name_id;
   param_handler->param_get_device_number_id = blofeld_get_device_number_id;
   param_handler->param_midi_init = blofeld_midi_init;
+  param_handler->param_timer = blofeld_timer;
+
+  return 0;
 }
 
 /************************* End of file blofeld_params.c *********************/
@@ -23,40 +23,277 @@
 #ifndef _BLOFELD_PARAMS_H_
 #define _BLOFELD_PARAMS_H_
 
+#include "request_tracker.h"
+#include "syx_file.h"
+
 /* Number of (sound) parameters in the Blofeld. */
 #define BLOFELD_PARAMS 383
 
+/* Number of buffers (i.e. multi mode parts) in the Blofeld. */
+#define BLOFELD_BUFFERS 16
+
+/* Number of sound banks (A..H), and sounds in each bank, in the Blofeld. */
+#define BLOFELD_BANKS 8
+#define BLOFELD_BANK_SIZE 128
+
 /* Parameter ranges. Used for specifying ranges to copy/paste functions. */
 #define PARNOS_ARPEGGIATOR 311, 358
 #define PARNOS_ALL         0, (BLOFELD_PARAMS - 1)
 
 #define BLOFELD_PATCH_NAME_LEN_MAX 16
 
+/* Total length of sound dump message */
+#define BLOFELD_SOUND_MSG_LEN (BLOFELD_PARAMS + 9)
+
+/* User wavetables: 39 slots of 64 waves, 128 samples per wave */
+#define BLOFELD_USER_WAVETABLES 39
+#define BLOFELD_USER_WAVETABLE_FIRST 80 /* wavetable number of first slot */
+#define BLOFELD_WAVES 64
+#define BLOFELD_WAVE_LEN 128
+#define BLOFELD_WAVE_MAX 0xfffff /* max sample value (21 bits signed) */
+#define BLOFELD_WAVETABLE_NAME_LEN 14
+/* Bytes in wavetable dump after BB and NN, excluding checksum and EOX */
+#define BLOFELD_WAVE_DATA_LEN (1 + 3 * BLOFELD_WAVE_LEN + \
+                               BLOFELD_WAVETABLE_NAME_LEN + 2)
+/* Total length of wavetable dump message */
+#define BLOFELD_WAVE_MSG_LEN (BLOFELD_WAVE_DATA_LEN + 9)
+
+/* Max number of devices mirroring the one being edited */
+#define BLOFELD_MIRRORS_MAX 8
+
+/* Device mirroring the one being edited */
+struct blofeld_mirror {
+  int port; /* SYNTH_PORT, or MIRROR_PORT for another MIDI device */
+  int dev_no;
+  int sent; /* # messages sent */
+  int failed; /* # messages which could not be sent */
+};
+
+/* Settings for a part in a multi */
+struct blofeld_part_config {
+  int bank; /* 0..7 = A..H */
+  int program; /* 0..127 */
+  int volume;
+  int pan; /* -64..63 */
+  int transpose; /* -64..63 */
+  int detune; /* -64..63 */
+  int channel; /* 0 = Global, 1 = Omni, 2..17 = channel 1..16 */
+  int key_low;
+  int key_high;
+  int vel_low;
+  int vel_high;
+};
+
+/* Multi, as received in multi dump */
+struct blofeld_multi {
+  char name[BLOFELD_PATCH_NAME_LEN_MAX + 1];
+  int volume;
+  int tempo;
+  struct blofeld_part_config part[BLOFELD_BUFFERS];
+  int valid;
+};
+
+/* Ways of sending a set of changed parameters to the synth */
+enum delta_path {
+  DELTA_NONE = 0, /* nothing changed, nothing sent */
+  DELTA_SNDP,     /* one parameter change message per parameter */
+  DELTA_SNDD      /* a single sound dump */
+};
+
 /* Initialize internal structures and fill in param_handler struct with
- * Blofeld-specific values and functions. */
-void blofeld_init(struct param_handler *param_handler);
+ * Blofeld-specific values and functions. The parameter definitions are
+ * loaded from param_handler->def_filename, or blofeld.def if NULL.
+ * Returns 0 if ok, -1 on error. */
+int blofeld_init(struct param_handler *param_handler);
 
 /* Fetch parameter dump from Blofeld */
 void blofeld_get_dump(int parlist, int dev_no);
 
+/* Request sound dump for given bank and buffer from Blofeld, calling cb
+ * (if not NULL) when it has arrived or the request has timed out.
+ * queued is the number of earlier requests still waiting to be answered,
+ * which extends the timeout accordingly.
+ * Returns 1 if sent, 0 if already in flight, -1 on error. */
+int blofeld_request_dump(int bank, int buf_no, int dev_no, int queued,
+                         request_done_cb cb, void *ref);
+
 /* Sender function type for dumps */
 typedef int (*send_func)(char *buf, int len, int userdata);
 
-/* Send parameter dump to Blofeld */
+/* Get global parameters from Blofeld, using our cached copy if we have one
+ * for the device, unless force is set. Returns 0 if the cache was used,
+ * otherwise as blofeld_request_dump(). */
+int blofeld_get_globals(int dev_no, int force);
+
+/* Request multi dump from Blofeld. When it arrives, the part
+ * configurations are filled in, and sound dumps are requested for all parts
+ * for which we don't have recent parameters, all at once. cb (if not NULL)
+ * is called when the multi dump has arrived or the request has timed out.
+ * Returns as blofeld_request_dump(). */
+int blofeld_get_multi(int dev_no, request_done_cb cb, void *ref);
+
+/* Return last multi received; valid member is 0 if none received yet. */
+const struct blofeld_multi *blofeld_get_multi_config(void);
+
+/* Queue wave wave_no (0..63) of user wavetable slot (0..38) for paced
+ * sending to Blofeld, with BLOFELD_WAVE_LEN samples, and name (padded
+ * with spaces). Returns 0 if ok, -1 if output queue is full. */
+int blofeld_queue_wave(int slot, int wave_no, int dev_no, const int *samples,
+                       const char *name);
+
+/* Add device to mirror set. All edits sent to the device being edited are
+ * also sent to the devices in the mirror set. If midi_device is NULL, the
+ * mirror is on the same MIDI port as the synth being edited, otherwise
+ * the mirror port is connected to midi_device. All mirrors that are
+ * not on the synth port share the mirror port, so they must all be on
+ * the same midi_device.
+ * Returns 0 if ok, -1 if the mirror set is full, -2 if midi_device
+ * differs from that of a mirror already added. */
+int blofeld_mirror_add(int dev_no, const char *midi_device);
+
+/* Get mirror set. Returns number of mirrors. */
+int blofeld_get_mirrors(const struct blofeld_mirror **mirrors);
+
+/* Get number of incoming parameter changes dropped because they were
+ * echoes of changes recently sent to the synth. */
+int blofeld_get_echoes_dropped(void);
+
+/* Play back recorded automation (see automation.h) to the synth being
+ * edited and its mirrors, at tempo percent of the recorded speed.
+ * Returns as automation_play(). */
+int blofeld_automation_play(int tempo);
+
+/* Begin and end a batch of parameter changes from the UI. Within a batch,
+ * changes to several bitmapped parameters sharing the same parameter byte
+ * are merged, so that each changed byte is sent to the synth only once,
+ * when the batch ends. Batches may be nested. */
+void blofeld_batch_begin(void);
+void blofeld_batch_end(void);
+
+/* Send parameter dump to Blofeld, or rather, what differs from what
+ * the synth already has. */
 void blofeld_send_dump(int parlist, int dev_no);
 
+/* Set device number of synth being edited. If it changes, we no longer
+ * know what the synth has in its parts. */
+void blofeld_set_device_number(int dev_no);
+
+/* Send what differs between editor and synth for a given buffer.
+ * Returns the way the changes were sent. */
+enum delta_path blofeld_sync(int buf_no, int dev_no);
+
+/* Send sound parameters to given bank and program in Blofeld */
+void blofeld_send_sound(int bank, int program, int dev_no,
+                        const unsigned char *params);
+
 /* General transfer function for parameter dumps */
 int blofeld_xfer_dump(int parlist, int dev_no, send_func sender, int userdata);
 
-/* Load parameter list from sysex buffer.
+/* Sound dump found in sysex file */
+struct blofeld_syx_entry {
+  size_t offset; /* of F0 in file */
+  size_t len; /* of whole message */
+  int bank; /* BB: 0..7 = A..H, or 0x7f for edit buffer */
+  int program; /* NN: program in bank, or buffer for edit buffer */
+  char name[BLOFELD_PATCH_NAME_LEN_MAX + 1];
+  int category; /* 0..12, as the Category parameter */
+  unsigned long long hash; /* of sound parameters, see blofeld_sound_hash */
+  unsigned long long sound_hash; /* same, excluding name */
+  const unsigned char *params; /* sound parameters, in the file's memory */
+};
+
+/* How a sound parameter is compared between sounds */
+enum blofeld_param_kind {
+  BLOFELD_KIND_AMOUNT, /* amount, with range of values */
+  BLOFELD_KIND_CHOICE, /* choice, or bitmap of several; equal or not */
+};
+
+/* Weight of parameter which matters the most when comparing sounds */
+#define BLOFELD_WEIGHT_MAX 8
+
+struct blofeld_param_metric {
+  enum blofeld_param_kind kind;
+  int range; /* max - min, for amounts */
+  int weight; /* 1..BLOFELD_WEIGHT_MAX */
+};
+
+/* Get how sound parameter is compared between sounds. Returns 0 if ok,
+ * -1 if it is not compared at all, e.g. reserved or part of the name. */
+int blofeld_param_metric(int parnum, struct blofeld_param_metric *metric);
+
+/* Build sound dump message (BLOFELD_SOUND_MSG_LEN bytes) in msg, for
+ * the given bank (or EDIT_BUF) and program (or part), from the sound
+ * parameters in params. */
+void blofeld_sound_dump(unsigned char *msg, int bank, int program,
+                        int dev_no, const unsigned char *params);
+
+/* Return parameters of sound in buffer (part) */
+const unsigned char *blofeld_get_params(int buf_no);
+
+/* Return 64 bit FNV-1a hash of sound parameters (BLOFELD_PARAMS bytes).
+ * If with_name is 0, the name is left out, so that sounds which only
+ * differ in name get the same hash. */
+unsigned long long blofeld_sound_hash(const unsigned char *params,
+                                      int with_name);
+
+/* Return nonzero if parameter is one of the name characters or the
+ * category of the sound. */
+int blofeld_is_name_param(int parnum);
+
+/* Fill in name and category of index entry from the sound parameters
+ * (BLOFELD_PARAMS bytes); only the name parameters are looked at. */
+void blofeld_syx_entry_name(struct blofeld_syx_entry *entry,
+                            const unsigned char *params);
+
+/* Fill in name, category, hashes and params of index entry from the
+ * sound parameters (BLOFELD_PARAMS bytes). */
+void blofeld_syx_entry_fill(struct blofeld_syx_entry *entry,
+                            const unsigned char *params);
+
+/* Index all Blofeld sound dumps in sysex file. *index is set to a newly
+ * allocated array of entries, which the caller must free(). Returns number
+ * of entries, or -1 if out of memory. */
+int blofeld_syx_index(const struct syx_file *file,
+                      struct blofeld_syx_entry **index);
+
+/* Load parameter list for buffer buf_no from sysex buffer.
  * Return -1 if something wrong, else 0. */
-int blofeld_file_sysex(void *buffer, int len);
+int blofeld_file_sysex(void *buffer, int len, int buf_no);
+
+/* Build name of directory for cached data. Returns 0 if ok, -1 if we
+ * can't find the user's cache directory. */
+int blofeld_cache_dirname(char *buf, int size);
+
+/* Select buffer to edit, showing cached parameters and refreshing if needed */
+void blofeld_select_buffer(int buf_no, int dev_no);
+
+/* Undo last parameter change, paste or file load. Return number of
+ * parameters restored, 0 if nothing to undo. */
+int blofeld_undo(int dev_no);
+
+/* Redo last undone change. Return number of parameters restored. */
+int blofeld_redo(int dev_no);
+
+/* Set up morph from current patch in buffer to paste buffer */
+void blofeld_morph_from_paste(int buf_no, int paste_buf);
+
+/* Set up morph from current patch in buffer to patch in sysex buffer.
+ * Return -1 if something wrong, else 0. */
+int blofeld_morph_from_file(void *buffer, int len, int buf_no);
+
+/* Set morph position, 0 (current patch) .. 127 (target patch) */
+void blofeld_morph_set(int position);
+
+/* Stop morphing */
+void blofeld_morph_stop(void);
 
 /* Copy selected parameters to selected paste buffer */
 void blofeld_copy_to_paste(int par_from, int par_to, int buf_no, int paste_buf);
 
-/* Copy selected parameters from selected paste buffer and update ui */
-void blofeld_copy_from_paste(int par_from, int par_to, int buf_no, int paste_buf);
+/* Copy selected parameters from selected paste buffer and update ui.
+ * Returns the way the changes were sent to the synth. */
+enum delta_path blofeld_copy_from_paste(int par_from, int par_to,
+                                        int buf_no, int paste_buf);
 
 #endif /* _BLOFELD_PARAMS_H_ */
 
@@ -0,0 +1,324 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_search.c - Searching the library for sounds by name.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+/* Sound names are searched using an index of the n-grams (sequences of
+ * one, two or three characters) in them. For each n-gram, the index has
+ * a list of all sounds whose names contain it, in library order. A name
+ * contains the search text only if it contains every n-gram of it, so
+ * only the sounds in the shortest of those lists need to be looked at;
+ * for texts of three characters or more, that is usually a handful even
+ * in a very large library. Each is then checked for the whole text.
+ *
+ * Each category has a list of its sounds in the same index, and is
+ * treated like another n-gram of the search text, so that searching
+ * within a category also only looks at the sounds in the shortest list.
+ *
+ * To keep the index small, case is ignored, and all characters other
+ * than letters, digits and spaces are considered the same in n-grams;
+ * checking the whole text sorts out the difference. The index is rebuilt
+ * when the library changes, unless it is being held while the results of
+ * searching it are being shown. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "param.h"
+#include "blofeld_params.h"
+#include "blofeld_library.h"
+#include "blofeld_search.h"
+#include "timestamp.h"
+
+#include "debug.h"
+
+#define NAME_LEN BLOFELD_PATCH_NAME_LEN_MAX
+
+/* Characters in n-grams: letters, digits, space and anything else */
+#define SYMBOLS (26 + 10 + 1 + 1)
+
+/* Longest n-gram in index */
+#define GRAM_MAX 3
+
+/* Number of n-grams of up to GRAM_MAX characters; n-grams of each length
+ * are numbered after the shorter ones. */
+#define GRAMS (SYMBOLS + SYMBOLS * SYMBOLS + SYMBOLS * SYMBOLS * SYMBOLS)
+
+/* Categories are 7 bit values, as all sound parameters */
+#define CATEGORIES 128
+
+/* Lists of sounds in index: n-grams, then categories */
+#define KEYS (GRAMS + CATEGORIES)
+
+/* Max number of distinct keys for a sound */
+#define ROW_KEYS (NAME_LEN * GRAM_MAX + 1)
+
+static struct {
+  int built;
+  int held; /* set while results are in use, see blofeld_search_hold() */
+  unsigned int generation; /* of library when built */
+  int size; /* # sound records in library when built */
+  int rows; /* # sounds in index */
+  int *sounds; /* sound record for each row */
+  char (*names)[NAME_LEN + 1]; /* lower case, without trailing spaces */
+  unsigned char *categories;
+  int *later; /* room for a row per sound, for matches not at the start */
+  int *last_row; /* per key: last row added, when building */
+  int *start; /* list of each key is at lists[start[key]..start[key+1]-1] */
+  int *lists; /* rows */
+} idx;
+
+/* Return symbol number for (lower case) character */
+static int
+symbol(int c)
+{
+  if (c >= 'a' && c <= 'z')
+    return c - 'a';
+  if (c >= '0' && c <= '9')
+    return 26 + c - '0';
+  if (c == ' ')
+    return 36;
+  return 37;
+}
+
+/* Return key of n-gram of len characters starting at s */
+static int
+gram(const char *s, int len)
+{
+  int key = 0, first = 0, size = 1, i;
+
+  for (i = 0; i < len; i++) {
+    key = key * SYMBOLS + symbol(s[i]);
+    first += size; /* skip past the shorter n-grams */
+    size *= SYMBOLS;
+  }
+  return first - 1 + key;
+}
+
+/* Copy name in lower case, without trailing spaces */
+static void
+fold_name(char *dest, const char *name)
+{
+  int len = 0, i;
+
+  for (i = 0; i < NAME_LEN && name[i]; i++) {
+    dest[i] = tolower((unsigned char) name[i]);
+    if (name[i] != ' ')
+      len = i + 1;
+  }
+  dest[len] = '\0';
+}
+
+/* Get the distinct keys for row. Returns # keys. */
+static int
+row_keys(int row, int *keys)
+{
+  const char *name = idx.names[row];
+  int count = 0, len = strlen(name), n, i;
+
+  for (n = 1; n <= GRAM_MAX; n++)
+    for (i = 0; i + n <= len; i++) {
+      int key = gram(&name[i], n);
+
+      if (idx.last_row[key] != row) {
+        idx.last_row[key] = row;
+        keys[count++] = key;
+      }
+    }
+  keys[count++] = GRAMS + idx.categories[row];
+  return count;
+}
+
+/* Build index from library, if it has changed since last time */
+static int
+build_index(void)
+{
+  int size = blofeld_library_size();
+  int keys[ROW_KEYS];
+  int row, i, count;
+  long long started = timestamp_ms();
+
+  if (idx.built &&
+      (idx.held || idx.generation == blofeld_library_generation()))
+    return 0;
+
+  blofeld_search_free();
+  idx.sounds = malloc((size ? size : 1) * sizeof(*idx.sounds));
+  idx.names = malloc((size ? size : 1) * sizeof(*idx.names));
+  idx.categories = malloc(size ? size : 1);
+  idx.later = malloc((size ? size : 1) * sizeof(*idx.later));
+  idx.last_row = malloc(GRAMS * sizeof(*idx.last_row));
+  idx.start = calloc(KEYS + 1, sizeof(*idx.start));
+  if (!idx.sounds || !idx.names || !idx.categories || !idx.later ||
+      !idx.last_row || !idx.start)
+    goto nomem;
+  for (i = 0; i < size; i++) {
+    const struct blofeld_library_patch *patch = blofeld_library_patch(i);
+
+    if (!patch) continue;
+    idx.sounds[idx.rows] = i;
+    fold_name(idx.names[idx.rows], patch->name);
+    idx.categories[idx.rows] = patch->category & (CATEGORIES - 1);
+    idx.rows++;
+  }
+
+  /* Count the sounds in each list, then put each list where it goes */
+  memset(idx.last_row, 0xff, GRAMS * sizeof(*idx.last_row)); /* -1 */
+  for (row = 0; row < idx.rows; row++) {
+    count = row_keys(row, keys);
+    for (i = 0; i < count; i++)
+      idx.start[keys[i] + 1]++;
+  }
+  for (i = 0; i < KEYS; i++)
+    idx.start[i + 1] += idx.start[i];
+  idx.lists = malloc((idx.start[KEYS] ? idx.start[KEYS] : 1) *
+                     sizeof(*idx.lists));
+  if (!idx.lists)
+    goto nomem;
+  memset(idx.last_row, 0xff, GRAMS * sizeof(*idx.last_row));
+  for (row = 0; row < idx.rows; row++) {
+    count = row_keys(row, keys);
+    for (i = 0; i < count; i++)
+      idx.lists[idx.start[keys[i]]++] = row;
+  }
+  /* Filling the lists moved each start to the start of the next list */
+  memmove(&idx.start[1], idx.start, KEYS * sizeof(*idx.start));
+  idx.start[0] = 0;
+  free(idx.last_row);
+  idx.last_row = NULL;
+
+  idx.built = 1;
+  idx.size = size;
+  idx.generation = blofeld_library_generation();
+  xprintf("Search: indexed %d names, %d entries, in %lld ms\n",
+          idx.rows, idx.start[KEYS], timestamp_ms() - started);
+  return 0;
+
+nomem:
+  eprintf("Out of memory for searching sound names\n");
+  blofeld_search_free();
+  return -1;
+}
+
+/* Bring index up to date, and keep it that way until released */
+int
+blofeld_search_hold(void)
+{
+  idx.held = 0;
+  if (build_index() < 0)
+    return -1;
+  idx.held = 1;
+  return idx.size;
+}
+
+/* Let index follow library again */
+void
+blofeld_search_release(void)
+{
+  idx.held = 0;
+}
+
+/* Free memory used for searching */
+void
+blofeld_search_free(void)
+{
+  free(idx.sounds);
+  free(idx.names);
+  free(idx.categories);
+  free(idx.later);
+  free(idx.last_row);
+  free(idx.start);
+  free(idx.lists);
+  memset(&idx, 0, sizeof(idx));
+}
+
+/* Return position of text (of length len) in name, or -1 if not found */
+static int
+find_in_name(const char *name, const char *text, int len)
+{
+  int i;
+
+  for (i = 0; name[i]; i++)
+    if (name[i] == text[0] && !strncmp(&name[i], text, len))
+      return i;
+  return -1;
+}
+
+/* Find sounds with names containing text */
+int
+blofeld_search_names(const char *text, int category, int *result, int max)
+{
+  char folded[NAME_LEN + 1];
+  const int *rows = NULL; /* NULL => all rows */
+  int count, len, found = 0, later = 0, n, i;
+
+  if (build_index() < 0)
+    return -1;
+
+  len = strlen(text);
+  if (len > NAME_LEN)
+    return 0;
+  for (i = 0; i <= len; i++)
+    folded[i] = tolower((unsigned char) text[i]);
+
+  /* Pick the shortest list of sounds that must contain all matches */
+  count = idx.rows;
+  if (category >= 0) {
+    int key = GRAMS + (category & (CATEGORIES - 1));
+
+    rows = &idx.lists[idx.start[key]];
+    count = idx.start[key + 1] - idx.start[key];
+  }
+  n = len < GRAM_MAX ? len : GRAM_MAX;
+  for (i = 0; n && i + n <= len; i++) {
+    int key = gram(&folded[i], n);
+
+    if (idx.start[key + 1] - idx.start[key] < count) {
+      rows = &idx.lists[idx.start[key]];
+      count = idx.start[key + 1] - idx.start[key];
+    }
+  }
+
+  /* Names starting with text go straight to the result, the rest are
+   * kept for later, after all of those. */
+  for (i = 0; i < count; i++) {
+    int row = rows ? rows[i] : i;
+    int pos = 0;
+
+    if (category >= 0 && idx.categories[row] != category)
+      continue;
+    if (len && (pos = find_in_name(idx.names[row], folded, len)) < 0)
+      continue;
+    if (pos)
+      idx.later[later++] = row;
+    else if (found < max)
+      result[found++] = idx.sounds[row];
+    else
+      found++;
+  }
+  for (i = 0; i < later && found < max; i++)
+    result[found++] = idx.sounds[idx.later[i]];
+
+  return found + later - i;
+}
+
+/*********************** End of file blofeld_search.c ***********************/
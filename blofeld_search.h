@@ -0,0 +1,51 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_search.h - Searching the library for sounds by name.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+#ifndef _BLOFELD_SEARCH_H_
+#define _BLOFELD_SEARCH_H_
+
+/* Find sounds in the library whose names contain text, ignoring case,
+ * and which are in the given category, or any category if category is
+ * -1. Sounds whose names start with text come first; otherwise sounds are
+ * in library order. An empty text matches all names. Up to max sound
+ * records are stored in result. Returns the total number of matching
+ * sounds, which may be more than max, or -1 if out of memory. */
+int blofeld_search_names(const char *text, int category, int *result,
+                         int max);
+
+/* Build the index if the library has changed, and then keep it as it is,
+ * so that searches only return sound records that existed at this point,
+ * until blofeld_search_release() is called. Returns the number of sound
+ * records in the library when the index was built, or -1 if out of
+ * memory. */
+int blofeld_search_hold(void);
+
+/* Let the index be rebuilt when the library changes again */
+void blofeld_search_release(void);
+
+/* Free memory used for searching, until the next search */
+void blofeld_search_free(void);
+
+#endif /* _BLOFELD_SEARCH_H_ */
+
+/*********************** End of file blofeld_search.h ***********************/
@@ -0,0 +1,319 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_similar.c - Finding library sounds similar to a given sound.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+/* The distance between two sounds is the sum of the weighted differences
+ * of their parameters. A choice parameter either differs by its full
+ * weight or not at all, while an amount parameter differs in proportion
+ * to how far apart the values are compared to its whole range. A full
+ * difference in a parameter of weight BLOFELD_WEIGHT_MAX is worth 64, so
+ * the distance between two sounds easily fits in 16 bits.
+ *
+ * To make it possible to compare a sound with a whole library in one go,
+ * the library's sound parameters are copied into columns: all the values
+ * of the first compared parameter, followed by all the values of the
+ * next, and so on. With SSE2, 16 sounds are then compared at a time, with
+ * the distances kept in registers until all parameters have been done.
+ * The columns are rebuilt when the library changes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "param.h"
+#include "blofeld_params.h"
+#include "blofeld_library.h"
+#include "blofeld_similar.h"
+#include "timestamp.h"
+
+#include "debug.h"
+
+/* Distance units per unit of parameter weight */
+#define SCALE (64 / BLOFELD_WEIGHT_MAX)
+
+/* Number of sounds compared at a time */
+#define BLOCK 16
+
+struct column {
+  int parnum;
+  unsigned char range; /* for amounts; 0 for choices */
+  unsigned char weight; /* in distance units */
+  unsigned short mul; /* for amounts: weight * 256 / range */
+};
+
+static struct {
+  int built;
+  unsigned int generation; /* of library when built */
+  struct column columns[BLOFELD_PARAMS];
+  int choices; /* choice columns come first, ... */
+  int amounts; /* ... followed by amount columns */
+  unsigned char *data; /* column after column, stride bytes each */
+  int *sounds; /* sound record for each row */
+  int rows, stride;
+} sim;
+
+/* Set up list of parameters to compare, choices first */
+static void
+setup_columns(void)
+{
+  static const enum blofeld_param_kind kinds[] = {
+    BLOFELD_KIND_CHOICE, BLOFELD_KIND_AMOUNT
+  };
+  struct blofeld_param_metric metric;
+  int columns = 0, parnum, i;
+
+  for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+    for (parnum = 0; parnum < BLOFELD_PARAMS; parnum++) {
+      struct column *column = &sim.columns[columns];
+
+      if (blofeld_param_metric(parnum, &metric) < 0 ||
+          metric.kind != kinds[i])
+        continue;
+      column->parnum = parnum;
+      column->weight = metric.weight * SCALE;
+      column->range = metric.range;
+      column->mul = metric.range ? column->weight * 256 / metric.range : 0;
+      columns++;
+    }
+    if (kinds[i] == BLOFELD_KIND_CHOICE)
+      sim.choices = columns;
+  }
+  sim.amounts = columns - sim.choices;
+}
+
+/* Copy library into columns, if it has changed since last time. */
+static int
+build_columns(void)
+{
+  int size = blofeld_library_size();
+  int columns, row, i;
+  long long started = timestamp_ms();
+
+  if (sim.built && sim.generation == blofeld_library_generation())
+    return 0;
+
+  blofeld_similar_free();
+  setup_columns();
+  columns = sim.choices + sim.amounts;
+  sim.sounds = malloc((size ? size : 1) * sizeof(*sim.sounds));
+  if (!sim.sounds)
+    goto nomem;
+  for (i = 0; i < size; i++)
+    if (blofeld_library_params(i))
+      sim.sounds[sim.rows++] = i;
+  sim.stride = (sim.rows + BLOCK - 1) / BLOCK * BLOCK;
+  /* Aligned for SSE2, and padded with zeroes to whole blocks */
+  if (posix_memalign((void **) &sim.data, BLOCK,
+                     (size_t) (columns ? columns : 1) *
+                     (sim.stride ? sim.stride : BLOCK))) {
+    sim.data = NULL;
+    goto nomem;
+  }
+  memset(sim.data, 0, (size_t) columns * sim.stride);
+  /* A block of rows at a time, so that each column gets a whole run of
+   * bytes at once, rather than one byte per sound all over the place. */
+  for (row = 0; row < sim.rows; row += BLOCK) {
+    const unsigned char *params[BLOCK];
+    unsigned char *p = &sim.data[row];
+    int rows = sim.rows - row < BLOCK ? sim.rows - row : BLOCK, j;
+
+    for (j = 0; j < rows; j++)
+      params[j] = blofeld_library_params(sim.sounds[row + j]);
+    for (i = 0; i < columns; i++, p += sim.stride) {
+      int parnum = sim.columns[i].parnum;
+
+      for (j = 0; j < rows; j++)
+        p[j] = params[j][parnum];
+    }
+  }
+  sim.built = 1;
+  sim.generation = blofeld_library_generation();
+  xprintf("Similar: %d sounds, %d parameters, copied in %lld ms\n",
+          sim.rows, columns, timestamp_ms() - started);
+  return 0;
+
+nomem:
+  eprintf("Out of memory for finding similar sounds\n");
+  blofeld_similar_free();
+  return -1;
+}
+
+/* Free memory used for searching */
+void
+blofeld_similar_free(void)
+{
+  free(sim.data);
+  free(sim.sounds);
+  sim.data = NULL;
+  sim.sounds = NULL;
+  sim.rows = sim.stride = 0;
+  sim.built = 0;
+}
+
+#ifdef __SSE2__
+
+/* Compute distances for block of rows starting at row */
+static void
+block_distances(const unsigned char *params, int row, unsigned short *dist)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = zero, hi = zero; /* distances of first and last 8 rows */
+  const struct column *column = sim.columns;
+  const unsigned char *p = &sim.data[row];
+  int i;
+
+  for (i = 0; i < sim.choices; i++, column++, p += sim.stride) {
+    __m128i v = _mm_load_si128((const __m128i *) p);
+    __m128i cur = _mm_set1_epi8(params[column->parnum]);
+    __m128i d = _mm_andnot_si128(_mm_cmpeq_epi8(v, cur),
+                                 _mm_set1_epi8(column->weight));
+    lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(d, zero));
+    hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(d, zero));
+  }
+  for (i = 0; i < sim.amounts; i++, column++, p += sim.stride) {
+    __m128i v = _mm_load_si128((const __m128i *) p);
+    __m128i cur = _mm_set1_epi8(params[column->parnum]);
+    __m128i mul = _mm_set1_epi16(column->mul);
+    /* |v - cur|, but no more than the range, for out of range values */
+    __m128i d = _mm_min_epu8(_mm_sub_epi8(_mm_max_epu8(v, cur),
+                                          _mm_min_epu8(v, cur)),
+                             _mm_set1_epi8(column->range));
+    lo = _mm_add_epi16(lo, _mm_srli_epi16(
+                             _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), mul),
+                             8));
+    hi = _mm_add_epi16(hi, _mm_srli_epi16(
+                             _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), mul),
+                             8));
+  }
+  _mm_storeu_si128((__m128i *) dist, lo);
+  _mm_storeu_si128((__m128i *) &dist[8], hi);
+}
+
+#else
+
+/* Compute distances for block of rows starting at row */
+static void
+block_distances(const unsigned char *params, int row, unsigned short *dist)
+{
+  const struct column *column = sim.columns;
+  const unsigned char *p = &sim.data[row];
+  int i, j;
+
+  memset(dist, 0, BLOCK * sizeof(*dist));
+  for (i = 0; i < sim.choices; i++, column++, p += sim.stride) {
+    int cur = params[column->parnum];
+
+    for (j = 0; j < BLOCK; j++)
+      if (p[j] != cur)
+        dist[j] += column->weight;
+  }
+  for (i = 0; i < sim.amounts; i++, column++, p += sim.stride) {
+    int cur = params[column->parnum];
+
+    for (j = 0; j < BLOCK; j++) {
+      int d = abs(p[j] - cur);
+      if (d > column->range)
+        d = column->range;
+      dist[j] += (d * column->mul) >> 8;
+    }
+  }
+}
+
+#endif
+
+/* Compare sounds for heap; the most distant one ends up on top */
+static int
+further(const struct blofeld_similar *a, const struct blofeld_similar *b)
+{
+  return a->distance > b->distance ||
+         (a->distance == b->distance && a->index > b->index);
+}
+
+/* Move element down heap of count elements, to restore heap order */
+static void
+sift_down(struct blofeld_similar *heap, int count, int i)
+{
+  for (;;) {
+    int top = i, child = 2 * i + 1;
+    struct blofeld_similar tmp;
+
+    if (child < count && further(&heap[child], &heap[top]))
+      top = child;
+    if (child + 1 < count && further(&heap[child + 1], &heap[top]))
+      top = child + 1;
+    if (top == i)
+      return;
+    tmp = heap[i];
+    heap[i] = heap[top];
+    heap[top] = tmp;
+    i = top;
+  }
+}
+
+/* Find sounds closest to params */
+int
+blofeld_similar_find(const unsigned char *params,
+                     struct blofeld_similar *result, int count)
+{
+  unsigned short dist[BLOCK];
+  int found = 0, row, i;
+  long long started;
+
+  if (count <= 0 || build_columns() < 0)
+    return count <= 0 ? 0 : -1;
+
+  started = timestamp_ms();
+  /* result[] is kept as a max-heap of the closest sounds so far */
+  for (row = 0; row < sim.rows; row += BLOCK) {
+    block_distances(params, row, dist);
+    for (i = 0; i < BLOCK && row + i < sim.rows; i++) {
+      struct blofeld_similar sound = { sim.sounds[row + i], dist[i] };
+
+      if (found < count) {
+        int j = found++;
+        /* sift up */
+        while (j > 0 && further(&sound, &result[(j - 1) / 2])) {
+          result[j] = result[(j - 1) / 2];
+          j = (j - 1) / 2;
+        }
+        result[j] = sound;
+      } else if (further(&result[0], &sound)) {
+        result[0] = sound;
+        sift_down(result, found, 0);
+      }
+    }
+  }
+  /* Sort, closest first, by repeatedly moving the top to the end */
+  for (i = found - 1; i > 0; i--) {
+    struct blofeld_similar tmp = result[0];
+    result[0] = result[i];
+    result[i] = tmp;
+    sift_down(result, i, 0);
+  }
+  xprintf("Similar: compared %d sounds in %lld ms\n", sim.rows,
+          timestamp_ms() - started);
+  return found;
+}
+
+/*********************** End of file blofeld_similar.c **********************/
@@ -0,0 +1,45 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_similar.h - Finding library sounds similar to a given sound.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+#ifndef _BLOFELD_SIMILAR_H_
+#define _BLOFELD_SIMILAR_H_
+
+/* Sound found by blofeld_similar_find */
+struct blofeld_similar {
+  int index; /* sound record in library */
+  int distance; /* 0 => identical sound, apart from name and category */
+};
+
+/* Find the count sounds in the library closest to the sound with the
+ * given parameters (BLOFELD_PARAMS bytes), closest first. Returns number
+ * of sounds found, which is less than count if the library is smaller,
+ * or -1 if out of memory. */
+int blofeld_similar_find(const unsigned char *params,
+                         struct blofeld_similar *result, int count);
+
+/* Free memory used for searching, until the next search */
+void blofeld_similar_free(void);
+
+#endif /* _BLOFELD_SIMILAR_H_ */
+
+/*********************** End of file blofeld_similar.h **********************/
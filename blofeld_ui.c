@@ -21,6 +21,7 @@
  ****************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,6 +34,13 @@
 #include "midi.h"
 #include "param.h"
 #include "blofeld_params.h"
+#include "blofeld_bank.h"
+#include "blofeld_wave.h"
+#include "blofeld_library.h"
+#include "blofeld_similar.h"
+#include "blofeld_search.h"
+#include "blofeld_archive.h"
+#include "automation.h"
 #include "debug.h"
 
 /* Send a buffer to a file fd, handling interrupted system calls etc */
@@ -50,6 +58,26 @@ file_send(char *buf, int len, int fd)
   return -1; /* We won't get here */
 }
 
+/* Set toggle button with given id to given state */
+static void
+set_toggle(const char *id, int active)
+{
+  GtkWidget *widget = find_widget_with_id(main_window, id);
+
+  if (widget && GTK_IS_TOGGLE_BUTTON(widget))
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(widget), active);
+}
+
+/* Get state of toggle button with given id */
+static int
+get_toggle(const char *id)
+{
+  GtkWidget *widget = find_widget_with_id(main_window, id);
+
+  return widget && GTK_IS_TOGGLE_BUTTON(widget) &&
+         gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget));
+}
+
 /* Handlers for various Blofeld-specific parts of the UI */
 
 /* When Patch Save pressed: save patch to file */
@@ -91,29 +119,78 @@ out:
 }
 
 
-/* Read buffer from file fd */
-static int safe_read(int fd, char *buf, int len)
+/* Let user pick one of the sound dumps in a sysex file. Returns index
+ * of dump picked, or -1 if canceled. */
+static int
+pick_dump(const struct blofeld_syx_entry *index, int count, GtkWidget *parent)
 {
-  int res;
-  while (1) {
-    res = read(fd, buf, len);
-    if (res < 0 && errno != EINTR) return res;
-    if (res == 0 || res == len) return 0;
-    buf += res;
-    len -= res;
+  const gchar **items = g_new(const gchar *, count);
+  int i, choice;
+
+  for (i = 0; i < count; i++) {
+    const struct blofeld_syx_entry *entry = &index[i];
+    if (entry->bank < BLOFELD_BANKS)
+      items[i] = g_strdup_printf("%c%03d  %s", 'A' + entry->bank,
+                                 entry->program + 1, entry->name);
+    else
+      items[i] = g_strdup_printf("Part %2d  %s", entry->program + 1,
+                                 entry->name);
   }
-  return -1; /* We won't get here */
+  choice = choose_from_list("Select Sound", "Sound", items, count, parent);
+  for (i = 0; i < count; i++)
+    g_free((gchar *) items[i]);
+  g_free(items);
+
+  return choice;
 }
 
-/* When Patch Load pressed: load patch from file */
-gboolean
-on_Patch_Load_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+/* Let user pick sound from archive, then hand it over to loader. */
+static void
+load_patch_archive(const char *filename,
+                   int (*loader)(void *buffer, int len, int buf_no),
+                   GtkWidget *dialog)
+{
+  struct blofeld_archive archive;
+  struct blofeld_syx_entry *index = NULL;
+  unsigned char msg[BLOFELD_SOUND_MSG_LEN];
+  int count, choice = 0;
+
+  if (blofeld_archive_open(&archive, filename) < 0) {
+    report("Error opening %s: %s", filename, GTK_MESSAGE_ERROR, dialog);
+    return;
+  }
+  count = blofeld_archive_index(&archive, &index);
+  if (count < 0)
+    report("Error reading data from %s: %s", filename, GTK_MESSAGE_ERROR, dialog);
+  else if (count == 0)
+    report("No sound dumps in %s", filename, GTK_MESSAGE_ERROR, dialog);
+  else {
+    if (count > 1)
+      choice = pick_dump(index, count, dialog);
+    /* Only the chosen sound is unpacked */
+    if (choice >= 0 &&
+        (blofeld_archive_get(&archive, index[choice].offset, msg, 0x7f) < 0 ||
+         loader(msg, sizeof(msg), current_buffer_no) < 0))
+      report("Error in data in %s", filename, GTK_MESSAGE_ERROR, dialog);
+  }
+  free(index);
+  blofeld_archive_close(&archive);
+}
+
+/* Let user select patch file, then hand it over to loader. The file may
+ * contain any number of sound dumps, for instance whole banks, in which
+ * case the user gets to pick one of them. It may also be an archive of
+ * sounds. */
+static void
+load_patch_file(const char *title, int (*loader)(void *buffer, int len,
+                                                 int buf_no))
 {
   char *filename = NULL;
-  int res;
-#define READ_LEN (BLOFELD_PARAMS + 10)
+  struct syx_file file;
+  struct blofeld_syx_entry *index = NULL;
+  int res, count, choice = 0;
 
-  GtkWidget *dialog = file_chooser_dialog("Load Patch", main_window,
+  GtkWidget *dialog = file_chooser_dialog(title, main_window,
                                           GTK_FILE_CHOOSER_ACTION_OPEN, "_Load");
 
   if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT)
@@ -121,29 +198,283 @@ on_Patch_Load_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 
   if (!filename) goto out;
 
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0) {
+  if (syx_file_open(&file, filename) < 0) {
     report("Error opening %s: %s", filename, GTK_MESSAGE_ERROR, dialog);
     goto out;
   }
-  char file_buf[READ_LEN];
-  res = safe_read(fd, file_buf, READ_LEN);
-  close(fd);
-  if (res < 0) {
-    report("Error reading data from %s: %s", filename, GTK_MESSAGE_ERROR, dialog);
+  if (blofeld_archive_is_archive(&file)) {
+    syx_file_close(&file);
+    load_patch_archive(filename, loader, dialog);
     goto out;
   }
-  close(fd);
+  count = blofeld_syx_index(&file, &index);
+  if (count < 0) {
+    report("Error reading data from %s: %s", filename, GTK_MESSAGE_ERROR, dialog);
+    goto close;
+  }
+  if (count == 0) {
+    report("No sound dumps in %s", filename, GTK_MESSAGE_ERROR, dialog);
+    goto close;
+  }
+  if (count > 1)
+    choice = pick_dump(index, count, dialog);
+  if (choice < 0) goto close; /* canceled */
 
-  res = blofeld_file_sysex(file_buf, READ_LEN);
-  if (res < 0) {
+  /* The loaders only read the dump, so it can stay in the mapped file */
+  res = loader((void *) &file.data[index[choice].offset], index[choice].len,
+               current_buffer_no);
+  if (res < 0)
     report("Error in data in %s", filename, GTK_MESSAGE_ERROR, dialog);
-    goto out;
-  }
 
+close:
+  free(index);
+  syx_file_close(&file);
 out:
   gtk_widget_destroy (dialog);
   g_free (filename);
+}
+
+/* When Patch Load pressed: load patch from file */
+gboolean
+on_Patch_Load_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  load_patch_file("Load Patch", blofeld_file_sysex);
+
+  return FALSE;
+}
+
+/* Max number of sound categories */
+#define CATEGORIES 16
+
+/* Get category names from the Category combo box. The names must be
+ * freed with g_free(). */
+static void
+get_categories(gchar **categories)
+{
+  GtkWidget *combo = find_widget_with_id(main_window, "Category1");
+  int i;
+
+  for (i = 0; i < CATEGORIES; i++)
+    categories[i] = NULL;
+  if (combo) {
+    GtkTreeModel *model = gtk_combo_box_get_model(GTK_COMBO_BOX(combo));
+    GtkTreeIter iter;
+
+    for (i = 0; i < CATEGORIES &&
+                gtk_tree_model_iter_nth_child(model, &iter, NULL, i); i++)
+      gtk_tree_model_get(model, &iter, 0, &categories[i], -1);
+  }
+}
+
+/* Return name of category, or "" if unknown */
+static const gchar *
+category_name(gchar **categories, int category)
+{
+  return category < CATEGORIES && categories[category] ?
+         categories[category] : "";
+}
+
+/* Tell user there is no library, if so. Returns TRUE if library empty. */
+static gboolean
+library_empty(void)
+{
+  struct blofeld_library_status status;
+
+  blofeld_library_get_status(&status);
+  if (!status.patches)
+    report("No sounds in library; use %s to select a library directory",
+           "--library", GTK_MESSAGE_INFO, main_window);
+  return !status.patches;
+}
+
+/* Library status callback: show what the library is up to in the
+ * Library Status label */
+static void
+library_status(const struct blofeld_library_status *status, void *ref)
+{
+  GtkWidget *label = find_widget_with_id(main_window, "Library Status");
+  char text[80];
+
+  if (!label || !GTK_IS_LABEL(label)) return;
+
+  if (status->pending)
+    snprintf(text, sizeof(text), "Indexing, %d files", status->pending);
+  else if (status->scanning)
+    snprintf(text, sizeof(text), "Scanning");
+  else if (status->files)
+    snprintf(text, sizeof(text), "%d sounds", status->patches);
+  else
+    text[0] = '\0';
+  gtk_label_set_text(GTK_LABEL(label), text);
+}
+
+/* When Library Status label realized, keep it up to date from then on */
+void
+on_Library_Status_realize(GtkWidget *widget, gpointer user_data)
+{
+  struct blofeld_library_status status;
+
+  blofeld_library_register_status_cb(library_status, NULL);
+  blofeld_library_get_status(&status);
+  library_status(&status, NULL);
+}
+
+/* Load sound from library into current buffer */
+static void
+load_from_library(int index)
+{
+  const struct blofeld_library_patch *patch = blofeld_library_patch(index);
+
+  /* The file may have been removed while the browser was open */
+  if (!patch)
+    report("Sound no longer in library", NULL, GTK_MESSAGE_ERROR,
+           main_window);
+  else if (blofeld_library_load(index, blofeld_file_sysex,
+                                current_buffer_no) < 0)
+    report("Can't load sound from %s", blofeld_library_file(patch),
+           GTK_MESSAGE_ERROR, main_window);
+}
+
+/* State of library browser, for search_library */
+struct library_search {
+  gchar *categories[CATEGORIES];
+  struct blofeld_library_dups dups;
+  int grouped; /* set if dups valid */
+  int size; /* # sound records when browser opened */
+  int *matches; /* room for size sounds */
+};
+
+/* Find sounds in library whose names contain text, in category filter */
+static int
+search_library(const gchar *text, int filter, gchar **items, int *ids,
+               int max, void *ref)
+{
+  struct library_search *ls = ref;
+  int count, found = 0, i;
+
+  /* The library may change while the browser is open, but the search
+   * index is held, so only records up to ls->size are returned. */
+  count = blofeld_search_names(text, filter, ls->matches, ls->size);
+  if (count > ls->size)
+    count = ls->size;
+  for (i = 0; i < count; i++) {
+    int index = ls->matches[i];
+    const struct blofeld_library_patch *patch = blofeld_library_patch(index);
+    const gchar *category;
+
+    if (!patch || index >= ls->size) continue; /* removed meanwhile */
+    if (ls->grouped && ls->dups.first[index] != index) continue;
+    category = category_name(ls->categories, patch->category);
+    if (found >= max) {
+      found++;
+      continue;
+    }
+    ids[found] = index;
+    if (ls->grouped && ls->dups.copies[index] > 1)
+      items[found++] = g_strdup_printf("%-16s  %-4s  %s (%d copies)",
+                                       patch->name, category,
+                                       blofeld_library_file(patch),
+                                       ls->dups.copies[index]);
+    else
+      items[found++] = g_strdup_printf("%-16s  %-4s  %s", patch->name,
+                                       category, blofeld_library_file(patch));
+  }
+  return found;
+}
+
+/* When Patch Library pressed: let user search for a sound in the library
+ * by name and category, and load it. The category names are taken from
+ * the Category combo box. */
+gboolean
+on_Patch_Library_pressed(GtkWidget *widget, GdkEvent *event,
+                         gpointer user_data)
+{
+  struct blofeld_library_status status;
+  struct library_search ls;
+  int categories, choice, i;
+  gchar *title;
+
+  if (library_empty())
+    return FALSE;
+  /* Sounds found while the browser is open aren't shown until next time,
+   * and the search index isn't rebuilt for them meanwhile. */
+  ls.size = blofeld_search_hold();
+  if (ls.size < 0)
+    return FALSE;
+  blofeld_library_get_status(&status);
+  get_categories(ls.categories);
+  for (categories = 0;
+       categories < CATEGORIES && ls.categories[categories]; categories++)
+    ;
+
+  /* Identical sounds are only shown once, with the number of copies */
+  ls.grouped = !blofeld_library_find_dups(&ls.dups,
+                                          get_toggle("Library Any Name"));
+  ls.matches = g_new(int, ls.size + 1);
+
+  title = g_strdup_printf("Library: %d sounds, %d duplicates%s",
+                          status.patches -
+                          (ls.grouped ? ls.dups.duplicates : 0),
+                          ls.grouped ? ls.dups.duplicates : 0,
+                          status.scanning ? " (scanning)" : "");
+  choice = choose_with_search(title, "Sound",
+                              (const gchar * const *) ls.categories,
+                              categories, search_library, &ls, main_window);
+  if (choice >= 0)
+    load_from_library(choice);
+
+  blofeld_search_release();
+  g_free(title);
+  g_free(ls.matches);
+  for (i = 0; i < CATEGORIES; i++)
+    g_free(ls.categories[i]);
+  if (ls.grouped)
+    blofeld_library_free_dups(&ls.dups);
+
+  return FALSE;
+}
+
+/* Number of sounds shown when looking for similar sounds */
+#define SIMILAR_SOUNDS 50
+
+/* When Patch Similar pressed: let user pick one of the sounds in the
+ * library closest to the current sound, and load it. */
+gboolean
+on_Patch_Similar_pressed(GtkWidget *widget, GdkEvent *event,
+                         gpointer user_data)
+{
+  struct blofeld_similar similar[SIMILAR_SOUNDS];
+  gchar *categories[CATEGORIES];
+  const gchar *items[SIMILAR_SOUNDS];
+  int i, count, choice;
+
+  if (library_empty())
+    return FALSE;
+  count = blofeld_similar_find(blofeld_get_params(current_buffer_no),
+                               similar, SIMILAR_SOUNDS);
+  if (count <= 0)
+    return FALSE;
+
+  get_categories(categories);
+  for (i = 0; i < count; i++) {
+    const struct blofeld_library_patch *patch =
+      blofeld_library_patch(similar[i].index);
+
+    items[i] = g_strdup_printf("%5d  %-16s  %-4s  %s", similar[i].distance,
+                               patch->name,
+                               category_name(categories, patch->category),
+                               blofeld_library_file(patch));
+  }
+
+  choice = choose_from_list("Similar sounds in library",
+                            "Distance  Sound", items, count, main_window);
+  if (choice >= 0)
+    load_from_library(similar[choice].index);
+
+  for (i = 0; i < count; i++)
+    g_free((gchar *) items[i]);
+  for (i = 0; i < CATEGORIES; i++)
+    g_free(categories[i]);
 
   return FALSE;
 }
@@ -160,7 +491,20 @@ on_GetDump_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
   return FALSE; /* let ui continue to press event (i.e. show button pressed) */
 }
 
-/* When Send Dump pressed, send patch dump to Blofeld. */
+/* When Get in the Global frame pressed, request global parameters from
+ * Blofeld, rather than using the ones we already have, as they may have
+ * been changed from the synth's front panel. */
+gboolean
+on_Global_Get_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  midi_connect(SYNTH_PORT, NULL);
+  blofeld_get_globals(device_number, 1);
+
+  return FALSE;
+}
+
+/* When Send Dump pressed, send patch to Blofeld. Only what has changed
+ * since the synth last had it is actually sent. */
 gboolean
 on_SendDump_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 {
@@ -172,7 +516,8 @@ on_SendDump_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 }
 
 /* When user presses any one of the 16 Buffer radio buttons:
- * set buffer number and request patch dump from Blofeld. */
+ * set buffer number and show the part, requesting a patch dump from
+ * Blofeld if we don't have a recent copy of it. */
 gboolean
 on_Buffer_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 {
@@ -183,11 +528,221 @@ on_Buffer_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
       buffer_no > 0 && buffer_no <= 16) {
     current_buffer_no = buffer_no - 1;
     set_title();
-    xprintf("Selected buffer #%d = buf %d, requesting dump\n",
-            buffer_no, current_buffer_no);
-    blofeld_get_dump(current_buffer_no, device_number);
+    xprintf("Selected buffer #%d = buf %d\n", buffer_no, current_buffer_no);
+    blofeld_select_buffer(current_buffer_no, device_number);
+  }
+
+  return FALSE;
+}
+
+/* Multi dump done callback: show each part's configuration in the
+ * tooltip of its Buffer button. */
+static void
+multi_done(int device, int bank, int buffer, enum request_status status,
+           void *ref)
+{
+  const struct blofeld_multi *multi = blofeld_get_multi_config();
+  int buf_no;
+
+  if (status != REQUEST_DONE || !multi->valid) return;
+
+  for (buf_no = 0; buf_no < BLOFELD_BUFFERS; buf_no++) {
+    const struct blofeld_part_config *part = &multi->part[buf_no];
+    char id[20], text[80], channel[10];
+    GtkWidget *button;
+
+    snprintf(id, sizeof(id), "Buffer %d", buf_no + 1);
+    button = find_widget_with_id(main_window, id);
+    if (!button) continue;
+
+    if (part->channel == 0)
+      strcpy(channel, "Global");
+    else if (part->channel == 1)
+      strcpy(channel, "Omni");
+    else
+      snprintf(channel, sizeof(channel), "%d", part->channel - 1);
+    snprintf(text, sizeof(text), "%c%03d ch %s vol %d pan %+d",
+             'A' + part->bank, part->program + 1, channel,
+             part->volume, part->pan);
+    gtk_widget_set_tooltip_text(button, text);
+  }
+}
+
+/* When Get Multi pressed, fetch multi from Blofeld, along with the sounds
+ * of all parts. */
+gboolean
+on_GetMulti_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  midi_connect(SYNTH_PORT, NULL);
+  blofeld_get_multi(device_number, multi_done, NULL);
+
+  return FALSE;
+}
+
+/* Bank fetch progress callback: show progress in Bank Status label */
+static void
+bank_progress(const struct bank_progress *progress, void *ref)
+{
+  GtkWidget *status = find_widget_with_id(main_window, "Bank Status");
+  char text[80];
+
+  if (!status || !GTK_IS_LABEL(status)) return;
+
+  snprintf(text, sizeof(text), "%s %d/%d, %d failed, %.1f sounds/s",
+           progress->finished ? "Fetched" : "Fetching",
+           progress->done, progress->total, progress->failed, progress->rate);
+  gtk_label_set_text(GTK_LABEL(status), text);
+}
+
+/* Bank upload progress callback: show progress in Bank Status label */
+static void
+bank_upload_progress(const struct bank_progress *progress, void *ref)
+{
+  GtkWidget *status = find_widget_with_id(main_window, "Bank Status");
+  char text[80];
+
+  if (!status || !GTK_IS_LABEL(status)) return;
+
+  snprintf(text, sizeof(text),
+           "%s %d/%d, %d bad verifies, %.1f sounds/s, gap %d ms",
+           progress->finished ? "Uploaded" : "Uploading",
+           progress->done, progress->total, progress->failed, progress->rate,
+           progress->gap);
+  gtk_label_set_text(GTK_LABEL(status), text);
+}
+
+/* When Bank Fetch pressed, fetch all sound banks from Blofeld. */
+gboolean
+on_Bank_Fetch_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  GtkWidget *window_widget = find_widget_with_id(main_window, "Bank Window");
+  int window = BLOFELD_BANK_WINDOW_DEFAULT;
+
+  if (window_widget && GTK_IS_SPIN_BUTTON(window_widget))
+    window = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(window_widget));
+
+  xprintf("Pressed bank fetch, window %d\n", window);
+  midi_connect(SYNTH_PORT, NULL);
+  blofeld_bank_fetch(0, BLOFELD_BANKS - 1, device_number, window,
+                     bank_progress, NULL);
+
+  return FALSE;
+}
+
+/* When Bank Upload pressed, send all sounds we have fetched back to the
+ * Blofeld's sound banks. */
+gboolean
+on_Bank_Upload_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  if (!query("Overwrite sounds in synth's banks?", NULL, main_window))
+    return FALSE;
+
+  xprintf("Pressed bank upload\n");
+  midi_connect(SYNTH_PORT, NULL);
+  blofeld_bank_upload(0, BLOFELD_BANKS - 1, device_number,
+                      bank_upload_progress, NULL);
+
+  return FALSE;
+}
+
+/* When Bank Save pressed, save all sounds we have fetched to file. */
+gboolean
+on_Bank_Save_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  GtkWidget *status = find_widget_with_id(main_window, "Bank Status");
+  char *filename = NULL;
+  char text[80];
+  int res;
+
+  GtkWidget *dialog = file_chooser_dialog("Save Banks", main_window,
+                                          GTK_FILE_CHOOSER_ACTION_SAVE, "_Save");
+  gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "banks.syx");
+
+  if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT)
+    filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
+
+  if (!filename) goto out;
+
+  /* The file is replaced rather than opened, so ask first */
+  if (access(filename, F_OK) == 0 &&
+      !query("File %s exists, overwrite?", filename, dialog)) {
+    report("Write to %s canceled!", filename, GTK_MESSAGE_ERROR, dialog);
+    goto out;
   }
 
+  xprintf("Pressed bank save\n");
+  res = blofeld_bank_save(0, BLOFELD_BANKS - 1, device_number, filename);
+  if (res < 0)
+    report("Error writing %s: %s", filename, GTK_MESSAGE_ERROR, dialog);
+  else if (res == 0)
+    report("No sounds to save; fetch banks first", NULL, GTK_MESSAGE_INFO,
+           dialog);
+  else if (status && GTK_IS_LABEL(status)) {
+    snprintf(text, sizeof(text), "Saved %d sounds", res);
+    gtk_label_set_text(GTK_LABEL(status), text);
+  }
+
+out:
+  gtk_widget_destroy (dialog);
+  g_free (filename);
+
+  return FALSE;
+}
+
+/* When Bank Window changed, change number of requests in flight */
+void
+on_Bank_Window_changed(GtkWidget *widget, gpointer user_data)
+{
+  blofeld_bank_set_window(gtk_spin_button_get_value_as_int(
+                            GTK_SPIN_BUTTON(widget)));
+}
+
+/* Wavetable upload progress callback: show progress in Wave Status label */
+static void
+wave_progress(const struct wave_progress *progress, void *ref)
+{
+  GtkWidget *status = find_widget_with_id(main_window, "Wave Status");
+  char text[80];
+
+  if (!status || !GTK_IS_LABEL(status)) return;
+
+  snprintf(text, sizeof(text), "%s %d/%d waves, %.0f bytes/s",
+           progress->finished ? "Uploaded" : "Uploading",
+           progress->done, progress->total, progress->rate);
+  gtk_label_set_text(GTK_LABEL(status), text);
+}
+
+/* When Wave Upload pressed, let user select a WAV file, and upload it
+ * to the user wavetable slot selected by Wave Slot. */
+gboolean
+on_Wave_Upload_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  GtkWidget *slot_widget = find_widget_with_id(main_window, "Wave Slot");
+  char *filename = NULL;
+  int slot = 0;
+
+  if (slot_widget && GTK_IS_SPIN_BUTTON(slot_widget))
+    slot = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(slot_widget)) - 1;
+
+  GtkWidget *dialog = file_chooser_dialog("Upload Wavetable", main_window,
+                                          GTK_FILE_CHOOSER_ACTION_OPEN,
+                                          "_Upload");
+
+  if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT)
+    filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
+
+  if (filename) {
+    xprintf("Pressed wave upload, slot %d\n", slot + 1);
+    midi_connect(SYNTH_PORT, NULL);
+    if (blofeld_wave_upload(filename, slot, device_number, 0,
+                            wave_progress, NULL) < 0)
+      report("Could not read wavetable from %s", filename,
+             GTK_MESSAGE_ERROR, dialog);
+  }
+
+  gtk_widget_destroy (dialog);
+  g_free (filename);
+
   return FALSE;
 }
 
@@ -200,15 +755,91 @@ on_Patch_Copy_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
   return FALSE;
 }
 
+/* Show how the last paste was sent to the synth in the paste button's
+ * tooltip */
+static void
+show_paste_status(GtkWidget *button, enum delta_path path)
+{
+  const char *text;
+
+  switch (path) {
+    case DELTA_SNDP: text = "Last paste sent as parameter changes"; break;
+    case DELTA_SNDD: text = "Last paste sent as a sound dump"; break;
+    default: text = "Last paste changed nothing"; break;
+  }
+  gtk_widget_set_tooltip_text(button, text);
+}
+
 /* When Patch Paste pressed, copy all parameters from paste buffer */
 gboolean
 on_Patch_Paste_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 {
-  blofeld_copy_from_paste(PARNOS_ALL, current_buffer_no, 0);
+  show_paste_status(widget,
+                    blofeld_copy_from_paste(PARNOS_ALL, current_buffer_no, 0));
+
+  return FALSE;
+}
+
+/* When Undo pressed (or Z), undo last change */
+gboolean
+on_Undo_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  midi_connect(SYNTH_PORT, NULL);
+  blofeld_undo(device_number);
 
   return FALSE;
 }
 
+/* When Redo pressed (or Y), redo last undone change */
+gboolean
+on_Redo_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  midi_connect(SYNTH_PORT, NULL);
+  blofeld_redo(device_number);
+
+  return FALSE;
+}
+
+/* Stop any morph in progress and set Morph slider back to start. */
+static void
+reset_morph_slider(void)
+{
+  GtkWidget *morph = find_widget_with_id(main_window, "Morph");
+
+  blofeld_morph_stop(); /* so moving the slider doesn't change anything */
+  if (morph && GTK_IS_RANGE(morph))
+    gtk_range_set_value(GTK_RANGE(morph), 0);
+}
+
+/* When Morph Clipboard pressed, set up morph from current patch to
+ * clipboard contents */
+gboolean
+on_Morph_Clip_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  reset_morph_slider();
+  blofeld_morph_from_paste(current_buffer_no, 0);
+
+  return FALSE;
+}
+
+/* When Morph File pressed, set up morph from current patch to patch file */
+gboolean
+on_Morph_File_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+  reset_morph_slider();
+  load_patch_file("Morph to Patch", blofeld_morph_from_file);
+
+  return FALSE;
+}
+
+/* When Morph slider moved (or knob turned), morph patch */
+void
+on_Morph_changed(GtkWidget *widget, gpointer user_data)
+{
+  midi_connect(SYNTH_PORT, NULL);
+  blofeld_morph_set(gtk_range_get_value(GTK_RANGE(widget)));
+}
+
 /* When Arp Copy pressed, copy all arpeggiator parameters to arpeggiator
  * paste buffer */
 gboolean
@@ -224,7 +855,8 @@ on_Copy_Arp_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 gboolean
 on_Paste_Arp_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 {
-  blofeld_copy_from_paste(PARNOS_ARPEGGIATOR, current_buffer_no, 1);
+  show_paste_status(widget, blofeld_copy_from_paste(PARNOS_ARPEGGIATOR,
+                                                    current_buffer_no, 1));
 
   return FALSE;
 }
@@ -319,6 +951,87 @@ on_Modulation_Select_changed(GtkWidget *widget, GdkEvent *event, gpointer user_d
 }
 
 
+/* Automation status callback: show status, and keep Record and Play
+ * buttons in line with what's actually going on, e.g. when playback
+ * has reached the end. */
+static void
+automation_status(const struct automation_status *status, void *ref)
+{
+  GtkWidget *label = find_widget_with_id(main_window, "Automation Status");
+  char text[80];
+
+  set_toggle("Automation Record", status->recording);
+  set_toggle("Automation Play", status->playing);
+
+  if (!label || !GTK_IS_LABEL(label)) return;
+
+  snprintf(text, sizeof(text), "%s %d events, %.1f s",
+           status->recording ? "Recording" :
+             status->playing ? "Playing" : "Recorded",
+           status->events, status->length / 1000.0);
+  gtk_label_set_text(GTK_LABEL(label), text);
+}
+
+/* Set automation loop from state of Loop button. We always loop the whole
+ * timeline. */
+static void
+set_automation_loop(void)
+{
+  struct automation_status status;
+
+  automation_get_status(&status);
+  if (get_toggle("Automation Loop"))
+    automation_set_loop(0, status.length);
+  else
+    automation_set_loop(0, 0);
+}
+
+/* When Automation Record toggled, start or stop recording */
+void
+on_Automation_Record_toggled(GtkWidget *widget, gpointer user_data)
+{
+  automation_register_status_cb(automation_status, NULL);
+  if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)))
+    automation_record_start();
+  else
+    automation_record_stop();
+}
+
+/* When Automation Play toggled, start or stop playback */
+void
+on_Automation_Play_toggled(GtkWidget *widget, gpointer user_data)
+{
+  GtkWidget *tempo = find_widget_with_id(main_window, "Automation Tempo");
+
+  automation_register_status_cb(automation_status, NULL);
+  if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
+    automation_stop();
+    return;
+  }
+
+  midi_connect(SYNTH_PORT, NULL);
+  automation_record_stop(); /* so the loop covers the whole recording */
+  set_automation_loop();
+  if (blofeld_automation_play(tempo && GTK_IS_RANGE(tempo) ?
+                                gtk_range_get_value(GTK_RANGE(tempo)) : 100)
+      < 0)
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(widget), FALSE);
+}
+
+/* When Automation Loop toggled, turn looping on or off */
+void
+on_Automation_Loop_toggled(GtkWidget *widget, gpointer user_data)
+{
+  set_automation_loop();
+}
+
+/* When Automation Tempo changed, change playback tempo */
+void
+on_Automation_Tempo_changed(GtkWidget *widget, gpointer user_data)
+{
+  automation_set_tempo(gtk_range_get_value(GTK_RANGE(widget)));
+}
+
 /* Parameter struct for set_value/on_all_changed */
 struct all_updater {
   const char *format;
@@ -387,7 +1100,11 @@ on_all_changed (GtkWidget *widget, gpointer user_data)
   GtkWidget *container = gtk_widget_get_parent(widget);
   GList *container_children = gtk_container_get_children(GTK_CONTAINER(container));
 
+  /* Send the resulting changes in one go rather than one step at a time */
+  blofeld_batch_begin();
   g_list_foreach(container_children, set_value, &all_updater);
+  blofeld_batch_end();
+  g_list_free(container_children);
 }
 
 /*************************** End of file blofeld_ui.c ***********************/
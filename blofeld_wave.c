@@ -0,0 +1,477 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_wave.c - User wavetable upload for Waldorf Blofeld.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* A Blofeld user wavetable consists of 64 waves of 128 samples each, and is
+ * sent as one sysex message per wave. The source is a WAV file containing
+ * a number of single cycle waves, which is read a chunk at a time, each
+ * cycle being resampled to 128 samples as it goes by. The resulting table
+ * is normalized so that its peak uses the full 21 bit range of the synth.
+ *
+ * The waves are encoded one at a time as the MIDI output queue drains, and
+ * the queue is paced so as not to overrun the synth, so the editor carries
+ * on as usual while the upload is in progress. */
+
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "param.h"
+#include "blofeld_params.h"
+#include "blofeld_wave.h"
+#include "midi.h"
+#include "timestamp.h"
+
+#include "debug.h"
+
+#define TABLE_SAMPLES (BLOFELD_WAVES * BLOFELD_WAVE_LEN)
+
+/* Cycle lengths we look for in WAV files when guessing. 2048 is what most
+ * wavetable editors produce. */
+#define COMMON_CYCLE_LEN 2048
+
+/* Max number of waves we keep in the MIDI output queue at any time */
+#define WAVES_QUEUED 2
+
+/* Number of frames read from WAV file at a time */
+#define WAV_CHUNK_FRAMES 1024
+
+/* Max number of channels in WAV file. All are mixed down to mono, so
+ * there is no point in more than surround formats use, and a frame must
+ * fit in the buffer in wav_read_chunk. */
+#define WAV_CHANNELS_MAX 8
+
+/* WAV format tags */
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xfffe
+
+/* WAV file being read. Samples are converted to mono floats in the
+ * range -1.0 .. 1.0 as they are read. */
+struct wav_reader {
+  FILE *f;
+  int channels;
+  int bits;
+  int is_float;
+  int frame_size; /* bytes per frame */
+  long data_start; /* file offset of first frame */
+  long frames; /* total # frames in file */
+  long chunk_start; /* index of first frame in chunk */
+  int chunk_frames; /* # frames in chunk */
+  float chunk[WAV_CHUNK_FRAMES];
+};
+
+/* State of ongoing wavetable upload */
+struct wave_upload {
+  int active;
+  int slot;
+  int dev_no;
+  int next; /* next wave to queue */
+  char name[BLOFELD_WAVETABLE_NAME_LEN + 1];
+  int samples[TABLE_SAMPLES];
+  long long started;
+  struct wave_progress progress;
+  wave_progress_cb cb;
+  void *ref;
+};
+
+static struct wave_upload upload = { 0 };
+
+/* Read little endian numbers from byte buffer */
+static unsigned int
+le16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long
+le32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+/* Open WAV file and find the data. Returns 0 if ok, -1 on error. */
+static int
+wav_open(struct wav_reader *wav, const char *filename)
+{
+  unsigned char header[40];
+  unsigned long size;
+  int pad;
+  int format = 0;
+
+  memset(wav, 0, sizeof(*wav));
+  wav->f = fopen(filename, "rb");
+  if (!wav->f) {
+    eprintf("Can't open %s\n", filename);
+    return -1;
+  }
+
+  if (fread(header, 1, 12, wav->f) != 12 ||
+      memcmp(header, "RIFF", 4) || memcmp(&header[8], "WAVE", 4))
+    goto bad;
+
+  /* Walk through chunks until we find the data */
+  while (fread(header, 1, 8, wav->f) == 8) {
+    size = le32(&header[4]);
+    pad = size & 1; /* chunks are padded to even length */
+    if (!memcmp(header, "fmt ", 4)) {
+      int len = size < sizeof(header) ? size : sizeof(header);
+      if (size < 16 || fread(header, 1, len, wav->f) != len)
+        goto bad;
+      format = le16(&header[0]);
+      if (format == WAV_FORMAT_EXTENSIBLE && len >= 26)
+        format = le16(&header[24]); /* subformat GUID starts with tag */
+      wav->channels = le16(&header[2]);
+      wav->bits = le16(&header[14]);
+      wav->is_float = format == WAV_FORMAT_FLOAT;
+      size -= len;
+    } else if (!memcmp(header, "data", 4)) {
+      if ((format != WAV_FORMAT_PCM && format != WAV_FORMAT_FLOAT) ||
+          wav->channels < 1 || wav->channels > WAV_CHANNELS_MAX ||
+          (wav->is_float ? wav->bits != 32 :
+                           wav->bits != 8 && wav->bits != 16 &&
+                           wav->bits != 24 && wav->bits != 32)) {
+        eprintf("Unsupported WAV format in %s\n", filename);
+        fclose(wav->f);
+        return -1;
+      }
+      wav->frame_size = wav->channels * wav->bits / 8;
+      wav->frames = size / wav->frame_size;
+      wav->data_start = ftell(wav->f);
+      xprintf("WAV %s: %d channels, %d bits%s, %ld frames\n", filename,
+              wav->channels, wav->bits, wav->is_float ? " float" : "",
+              wav->frames);
+      if (wav->frames > 0)
+        return 0;
+      break;
+    }
+    /* Skip rest of chunk */
+    if (fseek(wav->f, size + pad, SEEK_CUR) < 0)
+      break;
+  }
+
+bad:
+  eprintf("%s is not a valid WAV file\n", filename);
+  fclose(wav->f);
+  return -1;
+}
+
+/* Convert one sample in WAV file format to float */
+static float
+wav_convert(const struct wav_reader *wav, const unsigned char *p)
+{
+  union { unsigned int u; float f; } fl;
+
+  switch (wav->bits) {
+    case 8: return (p[0] - 128) / 128.0f;
+    case 16: return (short) le16(p) / 32768.0f;
+    case 24: return (int) ((p[0] << 8) | (p[1] << 16) |
+                           ((unsigned int) p[2] << 24)) / 2147483648.0f;
+  }
+  if (wav->is_float) {
+    fl.u = le32(p);
+    return fl.f;
+  }
+  return (int) le32(p) / 2147483648.0f;
+}
+
+/* Read chunk of frames starting at given frame, mixing them down to mono */
+static void
+wav_read_chunk(struct wav_reader *wav, long frame)
+{
+  unsigned char raw[WAV_CHUNK_FRAMES * 4 * 2]; /* 4 bytes, 2 channels */
+  int frames_per_read = sizeof(raw) / wav->frame_size;
+  int done = 0;
+
+  if (frames_per_read > WAV_CHUNK_FRAMES)
+    frames_per_read = WAV_CHUNK_FRAMES;
+
+  wav->chunk_start = frame;
+  wav->chunk_frames = 0;
+  if (frames_per_read < 1) /* can't happen with WAV_CHANNELS_MAX */
+    return;
+  if (fseek(wav->f, wav->data_start + frame * wav->frame_size, SEEK_SET) < 0)
+    return;
+
+  done = fread(raw, wav->frame_size, frames_per_read, wav->f);
+  for (wav->chunk_frames = 0; wav->chunk_frames < done; wav->chunk_frames++) {
+    const unsigned char *p = &raw[wav->chunk_frames * wav->frame_size];
+    float sum = 0;
+    int ch;
+
+    for (ch = 0; ch < wav->channels; ch++, p += wav->bits / 8)
+      sum += wav_convert(wav, p);
+    wav->chunk[wav->chunk_frames] = sum / wav->channels;
+  }
+}
+
+/* Return given frame of WAV file. Frames are normally requested in
+ * ascending order, in which case the file is read sequentially. */
+static float
+wav_sample(struct wav_reader *wav, long frame)
+{
+  if (frame < 0 || frame >= wav->frames)
+    return 0;
+  if (frame < wav->chunk_start ||
+      frame >= wav->chunk_start + wav->chunk_frames)
+    wav_read_chunk(wav, frame);
+  if (frame >= wav->chunk_start + wav->chunk_frames) /* read error */
+    return 0;
+  return wav->chunk[frame - wav->chunk_start];
+}
+
+/* Resample one cycle of cycle_len frames starting at frame start to
+ * BLOFELD_WAVE_LEN samples. When the cycle is longer than the wave, each
+ * sample is the average of the frames it covers, otherwise we interpolate
+ * linearly between frames, wrapping around at the end of the cycle. */
+static void
+resample_cycle(struct wav_reader *wav, long start, long cycle_len,
+               float *out)
+{
+  double step = (double) cycle_len / BLOFELD_WAVE_LEN;
+  int i;
+
+  for (i = 0; i < BLOFELD_WAVE_LEN; i++) {
+    if (step > 1) {
+      long first = i * step;
+      long last = (i + 1) * step;
+      float sum = 0;
+      long frame;
+
+      for (frame = first; frame < last; frame++)
+        sum += wav_sample(wav, start + frame);
+      out[i] = sum / (last - first);
+    } else {
+      double pos = i * step;
+      long frame = pos;
+      float frac = pos - frame;
+      float a = wav_sample(wav, start + frame);
+      float b = wav_sample(wav, start + (frame + 1) % cycle_len);
+
+      out[i] = a + (b - a) * frac;
+    }
+  }
+}
+
+/* Return highest absolute sample value */
+static float
+peak_level(const float *samples, int count)
+{
+  float peak = 0;
+  int i = 0;
+
+#ifdef __SSE2__
+  __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 vpeak = _mm_setzero_ps();
+  float lanes[4];
+  int lane;
+
+  for (; i + 4 <= count; i += 4)
+    vpeak = _mm_max_ps(vpeak, _mm_and_ps(_mm_loadu_ps(&samples[i]), absmask));
+  _mm_storeu_ps(lanes, vpeak);
+  for (lane = 0; lane < 4; lane++)
+    if (lanes[lane] > peak) peak = lanes[lane];
+#endif
+  for (; i < count; i++) {
+    float level = samples[i] < 0 ? -samples[i] : samples[i];
+    if (level > peak) peak = level;
+  }
+  return peak;
+}
+
+/* Scale float samples and convert them to integers, rounding to nearest */
+static void
+scale_samples(int *out, const float *in, int count, float scale)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  __m128 vscale = _mm_set1_ps(scale);
+
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_si128((__m128i *) &out[i],
+                     _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&in[i]),
+                                                vscale)));
+#endif
+  for (; i < count; i++) {
+    float value = in[i] * scale;
+    out[i] = value < 0 ? value - 0.5f : value + 0.5f;
+  }
+}
+
+/* Guess cycle length from number of frames in file */
+static long
+guess_cycle_len(long frames)
+{
+  if (frames % COMMON_CYCLE_LEN == 0)
+    return COMMON_CYCLE_LEN;
+  if (frames % BLOFELD_WAVE_LEN == 0)
+    return BLOFELD_WAVE_LEN;
+  return frames; /* assume it's a single cycle */
+}
+
+/* Read WAV file into upload.samples. Returns # cycles in file, or -1. */
+static int
+load_table(const char *filename, long cycle_len)
+{
+  static float table[TABLE_SAMPLES];
+  struct wav_reader wav;
+  float peak;
+  int cycles, wave;
+
+  if (wav_open(&wav, filename) < 0)
+    return -1;
+
+  if (cycle_len <= 0)
+    cycle_len = guess_cycle_len(wav.frames);
+  cycles = wav.frames / cycle_len;
+  if (cycles < 1) {
+    eprintf("%s is shorter than one cycle\n", filename);
+    fclose(wav.f);
+    return -1;
+  }
+
+  /* Waves beyond the ones in the file repeat the last one. */
+  for (wave = 0; wave < BLOFELD_WAVES; wave++) {
+    float *out = &table[wave * BLOFELD_WAVE_LEN];
+    if (wave < cycles)
+      resample_cycle(&wav, wave * cycle_len, cycle_len, out);
+    else
+      memcpy(out, out - BLOFELD_WAVE_LEN, BLOFELD_WAVE_LEN * sizeof(*out));
+  }
+  fclose(wav.f);
+
+  peak = peak_level(table, TABLE_SAMPLES);
+  scale_samples(upload.samples, table, TABLE_SAMPLES,
+                peak > 0 ? BLOFELD_WAVE_MAX / peak : 0);
+  xprintf("Wavetable %s: %d cycles of %ld frames, peak %f\n",
+          filename, cycles, cycle_len, peak);
+
+  return cycles;
+}
+
+/* Set wavetable name from file name, minus directory and extension */
+static void
+set_name(const char *filename)
+{
+  const char *base = strrchr(filename, '/');
+  int len;
+
+  base = base ? base + 1 : filename;
+  len = strcspn(base, ".");
+  if (len > BLOFELD_WAVETABLE_NAME_LEN)
+    len = BLOFELD_WAVETABLE_NAME_LEN;
+  memcpy(upload.name, base, len);
+  upload.name[len] = '\0';
+}
+
+/* Call progress callback with updated figures */
+static void
+report_progress(void)
+{
+  long long elapsed = timestamp_ms() - upload.started;
+  struct wave_progress *progress = &upload.progress;
+
+  progress->rate = elapsed > 0 ? progress->bytes * 1000.0 / elapsed : 0;
+  if (upload.cb)
+    upload.cb(progress, upload.ref);
+}
+
+/* Called periodically; top up the MIDI output queue with the next waves,
+ * and report the ones that have been sent. */
+void
+blofeld_wave_timer(void)
+{
+  int pending, done;
+
+  if (!upload.active) return;
+
+  while (upload.next < BLOFELD_WAVES &&
+         midi_queue_pending(SYNTH_PORT) <
+           WAVES_QUEUED * BLOFELD_WAVE_MSG_LEN) {
+    if (blofeld_queue_wave(upload.slot, upload.next, upload.dev_no,
+                           &upload.samples[upload.next * BLOFELD_WAVE_LEN],
+                           upload.name) < 0)
+      break; /* queue full; try again later */
+    upload.next++;
+  }
+
+  /* Anything not in the queue has been sent */
+  pending = midi_queue_pending(SYNTH_PORT);
+  done = upload.next -
+         (pending + BLOFELD_WAVE_MSG_LEN - 1) / BLOFELD_WAVE_MSG_LEN;
+  if (done < 0) done = 0;
+  if (done == upload.progress.done) return;
+
+  upload.progress.done = done;
+  upload.progress.bytes = done * BLOFELD_WAVE_MSG_LEN;
+  if (done == BLOFELD_WAVES) {
+    upload.active = 0;
+    upload.progress.finished = 1;
+  }
+  report_progress();
+
+  if (upload.progress.finished)
+    xprintf("Wavetable upload done: %d bytes, %.0f bytes/s\n",
+            upload.progress.bytes, upload.progress.rate);
+}
+
+/* Cancel upload. Waves already in the MIDI output queue are still sent. */
+void
+blofeld_wave_cancel(void)
+{
+  if (upload.active)
+    xprintf("Wavetable upload canceled\n");
+  upload.active = 0;
+}
+
+/* Start uploading wavetable from WAV file */
+int
+blofeld_wave_upload(const char *filename, int slot, int dev_no,
+                    int cycle_len, wave_progress_cb cb, void *ref)
+{
+  if (slot < 0 || slot >= BLOFELD_USER_WAVETABLES)
+    return -1;
+
+  blofeld_wave_cancel();
+
+  memset(&upload, 0, sizeof(upload));
+  if (load_table(filename, cycle_len) < 0)
+    return -1;
+  set_name(filename);
+  upload.slot = slot;
+  upload.dev_no = dev_no;
+  upload.progress.total = BLOFELD_WAVES;
+  upload.cb = cb;
+  upload.ref = ref;
+  upload.started = timestamp_ms();
+  upload.active = 1;
+
+  midi_set_pace(SYNTH_PORT, BLOFELD_WAVE_BYTES_PER_SEC);
+
+  xprintf("Uploading wavetable %s to slot %d\n", upload.name, slot + 1);
+  blofeld_wave_timer();
+
+  return 0;
+}
+
+/************************ End of file blofeld_wave.c ************************/
@@ -0,0 +1,60 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_wave.h - User wavetable upload for Waldorf Blofeld.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _BLOFELD_WAVE_H_
+#define _BLOFELD_WAVE_H_
+
+/* Rate at which wavetables are sent, in bytes per second. This is the
+ * speed of a DIN MIDI connection, which the Blofeld can keep up with
+ * regardless of how it is connected. */
+#define BLOFELD_WAVE_BYTES_PER_SEC 3125
+
+/* Progress of wavetable upload, passed to progress callback */
+struct wave_progress {
+  int done;     /* number of waves sent so far */
+  int total;    /* total number of waves in table */
+  int bytes;    /* number of bytes sent so far */
+  double rate;  /* bytes per second so far */
+  int finished; /* set when the upload has finished */
+};
+
+/* Progress callback, called each time a wave has been sent */
+typedef void (*wave_progress_cb)(const struct wave_progress *progress,
+                                 void *ref);
+
+/* Load WAV file, and start uploading it to user wavetable slot (0..38).
+ * The file is split into single cycle waves of cycle_len samples each;
+ * if cycle_len is 0, it is guessed from the file length. Each wave is
+ * resampled to the Blofeld's wave length, and the whole table normalized.
+ * Returns 0 if ok, -1 if the file could not be read. */
+int blofeld_wave_upload(const char *filename, int slot, int dev_no,
+                        int cycle_len, wave_progress_cb cb, void *ref);
+
+/* Called periodically to drive uploads. */
+void blofeld_wave_timer(void);
+
+/* Cancel upload in progress. */
+void blofeld_wave_cancel(void);
+
+#endif /* _BLOFELD_WAVE_H_ */
+
+/************************ End of file blofeld_wave.h ************************/
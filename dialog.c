@@ -106,4 +106,208 @@ out:
   return res;
 }
 
+
+/* Double clicking an item in a list chooses it */
+static void
+on_list_row_activated(GtkTreeView *view, GtkTreePath *path,
+                      GtkTreeViewColumn *column, gpointer dialog)
+{
+  gtk_dialog_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+}
+
+/* Let user choose one of a list of items in a dialog box. The first item
+ * is selected to start with, so just pressing Enter chooses it. Typing
+ * searches the list. */
+int
+choose_from_list(const gchar *title, const gchar *heading,
+                 const gchar * const *items, int count, GtkWidget *parent)
+{
+  GtkWidget *dialog, *content, *scrolled, *view;
+  GtkListStore *store;
+  GtkTreeIter iter;
+  GtkCellRenderer *renderer;
+  GtkTreeViewColumn *column;
+  GtkTreeSelection *selection;
+  int i, choice = -1;
+
+  store = gtk_list_store_new(1, G_TYPE_STRING);
+  for (i = 0; i < count; i++)
+    gtk_list_store_insert_with_values(store, NULL, -1, 0, items[i], -1);
+
+  dialog = gtk_dialog_new_with_buttons(title, GTK_WINDOW(parent),
+                                       GTK_DIALOG_MODAL |
+                                       GTK_DIALOG_DESTROY_WITH_PARENT,
+                                       GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+                                       GTK_STOCK_OK, GTK_RESPONSE_ACCEPT,
+                                       NULL);
+  gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+  gtk_window_set_default_size(GTK_WINDOW(dialog), 300, 400);
+
+  view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
+  g_object_unref(store); /* the view holds on to it */
+  renderer = gtk_cell_renderer_text_new();
+  column = gtk_tree_view_column_new_with_attributes(heading, renderer,
+                                                    "text", 0, NULL);
+  /* With fixed row heights, long lists are shown without measuring
+   * every row first */
+  gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+  gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
+  gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(view), TRUE);
+  gtk_tree_view_set_enable_search(GTK_TREE_VIEW(view), TRUE);
+  g_signal_connect(view, "row-activated",
+                   G_CALLBACK(on_list_row_activated), dialog);
+  selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(view));
+  if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter))
+    gtk_tree_selection_select_iter(selection, &iter);
+
+  scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled),
+                                 GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_container_add(GTK_CONTAINER(scrolled), view);
+  content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+  gtk_box_pack_start(GTK_BOX(content), scrolled, TRUE, TRUE, 0);
+  gtk_widget_show_all(scrolled);
+
+  if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+    GtkTreeModel *model;
+
+    if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
+      GtkTreePath *path = gtk_tree_model_get_path(model, &iter);
+      choice = gtk_tree_path_get_indices(path)[0];
+      gtk_tree_path_free(path);
+    }
+  }
+  gtk_widget_destroy(dialog);
+
+  return choice;
+}
+
+/* Max number of items shown by choose_with_search */
+#define SEARCH_SHOWN_MAX 1000
+
+struct search_dialog {
+  GtkWidget *entry, *filter, *status, *view;
+  GtkListStore *store; /* text, id */
+  search_func search;
+  void *ref;
+};
+
+/* Search again and show the result. The list is detached from the view
+ * while it is refilled, so that the view doesn't update for every row. */
+static void
+update_search(GtkWidget *widget, gpointer data)
+{
+  struct search_dialog *sd = data;
+  gchar *items[SEARCH_SHOWN_MAX];
+  int ids[SEARCH_SHOWN_MAX];
+  int filter = sd->filter ?
+               gtk_combo_box_get_active(GTK_COMBO_BOX(sd->filter)) - 1 : -1;
+  int total, shown, i;
+  GtkTreeIter iter;
+  gchar *status;
+
+  total = sd->search(gtk_entry_get_text(GTK_ENTRY(sd->entry)), filter,
+                     items, ids, SEARCH_SHOWN_MAX, sd->ref);
+  shown = total < SEARCH_SHOWN_MAX ? total : SEARCH_SHOWN_MAX;
+
+  gtk_tree_view_set_model(GTK_TREE_VIEW(sd->view), NULL);
+  gtk_list_store_clear(sd->store);
+  for (i = 0; i < shown; i++) {
+    gtk_list_store_insert_with_values(sd->store, NULL, -1, 0, items[i],
+                                      1, ids[i], -1);
+    g_free(items[i]);
+  }
+  gtk_tree_view_set_model(GTK_TREE_VIEW(sd->view),
+                          GTK_TREE_MODEL(sd->store));
+  if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(sd->store), &iter))
+    gtk_tree_selection_select_iter(
+      gtk_tree_view_get_selection(GTK_TREE_VIEW(sd->view)), &iter);
+
+  if (shown < total)
+    status = g_strdup_printf("Showing %d of %d", shown, total);
+  else
+    status = g_strdup_printf("%d found", total);
+  gtk_label_set_text(GTK_LABEL(sd->status), status);
+  g_free(status);
+}
+
+/* Let user choose an item, searching for it as the user types. Pressing
+ * Enter in the search entry chooses the selected (at first the first)
+ * item. */
+int
+choose_with_search(const gchar *title, const gchar *heading,
+                   const gchar * const *filters, int filter_count,
+                   search_func search, void *ref, GtkWidget *parent)
+{
+  struct search_dialog sd = { .search = search, .ref = ref };
+  GtkWidget *dialog, *content, *hbox, *scrolled;
+  GtkCellRenderer *renderer;
+  GtkTreeViewColumn *column;
+  GtkTreeSelection *selection;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  int i, choice = -1;
+
+  dialog = gtk_dialog_new_with_buttons(title, GTK_WINDOW(parent),
+                                       GTK_DIALOG_MODAL |
+                                       GTK_DIALOG_DESTROY_WITH_PARENT,
+                                       GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+                                       GTK_STOCK_OK, GTK_RESPONSE_ACCEPT,
+                                       NULL);
+  gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+  gtk_window_set_default_size(GTK_WINDOW(dialog), 400, 500);
+  content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
+
+  hbox = gtk_hbox_new(FALSE, 4);
+  sd.entry = gtk_entry_new();
+  gtk_entry_set_activates_default(GTK_ENTRY(sd.entry), TRUE);
+  gtk_box_pack_start(GTK_BOX(hbox), sd.entry, TRUE, TRUE, 0);
+  if (filter_count) {
+    sd.filter = gtk_combo_box_new_text();
+    gtk_combo_box_append_text(GTK_COMBO_BOX(sd.filter), "All");
+    for (i = 0; i < filter_count; i++)
+      gtk_combo_box_append_text(GTK_COMBO_BOX(sd.filter), filters[i]);
+    gtk_combo_box_set_active(GTK_COMBO_BOX(sd.filter), 0);
+    gtk_box_pack_start(GTK_BOX(hbox), sd.filter, FALSE, FALSE, 0);
+  }
+  gtk_box_pack_start(GTK_BOX(content), hbox, FALSE, FALSE, 0);
+
+  sd.store = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_INT);
+  sd.view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(sd.store));
+  renderer = gtk_cell_renderer_text_new();
+  column = gtk_tree_view_column_new_with_attributes(heading, renderer,
+                                                    "text", 0, NULL);
+  gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+  gtk_tree_view_append_column(GTK_TREE_VIEW(sd.view), column);
+  gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(sd.view), TRUE);
+  gtk_tree_view_set_enable_search(GTK_TREE_VIEW(sd.view), FALSE);
+  g_signal_connect(sd.view, "row-activated",
+                   G_CALLBACK(on_list_row_activated), dialog);
+  selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(sd.view));
+
+  scrolled = gtk_scrolled_window_new(NULL, NULL);
+  gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled),
+                                 GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+  gtk_container_add(GTK_CONTAINER(scrolled), sd.view);
+  gtk_box_pack_start(GTK_BOX(content), scrolled, TRUE, TRUE, 0);
+  sd.status = gtk_label_new("");
+  gtk_misc_set_alignment(GTK_MISC(sd.status), 0, 0.5);
+  gtk_box_pack_start(GTK_BOX(content), sd.status, FALSE, FALSE, 0);
+
+  update_search(NULL, &sd);
+  g_signal_connect(sd.entry, "changed", G_CALLBACK(update_search), &sd);
+  if (sd.filter)
+    g_signal_connect(sd.filter, "changed", G_CALLBACK(update_search), &sd);
+  gtk_widget_show_all(content);
+  gtk_widget_grab_focus(sd.entry);
+
+  if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT &&
+      gtk_tree_selection_get_selected(selection, &model, &iter))
+    gtk_tree_model_get(model, &iter, 1, &choice, -1);
+  gtk_widget_destroy(dialog);
+  g_object_unref(sd.store);
+
+  return choice;
+}
+
 /************************* End of file dialog.c ****************************/
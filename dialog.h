@@ -38,6 +38,26 @@ GtkWidget *file_chooser_dialog(const gchar *title, GtkWidget *parent,
 /* Perform a file open with overwrite query if file exists */
 int open_with_overwrite_query(char *filename, GtkWidget *parent);
 
+/* Let user choose one of a list of items, shown under the given heading.
+ * Return index of item chosen, or -1 if canceled. */
+int choose_from_list(const gchar *title, const gchar *heading,
+                     const gchar * const *items, int count,
+                     GtkWidget *parent);
+
+/* Function called by choose_with_search to find the items matching text
+ * and filter (-1 for none). Up to max items are stored in items, newly
+ * allocated, with an id for each in ids. Returns the total number of
+ * matching items, which may be more than max. */
+typedef int (*search_func)(const gchar *text, int filter, gchar **items,
+                           int *ids, int max, void *ref);
+
+/* Let user choose an item, searching for it by typing text in an entry,
+ * and optionally picking one of the given filters. The list is updated
+ * as the user types. Returns id of item chosen, or -1 if canceled. */
+int choose_with_search(const gchar *title, const gchar *heading,
+                       const gchar * const *filters, int filter_count,
+                       search_func search, void *ref, GtkWidget *parent);
+
 #endif /* _DIALOG_H_ */
 
 /**************************** End of file dialog.h **************************/
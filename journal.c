@@ -0,0 +1,184 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * journal.c - Undo/redo journal of parameter changes.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* Parameter changes are recorded in a fixed size ring of compact records.
+ * Each record belongs to a group, which is the unit of undo: a single
+ * parameter change (or several merged changes of the same parameter),
+ * or an explicit group such as a paste or a file load.
+ *
+ * The indexes below increment forever, and are taken modulo
+ * JOURNAL_RECORDS when accessing the ring. Records between tail and cur
+ * can be undone, records between cur and head can be redone. */
+
+#include <stdio.h>
+#include "journal.h"
+#include "timestamp.h"
+
+#include "debug.h"
+
+struct journal_record {
+  unsigned short parnum;
+  unsigned char buf_no;
+  unsigned char old_value;
+  unsigned char new_value;
+  unsigned int time; /* timestamp_ms(), truncated; only used for deltas */
+  unsigned int group;
+};
+
+static struct journal_record journal[JOURNAL_RECORDS];
+
+static unsigned int tail = 0; /* oldest record */
+static unsigned int cur = 0; /* next record to be undone is cur - 1 */
+static unsigned int head = 0; /* next free record */
+
+static unsigned int group = 0; /* current group id */
+static int group_depth = 0; /* nesting level of explicit groups */
+static int mergeable = 0; /* last record may be merged with next one */
+
+#define RECORD(index) (&journal[(index) % JOURNAL_RECORDS])
+
+/* Make room for one record by discarding the oldest group. If the oldest
+ * group is the one currently being recorded, just discard its oldest
+ * record. */
+static void
+make_room(void)
+{
+  unsigned int oldest_group = RECORD(tail)->group;
+
+  if (oldest_group == group) {
+    tail++;
+    return;
+  }
+  while (tail != head && RECORD(tail)->group == oldest_group)
+    tail++;
+}
+
+/* Record parameter change */
+void
+journal_record(int buf_no, int parnum, int old_value, int new_value)
+{
+  unsigned int now = timestamp_ms();
+  struct journal_record *record;
+
+  if (old_value == new_value)
+    return;
+
+  /* Merge with previous record if it's the same parameter and it was
+   * recently changed, i.e. the user is dragging a slider */
+  if (mergeable && !group_depth && cur == head) {
+    record = RECORD(head - 1);
+    if (record->buf_no == buf_no && record->parnum == parnum &&
+        now - record->time < JOURNAL_MERGE_MS) {
+      record->new_value = new_value;
+      record->time = now;
+      return;
+    }
+  }
+
+  head = cur; /* New change means redo history is gone */
+  if (!group_depth)
+    group++;
+  if (head - tail >= JOURNAL_RECORDS)
+    make_room();
+
+  record = RECORD(head);
+  record->parnum = parnum;
+  record->buf_no = buf_no;
+  record->old_value = old_value;
+  record->new_value = new_value;
+  record->time = now;
+  record->group = group;
+  cur = ++head;
+
+  mergeable = !group_depth;
+}
+
+/* Begin group of changes */
+void
+journal_begin_group(void)
+{
+  if (!group_depth++)
+    group++;
+  mergeable = 0;
+}
+
+/* End group of changes */
+void
+journal_end_group(void)
+{
+  if (group_depth > 0)
+    group_depth--;
+}
+
+/* Undo last step */
+int
+journal_undo(journal_apply_func apply, void *ref)
+{
+  unsigned int undo_group;
+  int count = 0;
+
+  if (cur == tail)
+    return 0;
+
+  mergeable = 0;
+  undo_group = RECORD(cur - 1)->group;
+  while (cur != tail && RECORD(cur - 1)->group == undo_group) {
+    struct journal_record *record = RECORD(--cur);
+    apply(record->buf_no, record->parnum, record->old_value, ref);
+    count++;
+  }
+  xprintf("Journal: undid %d parameters\n", count);
+
+  return count;
+}
+
+/* Redo last undone step */
+int
+journal_redo(journal_apply_func apply, void *ref)
+{
+  unsigned int redo_group;
+  int count = 0;
+
+  if (cur == head)
+    return 0;
+
+  mergeable = 0;
+  redo_group = RECORD(cur)->group;
+  while (cur != head && RECORD(cur)->group == redo_group) {
+    struct journal_record *record = RECORD(cur++);
+    apply(record->buf_no, record->parnum, record->new_value, ref);
+    count++;
+  }
+  xprintf("Journal: redid %d parameters\n", count);
+
+  return count;
+}
+
+/* Forget everything */
+void
+journal_clear(void)
+{
+  tail = cur = head = 0;
+  mergeable = 0;
+}
+
+/*************************** End of file journal.c **************************/
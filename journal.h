@@ -0,0 +1,60 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * journal.h - Undo/redo journal of parameter changes.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+/* Number of records kept in the journal. When full, the oldest undo
+ * steps are discarded. */
+#define JOURNAL_RECORDS 4096
+
+/* Consecutive changes to the same parameter closer together than this
+ * (in ms) are merged into one undo step, so that dragging a slider or
+ * turning a knob can be undone in one go. */
+#define JOURNAL_MERGE_MS 750
+
+/* Function called for each parameter to be restored during undo/redo */
+typedef void (*journal_apply_func)(int buf_no, int parnum, int value,
+                                   void *ref);
+
+/* Record parameter change. */
+void journal_record(int buf_no, int parnum, int old_value, int new_value);
+
+/* Begin and end a group of changes which are undone as a single step.
+ * Groups may be nested, in which case only the outermost one counts. */
+void journal_begin_group(void);
+void journal_end_group(void);
+
+/* Undo the last step, calling apply with the old value for each parameter
+ * in it, most recent first. Returns number of parameters restored. */
+int journal_undo(journal_apply_func apply, void *ref);
+
+/* Redo the last undone step, calling apply with the new value for each
+ * parameter, in original order. Returns number of parameters restored. */
+int journal_redo(journal_apply_func apply, void *ref);
+
+/* Forget all recorded changes. */
+void journal_clear(void);
+
+#endif /* _JOURNAL_H_ */
+
+/*************************** End of file journal.h **************************/
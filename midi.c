@@ -23,6 +23,7 @@
 #include <asoundlib.h>
 
 #include "midi.h"
+#include "timestamp.h"
 #include "debug.h"
 #include <alloca.h>
 
@@ -49,6 +50,20 @@ struct cc_info {
 
 static struct cc_info cc_receivers[MAX_PORTS] = { 0 };
 
+/* Paced output. Messages queued using midi_queue_sysex() are sent from
+ * midi_output() no faster than the rate set for the port, so that large
+ * transfers neither overrun the receiving device nor hold up the caller
+ * while they are being sent. */
+struct out_queue {
+  unsigned char buf[MIDI_QUEUE_SIZE];
+  int len;
+  int bytes_per_sec; /* 0 => send as fast as we can */
+  double credit; /* number of bytes we may send right now */
+  long long updated; /* timestamp_ms() when credit last updated */
+};
+
+static struct out_queue out_queues[MAX_PORTS];
+
 /* Convert port id from ALSA to local port index 0 .. */
 static int
 myport(int port)
@@ -69,7 +84,7 @@ midi_init_alsa(void)
 {
   struct polls *polls;
   int npfd;
-  int synth_port, ctrlr_port;
+  int synth_port, ctrlr_port, mirror_port;
   int i;
 
   if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, 0) < 0) {
@@ -109,6 +124,18 @@ midi_init_alsa(void)
   }
   ports[CTRLR_PORT] = ctrlr_port;
 
+  mirror_port = snd_seq_create_simple_port(seq, "Xtor mirror port",
+                                           SND_SEQ_PORT_CAP_READ |
+                                           SND_SEQ_PORT_CAP_WRITE |
+                                           SND_SEQ_PORT_CAP_SUBS_READ |
+                                           SND_SEQ_PORT_CAP_SUBS_WRITE,
+                                           SND_SEQ_PORT_TYPE_APPLICATION);
+  if (mirror_port < 0) {
+    xprintf("Couldn't create mirror port: %s\n", snd_strerror(errno));
+    return NULL;
+  }
+  ports[MIRROR_PORT] = mirror_port;
+
   /* Fetch poll descriptor(s) for MIDI input (normally only one) */
   npfd = snd_seq_poll_descriptors_count(seq, POLLIN);
   polls = (struct polls *) malloc(sizeof(struct polls) +
@@ -213,6 +240,188 @@ midi_send_sysex(int port, void *buf, int buflen)
   return err;
 }
 
+/* Queue sysex buffer for paced output (buffer must contain complete
+ * sysex msg w/ SYSEX & EOX). Returns -1 if there is no room for it. */
+int
+midi_queue_sysex(int port, const void *buf, int buflen)
+{
+  struct out_queue *queue;
+
+  if (port >= MAX_PORTS) return -1;
+
+  queue = &out_queues[port];
+  if (buflen > MIDI_QUEUE_SIZE - queue->len) return -1;
+
+  if (queue->len == 0) {
+    /* The first message after the queue has been idle goes right away */
+    queue->credit = buflen;
+    queue->updated = timestamp_ms();
+  }
+  memcpy(&queue->buf[queue->len], buf, buflen);
+  queue->len += buflen;
+  return 0;
+}
+
+/* Return number of bytes waiting in output queue */
+int
+midi_queue_pending(int port)
+{
+  if (port >= MAX_PORTS) return 0;
+
+  return out_queues[port].len;
+}
+
+/* Set max output rate for queued messages. 0 means no limit. */
+void
+midi_set_pace(int port, int bytes_per_sec)
+{
+  if (port < MAX_PORTS)
+    out_queues[port].bytes_per_sec = bytes_per_sec;
+}
+
+/* Send as many queued messages as the pace allows. To be called
+ * periodically from the main loop. */
+void
+midi_output(void)
+{
+  int port;
+
+  for (port = 0; port < MAX_PORTS; port++) {
+    struct out_queue *queue = &out_queues[port];
+    long long now;
+
+    if (!queue->len) continue;
+
+    now = timestamp_ms();
+    queue->credit += (now - queue->updated) * queue->bytes_per_sec / 1000.0;
+    queue->updated = now;
+
+    while (queue->len) {
+      unsigned char *eox = memchr(queue->buf, EOX, queue->len);
+      int msglen = eox ? eox - queue->buf + 1 : queue->len;
+
+      if (queue->bytes_per_sec && queue->credit < msglen) break;
+
+      midi_send_sysex(port, queue->buf, msglen);
+      queue->credit -= msglen;
+      queue->len -= msglen;
+      memmove(queue->buf, &queue->buf[msglen], queue->len);
+    }
+  }
+}
+
+/* Scheduled output. Events are scheduled on an ALSA queue, which sends
+ * them at the right time regardless of how busy we are. The queue runs at
+ * MIDI_SCHED_TICKS_PER_SEC at normal tempo. */
+#define SCHED_PPQ 1000 /* ticks per quarter note */
+#define SCHED_TEMPO (1000000LL * SCHED_PPQ / MIDI_SCHED_TICKS_PER_SEC)
+
+static int sched_queue = -1;
+
+/* Return queue tempo (us per quarter note) for tempo in percent */
+static int
+sched_tempo(int percent)
+{
+  if (percent <= 0) percent = 100;
+  return SCHED_TEMPO * 100 / percent;
+}
+
+/* Start scheduler queue from tick 0 at given tempo, in percent of normal.
+ * Returns 0 if ok, -1 on error. */
+int
+midi_sched_start(int percent)
+{
+  snd_seq_queue_tempo_t *tempo;
+  int err;
+
+  if (sched_queue < 0) {
+    sched_queue = snd_seq_alloc_named_queue(seq, "Xtor scheduler");
+    if (sched_queue < 0) {
+      eprintf("Couldn't allocate ALSA queue: %s\n",
+              snd_strerror(sched_queue));
+      return -1;
+    }
+  }
+
+  snd_seq_queue_tempo_alloca(&tempo);
+  snd_seq_queue_tempo_set_tempo(tempo, sched_tempo(percent));
+  snd_seq_queue_tempo_set_ppq(tempo, SCHED_PPQ);
+  err = snd_seq_set_queue_tempo(seq, sched_queue, tempo);
+  if (err >= 0)
+    err = snd_seq_start_queue(seq, sched_queue, NULL);
+  if (err >= 0)
+    err = snd_seq_drain_output(seq);
+  if (err < 0) {
+    eprintf("Couldn't start ALSA queue: %s\n", snd_strerror(err));
+    return -1;
+  }
+  return 0;
+}
+
+/* Stop scheduler queue, dropping anything scheduled but not yet sent */
+void
+midi_sched_stop(void)
+{
+  snd_seq_remove_events_t *remove;
+
+  if (sched_queue < 0) return;
+
+  snd_seq_remove_events_alloca(&remove);
+  snd_seq_remove_events_set_condition(remove, SND_SEQ_REMOVE_OUTPUT |
+                                              SND_SEQ_REMOVE_IGNORE_OFF);
+  snd_seq_remove_events_set_queue(remove, sched_queue);
+  snd_seq_remove_events(seq, remove);
+  snd_seq_stop_queue(seq, sched_queue, NULL);
+  snd_seq_drain_output(seq);
+}
+
+/* Change tempo of running scheduler queue */
+void
+midi_sched_tempo(int percent)
+{
+  if (sched_queue < 0) return;
+
+  snd_seq_change_queue_tempo(seq, sched_queue, sched_tempo(percent), NULL);
+  snd_seq_drain_output(seq);
+}
+
+/* Return current tick of scheduler queue */
+unsigned int
+midi_sched_time(void)
+{
+  snd_seq_queue_status_t *status;
+
+  if (sched_queue < 0) return 0;
+
+  snd_seq_queue_status_alloca(&status);
+  if (snd_seq_get_queue_status(seq, sched_queue, status) < 0)
+    return 0;
+  return snd_seq_queue_status_get_tick_time(status);
+}
+
+/* Schedule sysex buffer to be sent at given tick. Returns -1 if it could
+ * not be scheduled, e.g. because ALSA's buffers are full. */
+int
+midi_sched_sysex(int port, void *buf, int buflen, unsigned int tick)
+{
+  int err;
+  snd_seq_event_t sendev;
+
+  if (port >= MAX_PORTS || sched_queue < 0) return -1;
+
+  snd_seq_ev_clear(&sendev);
+  snd_seq_ev_set_source(&sendev, ports[port]);
+  snd_seq_ev_set_subs(&sendev);
+  snd_seq_ev_set_sysex(&sendev, buflen, buf);
+  snd_seq_ev_schedule_tick(&sendev, sched_queue, 0, tick);
+  err = snd_seq_event_output(seq, &sendev);
+  if (err >= 0)
+    err = snd_seq_drain_output(seq);
+  if (err < 0 && err != -EAGAIN)
+    eprintf("Couldn't schedule MIDI sysex: %s\n", snd_strerror(err));
+  return err < 0 ? -1 : 0;
+}
+
 /* Handle sysex event. */
 /* Alsa seems to return sysex data in chunks of 256 bytes, so piece the
  * chunks together to form the complete message. */
@@ -26,12 +26,20 @@
 #include <poll.h>
 
 /* Logical port numbers */
-enum port_no { SYNTH_PORT = 0, CTRLR_PORT, MAX_PORTS };
+/* MIRROR_PORT is used for sending to further synths mirroring the one
+ * connected to SYNTH_PORT. */
+enum port_no { SYNTH_PORT = 0, CTRLR_PORT, MIRROR_PORT, MAX_PORTS };
 
 /* Well-known MIDI constants */
 #define SYSEX 240
 #define EOX 247
 
+/* Scheduler queue ticks per second at normal tempo */
+#define MIDI_SCHED_TICKS_PER_SEC 1000
+
+/* Max number of bytes in output queue for each port */
+#define MIDI_QUEUE_SIZE 8192
+
 /* Convert two byte MIDI data (7 bits per bytes) to single int */
 #define MIDI_2BYTE(v1, v2) ((((int)(v1)) << 7) | (v2))
 
@@ -54,6 +62,35 @@ struct polls *midi_init_alsa(void);
 /* Send sysex buffer (buffer must contain complete sysex msg w/ SYSEX & EOX) */
 int midi_send_sysex(int port, void *buf, int buflen);
 
+/* Queue sysex buffer for paced output (as above). Returns -1 if the
+ * queue is full. */
+int midi_queue_sysex(int port, const void *buf, int buflen);
+
+/* Return number of bytes waiting to be sent from output queue */
+int midi_queue_pending(int port);
+
+/* Set max rate at which queued messages are sent; 0 for no limit */
+void midi_set_pace(int port, int bytes_per_sec);
+
+/* Send queued messages, as pace allows. Called periodically. */
+void midi_output(void);
+
+/* Start scheduler queue from tick 0, at tempo percent of normal */
+int midi_sched_start(int percent);
+
+/* Stop scheduler queue, dropping events not yet sent */
+void midi_sched_stop(void);
+
+/* Change tempo of scheduler queue, in percent of normal */
+void midi_sched_tempo(int percent);
+
+/* Return current tick of scheduler queue */
+unsigned int midi_sched_time(void);
+
+/* Schedule sysex buffer to be sent at given tick. Returns -1 if it
+ * could not be scheduled. */
+int midi_sched_sysex(int port, void *buf, int buflen, unsigned int tick);
+
 /* Process any potential incoming MIDI data */
 void midi_input(void);
 
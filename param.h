@@ -23,6 +23,9 @@
 #ifndef _PARAM_H_
 #define _PARAM_H_
 
+/* Interval in ms between calls to param_timer (see below) */
+#define PARAM_TIMER_INTERVAL 10
+
 struct param_properties {
   int ui_min;  /* user interface minimum */
   int ui_max;  /* user interface maximum */
@@ -32,12 +35,30 @@ struct param_properties {
 /* Register callback for parameter updates */
 typedef void (*notify_cb)(int parnum, int parlist, void *valptr, void *ref);
 
+/* Parameter change event, delivered in batches */
+struct param_event {
+  int parnum;
+  int buf_no;
+  int value; /* for integer parameters */
+  const char *string; /* for string parameters, else NULL */
+};
+
+/* Callback for a batch of parameter updates. The events (and strings) are
+ * only valid during the call. */
+typedef void (*param_batch_cb)(const struct param_event *events, int count,
+                               void *ref);
+
 /* Struct for specifying synth-specific functions and values, intended
  * to be filled in by synth-specific initialization routines. */
 struct param_handler {
   /* Register callback for parameter updates */
   void (*param_register_notify_cb)(notify_cb cb, void *ref);
 
+  /* Register callback for batches of parameter updates, such as all the
+   * parameters of a sound dump. May be NULL, in which case the UI
+   * registers a notify_cb instead. */
+  void (*param_register_batch_cb)(param_batch_cb cb, void *ref);
+
   /* Find parameter index from parameter name */
   int (*param_find_index)(const char *param_name);
 
@@ -68,11 +89,16 @@ struct param_handler {
   /* Called by main to initialize midi connection */
   void (*param_midi_init)(struct param_handler *param_handler);
 
+  /* Called by main every PARAM_TIMER_INTERVAL ms, for handling timeouts
+   * and the like. May be NULL if not needed. */
+  void (*param_timer)(void);
+
   int params; /* tital #params in parameter list (including bitmapped ones) */
   const char *name; /* Name of synth, to be used for window title etc */
   const char *remote_midi_device; /* Default Device ID of USB MIDI device */
   int remote_midi_device_number; /* Default sysex Device Number */
   const char *ui_filename; /* name of glade file with UI definition */
+  const char *def_filename; /* synth definition file; NULL for default */
 };
 
 #endif /* _PARAM_H_ */
@@ -0,0 +1,188 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * param_bus.c - Distribution of parameter changes to listeners.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* Parameter changes are posted by the synth-specific code, and delivered
+ * to any number of listeners (UI, recorder, etc). Changes that belong
+ * together, such as all the parameters in a sound dump, are delivered as
+ * one batch, so that each listener gets one call rather than hundreds. */
+
+#include <stdio.h>
+#include <string.h>
+#include "param_bus.h"
+
+#include "debug.h"
+
+struct listener {
+  param_batch_cb batch_cb; /* NULL if unused or single event listener */
+  notify_cb single_cb; /* NULL if unused or batch listener */
+  void *ref;
+};
+
+static struct listener listeners[PARAM_BUS_LISTENERS];
+
+/* Events queued during batch, with storage for string values */
+static struct param_event queue[PARAM_BUS_QUEUE];
+static char strings[PARAM_BUS_QUEUE][PARAM_BUS_STRING_MAX];
+static int queued = 0;
+
+static int batch_depth = 0;
+
+/* Set while delivering events; events posted by listeners during delivery
+ * are delivered directly, rather than being queued. */
+static int delivering = 0;
+
+/* Deliver events to all listeners */
+static void
+deliver_events(const struct param_event *events, int count)
+{
+  int id, i;
+
+  for (id = 0; id < PARAM_BUS_LISTENERS; id++) {
+    struct listener *listener = &listeners[id];
+    if (listener->batch_cb)
+      listener->batch_cb(events, count, listener->ref);
+    else if (listener->single_cb)
+      for (i = 0; i < count; i++) {
+        const struct param_event *event = &events[i];
+        void *valptr = event->string ? (void *) event->string :
+                                       (void *) &event->value;
+        listener->single_cb(event->parnum, event->buf_no, valptr,
+                            listener->ref);
+      }
+  }
+}
+
+/* Deliver queued events */
+static void
+deliver(void)
+{
+  if (!queued) return;
+
+  delivering = 1;
+  deliver_events(queue, queued);
+  delivering = 0;
+  queued = 0;
+}
+
+/* Find free listener slot and fill it in */
+static int
+subscribe(param_batch_cb batch_cb, notify_cb single_cb, void *ref)
+{
+  int id;
+
+  for (id = 0; id < PARAM_BUS_LISTENERS; id++) {
+    struct listener *listener = &listeners[id];
+    if (!listener->batch_cb && !listener->single_cb) {
+      listener->batch_cb = batch_cb;
+      listener->single_cb = single_cb;
+      listener->ref = ref;
+      return id;
+    }
+  }
+  eprintf("Warning: Too many parameter listeners\n");
+  return -1;
+}
+
+/* Subscribe to batches of events */
+int
+param_bus_subscribe(param_batch_cb cb, void *ref)
+{
+  return subscribe(cb, NULL, ref);
+}
+
+/* Subscribe to single events */
+int
+param_bus_subscribe_single(notify_cb cb, void *ref)
+{
+  return subscribe(NULL, cb, ref);
+}
+
+/* Remove listener */
+void
+param_bus_unsubscribe(int id)
+{
+  if (id < 0 || id >= PARAM_BUS_LISTENERS) return;
+
+  memset(&listeners[id], 0, sizeof(listeners[id]));
+}
+
+/* Begin batch */
+void
+param_bus_begin_batch(void)
+{
+  batch_depth++;
+}
+
+/* End batch, delivering events if it was the outermost one */
+void
+param_bus_end_batch(void)
+{
+  if (batch_depth > 0 && !--batch_depth)
+    deliver();
+}
+
+/* Add event to queue, delivering at once if we're not in a batch */
+static void
+post(int parnum, int buf_no, int value, const char *string)
+{
+  struct param_event *event;
+
+  if (delivering) {
+    struct param_event direct = { parnum, buf_no, value, string };
+    deliver_events(&direct, 1);
+    return;
+  }
+
+  if (queued >= PARAM_BUS_QUEUE) /* batch too large, deliver what we have */
+    deliver();
+
+  event = &queue[queued];
+  event->parnum = parnum;
+  event->buf_no = buf_no;
+  event->value = value;
+  event->string = NULL;
+  if (string) {
+    strncpy(strings[queued], string, PARAM_BUS_STRING_MAX - 1);
+    strings[queued][PARAM_BUS_STRING_MAX - 1] = '\0';
+    event->string = strings[queued];
+  }
+  queued++;
+
+  if (!batch_depth)
+    deliver();
+}
+
+/* Post integer parameter change */
+void
+param_bus_post(int parnum, int buf_no, int value)
+{
+  post(parnum, buf_no, value, NULL);
+}
+
+/* Post string parameter change */
+void
+param_bus_post_string(int parnum, int buf_no, const char *string)
+{
+  post(parnum, buf_no, 0, string);
+}
+
+/************************** End of file param_bus.c *************************/
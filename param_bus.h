@@ -0,0 +1,60 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * param_bus.h - Distribution of parameter changes to listeners.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _PARAM_BUS_H_
+#define _PARAM_BUS_H_
+
+#include "param.h"
+
+/* Max number of listeners */
+#define PARAM_BUS_LISTENERS 8
+
+/* Max number of events queued during a batch. If more events than this
+ * are posted, the batch is delivered in several parts. */
+#define PARAM_BUS_QUEUE 1024
+
+/* Max length of string parameter values, including terminating '\0' */
+#define PARAM_BUS_STRING_MAX 32
+
+/* Subscribe to batches of events (see param.h for struct param_event and
+ * param_batch_cb). Returns listener id, or -1 if full. */
+int param_bus_subscribe(param_batch_cb cb, void *ref);
+
+/* Subscribe with a callback called once for each event, with valptr
+ * pointing to either an int or a string, as for notify_cb. */
+int param_bus_subscribe_single(notify_cb cb, void *ref);
+
+/* Remove listener */
+void param_bus_unsubscribe(int id);
+
+/* Begin and end batch of events. Events posted during a batch are
+ * delivered when the (outermost) batch ends. */
+void param_bus_begin_batch(void);
+void param_bus_end_batch(void);
+
+/* Post parameter changes. Outside a batch they are delivered at once. */
+void param_bus_post(int parnum, int buf_no, int value);
+void param_bus_post_string(int parnum, int buf_no, const char *string);
+
+#endif /* _PARAM_BUS_H_ */
+
+/************************** End of file param_bus.h *************************/
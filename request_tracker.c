@@ -0,0 +1,248 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * request_tracker.c - Tracking of outstanding dump requests.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* Keeps track of requests sent to the synth, such as sound dump requests,
+ * so that we can detect when the synth does not answer, and retry,
+ * as well as avoid sending the same request twice when it is already in
+ * flight. Users can register callbacks to be called when a request is
+ * completed, which means that operations involving a sequence of requests
+ * can be pipelined. */
+
+#include <stdio.h>
+#include "request_tracker.h"
+#include "timestamp.h"
+
+#include "debug.h"
+
+/* Number of callbacks that can wait for the same request */
+#define REQUEST_MAX_WAITERS 4
+
+struct request_waiter {
+  request_done_cb cb;
+  void *ref;
+};
+
+struct request {
+  int in_use;
+  int device;
+  int bank;
+  int buffer;
+  request_send_func send;
+  long long deadline; /* timestamp_ms() when we time out */
+  int timeout; /* current timeout in ms, doubled for each retry */
+  int retries_left;
+  int waiters;
+  struct request_waiter waiter[REQUEST_MAX_WAITERS];
+};
+
+static struct request requests[REQUEST_MAX];
+
+static int requests_in_flight = 0;
+
+/* Timing defaults. Even at DIN MIDI speeds, a Blofeld sound dump takes
+ * about 130 ms to transfer, so this leaves some margin for the synth to
+ * actually get around to sending it. */
+static int request_timeout = 500;
+static int request_retries = 3;
+
+/* Does request match given device, bank and buffer ? */
+static int
+request_matches(struct request *req, int device, int bank, int buffer)
+{
+  return req->in_use && req->bank == bank && req->buffer == buffer &&
+         (req->device == device || req->device == REQUEST_ANY_DEVICE ||
+          device == REQUEST_ANY_DEVICE);
+}
+
+/* Find request in flight, NULL if not found */
+static struct request *
+request_find(int device, int bank, int buffer)
+{
+  int i;
+
+  for (i = 0; i < REQUEST_MAX; i++)
+    if (request_matches(&requests[i], device, bank, buffer))
+      return &requests[i];
+  return NULL;
+}
+
+/* Add waiter to request, unless it's already there */
+static void
+request_add_waiter(struct request *req, request_done_cb cb, void *ref)
+{
+  int i;
+
+  if (!cb) return;
+
+  for (i = 0; i < req->waiters; i++)
+    if (req->waiter[i].cb == cb && req->waiter[i].ref == ref)
+      return;
+
+  if (req->waiters >= REQUEST_MAX_WAITERS) {
+    eprintf("Warning: too many waiters for request %d:%d:%d\n",
+            req->device, req->bank, req->buffer);
+    return;
+  }
+  req->waiter[req->waiters].cb = cb;
+  req->waiter[req->waiters].ref = ref;
+  req->waiters++;
+}
+
+/* Remove request from table and call its waiters. */
+/* We free the slot before calling the callbacks, so they can submit
+ * new requests (including the same one again) if they so wish. */
+static void
+request_finish(struct request *req, enum request_status status)
+{
+  struct request done = *req;
+  int i;
+
+  req->in_use = 0;
+  requests_in_flight--;
+
+  for (i = 0; i < done.waiters; i++)
+    done.waiter[i].cb(done.device, done.bank, done.buffer, status,
+                      done.waiter[i].ref);
+}
+
+/* Submit request, or merge it with identical request in flight */
+int
+request_submit(int device, int bank, int buffer, request_send_func send,
+               request_done_cb cb, void *ref)
+{
+  return request_submit_wait(device, bank, buffer, send, cb, ref, 0);
+}
+
+/* Submit request, allowing wait_ms extra before the first timeout */
+int
+request_submit_wait(int device, int bank, int buffer, request_send_func send,
+                    request_done_cb cb, void *ref, int wait_ms)
+{
+  struct request *req = request_find(device, bank, buffer);
+  int i;
+
+  if (req) {
+    xprintf("Request %d:%d:%d already in flight\n", device, bank, buffer);
+    request_add_waiter(req, cb, ref);
+    return 0;
+  }
+
+  for (i = 0; i < REQUEST_MAX; i++)
+    if (!requests[i].in_use)
+      break;
+  if (i >= REQUEST_MAX) {
+    eprintf("Warning: too many requests in flight\n");
+    return -1;
+  }
+
+  req = &requests[i];
+  req->in_use = 1;
+  req->device = device;
+  req->bank = bank;
+  req->buffer = buffer;
+  req->send = send;
+  req->timeout = request_timeout;
+  req->deadline = timestamp_ms() + req->timeout + wait_ms;
+  req->retries_left = request_retries;
+  req->waiters = 0;
+  request_add_waiter(req, cb, ref);
+  requests_in_flight++;
+
+  send(device, bank, buffer);
+
+  return 1;
+}
+
+/* Reply arrived for request */
+int
+request_complete(int device, int bank, int buffer)
+{
+  struct request *req = request_find(device, bank, buffer);
+
+  if (!req) {
+    xprintf("Unsolicited reply %d:%d:%d\n", device, bank, buffer);
+    return -1;
+  }
+
+  request_finish(req, REQUEST_DONE);
+
+  return 0;
+}
+
+/* Check all requests in flight for timeouts; retry with doubled timeout,
+ * or give up when we've run out of retries. */
+void
+request_timer(void)
+{
+  long long now;
+  int i;
+
+  if (!requests_in_flight) return;
+
+  now = timestamp_ms();
+  for (i = 0; i < REQUEST_MAX; i++) {
+    struct request *req = &requests[i];
+
+    if (!req->in_use || now < req->deadline)
+      continue;
+
+    if (req->retries_left-- > 0) {
+      req->timeout *= 2;
+      req->deadline = now + req->timeout;
+      xprintf("Request %d:%d:%d timed out, retrying, timeout %d ms\n",
+              req->device, req->bank, req->buffer, req->timeout);
+      req->send(req->device, req->bank, req->buffer);
+    } else {
+      eprintf("Warning: no reply from synth for request %d:%d:%d\n",
+              req->device, req->bank, req->buffer);
+      request_finish(req, REQUEST_TIMEOUT);
+    }
+  }
+}
+
+/* Forget about all requests in flight */
+void
+request_cancel_all(void)
+{
+  int i;
+
+  for (i = 0; i < REQUEST_MAX; i++)
+    requests[i].in_use = 0;
+  requests_in_flight = 0;
+}
+
+/* Number of requests in flight */
+int
+request_in_flight(void)
+{
+  return requests_in_flight;
+}
+
+/* Set timeout and max retries */
+void
+request_set_timing(int timeout_ms, int retries)
+{
+  request_timeout = timeout_ms;
+  request_retries = retries;
+}
+
+/*********************** End of file request_tracker.c **********************/
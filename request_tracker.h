@@ -0,0 +1,81 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * request_tracker.h - Tracking of outstanding dump requests.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _REQUEST_TRACKER_H_
+#define _REQUEST_TRACKER_H_
+
+/* A request is identified by the device (sysex device number), bank and
+ * buffer it refers to. For synths which reply with their own device number
+ * to a request sent to the broadcast device number, the request can
+ * be submitted with REQUEST_ANY_DEVICE, matching replies from any device. */
+#define REQUEST_ANY_DEVICE -1
+
+/* Maximum number of requests in flight at any one time */
+#define REQUEST_MAX 64
+
+/* Status passed to completion callback */
+enum request_status { REQUEST_DONE = 0, REQUEST_TIMEOUT };
+
+/* Function that actually sends a request. Called when a request is first
+ * submitted, as well as for each retry. */
+typedef void (*request_send_func)(int device, int bank, int buffer);
+
+/* Callback called when a request has been answered, or has timed out
+ * after the final retry. */
+typedef void (*request_done_cb)(int device, int bank, int buffer,
+                                enum request_status status, void *ref);
+
+/* Submit request. If an identical request is already in flight, it is not
+ * sent again, but the callback is added to the existing request.
+ * Returns 1 if request sent, 0 if merged with request in flight,
+ * and -1 if request table full. */
+int request_submit(int device, int bank, int buffer, request_send_func send,
+                   request_done_cb cb, void *ref);
+
+/* As request_submit(), but the first timeout is extended by wait_ms, for
+ * requests which the device will only get around to answering after it
+ * has finished answering others that were submitted before. */
+int request_submit_wait(int device, int bank, int buffer,
+                        request_send_func send, request_done_cb cb, void *ref,
+                        int wait_ms);
+
+/* Tell tracker that a reply has arrived. Calls completion callbacks for the
+ * matching request, if any. Returns 0 if a matching request was found,
+ * else -1 (i.e. the reply was unsolicited). */
+int request_complete(int device, int bank, int buffer);
+
+/* Handle timeouts and retries. To be called periodically. */
+void request_timer(void);
+
+/* Cancel all requests in flight, without calling any callbacks. */
+void request_cancel_all(void);
+
+/* Number of requests currently in flight */
+int request_in_flight(void);
+
+/* Set initial timeout (in ms) and max number of retries. Each retry
+ * doubles the timeout. */
+void request_set_timing(int timeout_ms, int retries);
+
+#endif /* _REQUEST_TRACKER_H_ */
+
+/*********************** End of file request_tracker.h **********************/
@@ -0,0 +1,675 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * synth_def.c - Loading of synth definition files.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* A synth definition file is a line based text file describing the
+ * synth's parameters. Anything after a # is a comment, and names
+ * containing spaces are put within double quotes. The statements are:
+ *
+ *   synth NAME                       name of synth
+ *   device NAME                      default name of USB MIDI device
+ *   ui FILENAME                      glade file with UI definition
+ *   sysex MANUFACTURER MODEL         sysex ids
+ *   sound_params N                   # parameters in a sound dump
+ *   limits NAME MIN MAX [enumerated] named value range
+ *   param NAME [LIMITS]              ordinary parameter; no limits for
+ *                                    reserved and bitmap parent parameters
+ *   bitmap NAME LIMITS PARENT MASK SHIFT   bitfield in parent parameter
+ *   string NAME PARENT LENGTH        string, one parent per character
+ *   global NAME LIMITS OFFSET        global parameter, at OFFSET in global
+ *                                    dump
+ *
+ * Parameters are numbered in the order they appear, with the first
+ * sound_params parameters making up a sound dump.
+ *
+ * Parsing the file is turned into a single block consisting of a header,
+ * the parameter records, and the string data, which is also exactly what
+ * is stored in the cache file. The cache is tagged with a hash of the
+ * contents of the definition file, so it is rebuilt whenever the file
+ * changes, and a checksum of the compiled data, so a damaged cache file is
+ * not used. Cache files are named after a hash of the definition file's
+ * full path, so definitions with the same name in different directories
+ * get a cache file each. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "synth_def.h"
+
+#include "debug.h"
+
+#define CACHE_MAGIC "XTSD"
+#define CACHE_VERSION 3
+
+/* Max number of tokens on a line */
+#define MAX_TOKENS 8
+
+/* Header of compiled definition */
+struct compiled_header {
+  char magic[4];
+  int version;
+  unsigned long long hash; /* of definition file contents */
+  unsigned long long checksum; /* of everything following the header */
+  int size; /* total size of compiled definition, including header */
+  int name; /* string offsets */
+  int device;
+  int ui_filename;
+  int sysex_id;
+  int equipment_id;
+  int sound_params;
+  int params;
+  int strings; /* bytes of string data */
+};
+
+/* Parameter record in compiled definition */
+struct compiled_param {
+  int name; /* string offset */
+  int flags;
+  int min;
+  int max;
+  int parent;
+  int child;
+  int bitmask;
+  int bitshift;
+  int offset;
+};
+
+/* Named range, used during parsing */
+struct def_limits {
+  const char *name;
+  int min;
+  int max;
+  int enumerated;
+};
+
+/* Parsing state */
+struct parser {
+  const char *filename;
+  int line;
+  struct compiled_header header;
+  struct compiled_param *params;
+  int params_size;
+  const char **parent_names; /* per param, resolved when done */
+  int parent_names_size;
+  char *strings;
+  int strings_size;
+  struct def_limits *limits;
+  int nlimits;
+  int limits_size;
+};
+
+/* 64 bit FNV-1a hash */
+static unsigned long long
+hash_data(const unsigned char *data, int len)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+
+  while (len--) {
+    hash ^= *data++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* Read whole file into malloced buffer, with a terminating NUL.
+ * Returns NULL on error. */
+static char *
+read_file(const char *filename, int *len)
+{
+  FILE *f = fopen(filename, "r");
+  char *buf;
+  long size;
+
+  if (!f) return NULL;
+
+  if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) < 0) {
+    fclose(f);
+    return NULL;
+  }
+  buf = malloc(size + 1);
+  if (buf && fread(buf, 1, size, f) != size) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  if (!buf) return NULL;
+
+  buf[size] = '\0';
+  *len = size;
+  return buf;
+}
+
+/* Make sure *ptr has room for need elements of elem_size, growing it
+ * if needed. Returns 0 if ok, -1 if out of memory. */
+static int
+grow(void *ptr, int *size, int need, int elem_size)
+{
+  void **p = ptr;
+  int new_size = *size ? *size : 64;
+  void *new_ptr;
+
+  if (need <= *size) return 0;
+
+  while (new_size < need)
+    new_size *= 2;
+  new_ptr = realloc(*p, new_size * elem_size);
+  if (!new_ptr) return -1;
+  *p = new_ptr;
+  *size = new_size;
+  return 0;
+}
+
+/* Append string to string data, returning its offset, or -1 if out
+ * of memory. */
+static int
+add_string(struct parser *p, const char *s)
+{
+  int offset = p->header.strings;
+  int len = strlen(s) + 1;
+
+  if (grow(&p->strings, &p->strings_size, offset + len, 1) < 0)
+    return -1;
+  memcpy(&p->strings[offset], s, len);
+  p->header.strings += len;
+  return offset;
+}
+
+/* Split line into tokens, in place. Returns number of tokens. */
+static int
+tokenize(char *line, char **tokens)
+{
+  int count = 0;
+
+  while (*line) {
+    while (*line == ' ' || *line == '\t' || *line == '\r')
+      line++;
+    if (!*line || *line == '#') break;
+    if (count == MAX_TOKENS) return -1;
+    if (*line == '"') {
+      tokens[count++] = ++line;
+      while (*line && *line != '"')
+        line++;
+      if (!*line) return -1; /* unterminated string */
+    } else {
+      tokens[count++] = line;
+      while (*line && *line != ' ' && *line != '\t' && *line != '\r')
+        line++;
+      if (!*line) break;
+    }
+    *line++ = '\0';
+  }
+  return count;
+}
+
+/* Parse integer, returning 0 if ok, -1 on error */
+static int
+parse_int(const char *s, int *value)
+{
+  char *end;
+
+  *value = strtol(s, &end, 0);
+  return (*s && !*end) ? 0 : -1;
+}
+
+static const struct def_limits *
+find_limits(struct parser *p, const char *name)
+{
+  int i;
+
+  for (i = 0; i < p->nlimits; i++)
+    if (!strcmp(p->limits[i].name, name))
+      return &p->limits[i];
+  return NULL;
+}
+
+/* Add new parameter, returning NULL if out of memory */
+static struct compiled_param *
+add_param(struct parser *p, const char *name)
+{
+  struct compiled_param *param;
+  int n = p->header.params;
+
+  if (grow(&p->params, &p->params_size, n + 1, sizeof(*p->params)) < 0 ||
+      grow(&p->parent_names, &p->parent_names_size, n + 1,
+           sizeof(*p->parent_names)) < 0)
+    return NULL;
+
+  param = &p->params[n];
+  memset(param, 0, sizeof(*param));
+  param->name = add_string(p, name);
+  if (param->name < 0) return NULL;
+  param->parent = -1;
+  param->child = -1;
+  p->parent_names[n] = NULL;
+  p->header.params++;
+  return param;
+}
+
+/* Fill in limits of parameter, returning 0 if ok, -1 if unknown */
+static int
+set_limits(struct parser *p, struct compiled_param *param, const char *name)
+{
+  const struct def_limits *limits = find_limits(p, name);
+
+  if (!limits) return -1;
+
+  param->flags |= SYNTH_DEF_LIMITS;
+  if (limits->enumerated)
+    param->flags |= SYNTH_DEF_ENUMERATED;
+  param->min = limits->min;
+  param->max = limits->max;
+  return 0;
+}
+
+/* Parse a single line. Returns 0 if ok, else -1. */
+static int
+parse_line(struct parser *p, char *line)
+{
+  char *tok[MAX_TOKENS];
+  int count = tokenize(line, tok);
+  struct compiled_header *h = &p->header;
+  struct compiled_param *param;
+
+  if (count <= 0) return count;
+
+  if (!strcmp(tok[0], "synth") && count == 2)
+    return (h->name = add_string(p, tok[1])) < 0 ? -1 : 0;
+
+  if (!strcmp(tok[0], "device") && count == 2)
+    return (h->device = add_string(p, tok[1])) < 0 ? -1 : 0;
+
+  if (!strcmp(tok[0], "ui") && count == 2)
+    return (h->ui_filename = add_string(p, tok[1])) < 0 ? -1 : 0;
+
+  if (!strcmp(tok[0], "sysex") && count == 3)
+    return parse_int(tok[1], &h->sysex_id) ||
+           parse_int(tok[2], &h->equipment_id) ? -1 : 0;
+
+  if (!strcmp(tok[0], "sound_params") && count == 2)
+    return parse_int(tok[1], &h->sound_params);
+
+  if (!strcmp(tok[0], "limits") && (count == 4 || count == 5)) {
+    struct def_limits *limits;
+
+    if (count == 5 && strcmp(tok[4], "enumerated")) return -1;
+    if (grow(&p->limits, &p->limits_size, p->nlimits + 1,
+             sizeof(*p->limits)) < 0)
+      return -1;
+    limits = &p->limits[p->nlimits];
+    limits->name = tok[1];
+    limits->enumerated = (count == 5);
+    if (parse_int(tok[2], &limits->min) || parse_int(tok[3], &limits->max))
+      return -1;
+    p->nlimits++;
+    return 0;
+  }
+
+  if (!strcmp(tok[0], "param") && (count == 2 || count == 3)) {
+    if (!(param = add_param(p, tok[1]))) return -1;
+    return count == 3 ? set_limits(p, param, tok[2]) : 0;
+  }
+
+  if (!strcmp(tok[0], "bitmap") && count == 6) {
+    if (!(param = add_param(p, tok[1]))) return -1;
+    param->flags |= SYNTH_DEF_BITMAP;
+    p->parent_names[h->params - 1] = tok[3];
+    /* A zero bitmask is reserved for string parameters */
+    return set_limits(p, param, tok[2]) ||
+           parse_int(tok[4], &param->bitmask) || !param->bitmask ||
+           parse_int(tok[5], &param->bitshift) ? -1 : 0;
+  }
+
+  if (!strcmp(tok[0], "string") && count == 4) {
+    if (!(param = add_param(p, tok[1]))) return -1;
+    param->flags |= SYNTH_DEF_STRING;
+    p->parent_names[h->params - 1] = tok[2];
+    return parse_int(tok[3], &param->bitshift);
+  }
+
+  if (!strcmp(tok[0], "global") && count == 4) {
+    if (!(param = add_param(p, tok[1]))) return -1;
+    param->flags |= SYNTH_DEF_GLOBAL;
+    return set_limits(p, param, tok[2]) ||
+           parse_int(tok[3], &param->offset) || param->offset < 0 ? -1 : 0;
+  }
+
+  return -1;
+}
+
+/* Resolve parent names into indexes, and fill in first child of each
+ * parent. Children of the same parent are assumed to follow each other.
+ * Returns 0 if ok, -1 if a parent can't be found. */
+static int
+link_params(struct parser *p)
+{
+  struct compiled_param *params = p->params;
+  int idx, parent;
+
+  for (idx = 0; idx < p->header.params; idx++) {
+    const char *parent_name = p->parent_names[idx];
+    int parents;
+
+    if (!parent_name) continue;
+
+    for (parent = 0; parent < p->header.params; parent++)
+      if (!strcmp(&p->strings[params[parent].name], parent_name))
+        break;
+    /* String params need one parent per character */
+    parents = (params[idx].flags & SYNTH_DEF_STRING) ?
+              params[idx].bitshift : 1;
+    if (parent + parents > p->header.params) {
+      eprintf("%s: Invalid parent %s for %s\n", p->filename, parent_name,
+              &p->strings[params[idx].name]);
+      return -1;
+    }
+    params[idx].parent = parent;
+    while (parents--) {
+      if (params[parent].child < 0)
+        params[parent].child = idx;
+      parent++;
+    }
+  }
+  return 0;
+}
+
+/* Parse definition file contents, returning compiled definition in
+ * a single malloced block, or NULL on error. */
+static void *
+parse(const char *filename, char *text, unsigned long long hash)
+{
+  struct parser p;
+  char *line, *next;
+  int params_bytes, idx;
+  char *block = NULL;
+
+  memset(&p, 0, sizeof(p));
+  p.filename = filename;
+  p.header.name = p.header.device = p.header.ui_filename = -1;
+
+  for (line = text; line; line = next) {
+    next = strchr(line, '\n');
+    if (next) *next++ = '\0';
+    p.line++;
+    if (parse_line(&p, line) < 0) {
+      eprintf("%s:%d: Invalid definition\n", filename, p.line);
+      goto out;
+    }
+  }
+
+  if (p.header.name < 0 || p.header.ui_filename < 0 ||
+      p.header.sound_params <= 0 ||
+      p.header.params < p.header.sound_params) {
+    eprintf("%s: Incomplete definition\n", filename);
+    goto out;
+  }
+  if (p.header.device < 0)
+    p.header.device = p.header.name;
+
+  for (idx = 0; idx < p.header.sound_params; idx++)
+    if (p.params[idx].flags & SYNTH_DEF_GLOBAL) {
+      eprintf("%s: Global parameter %s among sound parameters\n", filename,
+              &p.strings[p.params[idx].name]);
+      goto out;
+    }
+
+  if (link_params(&p) < 0) goto out;
+
+  memcpy(p.header.magic, CACHE_MAGIC, sizeof(p.header.magic));
+  p.header.version = CACHE_VERSION;
+  p.header.hash = hash;
+  params_bytes = p.header.params * sizeof(struct compiled_param);
+  p.header.size = sizeof(p.header) + params_bytes + p.header.strings;
+
+  block = malloc(p.header.size);
+  if (block) {
+    memcpy(block + sizeof(p.header), p.params, params_bytes);
+    memcpy(block + sizeof(p.header) + params_bytes, p.strings,
+           p.header.strings);
+    p.header.checksum =
+      hash_data((unsigned char *) block + sizeof(p.header),
+                p.header.size - sizeof(p.header));
+    memcpy(block, &p.header, sizeof(p.header));
+  }
+
+out:
+  free(p.params);
+  free(p.parent_names);
+  free(p.strings);
+  free(p.limits);
+  return block;
+}
+
+/* Check that compiled definition of len bytes is sane, intact, and
+ * matches hash */
+static int
+check_compiled(const void *block, int len, unsigned long long hash)
+{
+  const struct compiled_header *h = block;
+  const char *strings;
+
+  if (len < sizeof(*h) ||
+      memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) ||
+      h->version != CACHE_VERSION || h->hash != hash || h->size != len ||
+      h->params < 0 || h->strings <= 0 ||
+      sizeof(*h) + h->params * sizeof(struct compiled_param) + h->strings !=
+        len)
+    return -1;
+  if (hash_data((const unsigned char *) block + sizeof(*h),
+                len - sizeof(*h)) != h->checksum)
+    return -1;
+
+  /* All string offsets are checked when the definition is set up, so
+   * it is enough that the string data ends with a NUL. */
+  strings = (const char *) block + len - h->strings;
+  return strings[h->strings - 1] == '\0' ? 0 : -1;
+}
+
+/* Fill in definition from compiled block, which def takes ownership of.
+ * Returns 0 if ok, -1 on error. */
+static int
+setup_def(struct synth_def *def, void *block)
+{
+  const struct compiled_header *h = block;
+  const struct compiled_param *cparams =
+    (const struct compiled_param *) ((char *) block + sizeof(*h));
+  const char *strings = (const char *) &cparams[h->params];
+  int idx;
+
+#define STRING_OK(offset) ((offset) >= 0 && (offset) < h->strings)
+#define INDEX_OK(index) ((index) >= -1 && (index) < h->params)
+/* Bitmap and string params must have (all their) parents, as when
+ * linking them in link_params() */
+#define PARENT_OK(cparam) \
+  (!((cparam)->flags & (SYNTH_DEF_BITMAP | SYNTH_DEF_STRING)) || \
+   ((cparam)->parent >= 0 && \
+    (cparam)->parent + (((cparam)->flags & SYNTH_DEF_STRING) ? \
+                        (cparam)->bitshift : 1) <= h->params))
+
+  if (!STRING_OK(h->name) || !STRING_OK(h->device) ||
+      !STRING_OK(h->ui_filename))
+    return -1;
+
+  def->param = malloc(h->params * sizeof(*def->param));
+  if (!def->param) return -1;
+
+  for (idx = 0; idx < h->params; idx++) {
+    const struct compiled_param *cparam = &cparams[idx];
+    struct synth_def_param *param = &def->param[idx];
+
+    if (!STRING_OK(cparam->name) || !INDEX_OK(cparam->parent) ||
+        !INDEX_OK(cparam->child) || !PARENT_OK(cparam)) {
+      free(def->param);
+      return -1;
+    }
+    param->name = &strings[cparam->name];
+    param->flags = cparam->flags;
+    param->min = cparam->min;
+    param->max = cparam->max;
+    param->parent = cparam->parent;
+    param->child = cparam->child;
+    param->bitmask = cparam->bitmask;
+    param->bitshift = cparam->bitshift;
+    param->offset = cparam->offset;
+  }
+
+  def->name = &strings[h->name];
+  def->device = &strings[h->device];
+  def->ui_filename = &strings[h->ui_filename];
+  def->sysex_id = h->sysex_id;
+  def->equipment_id = h->equipment_id;
+  def->sound_params = h->sound_params;
+  def->params = h->params;
+  def->storage = block;
+  return 0;
+}
+
+/* Build name of cache file for definition file, from its base name and
+ * a hash of its full path. Returns 0 if ok. */
+static int
+cache_filename(char *buf, int size, const char *cache_dir,
+               const char *filename)
+{
+  char *path = realpath(filename, NULL);
+  const char *full = path ? path : filename;
+  const char *base = strrchr(filename, '/');
+  unsigned long long path_hash;
+
+  path_hash = hash_data((const unsigned char *) full, strlen(full));
+  free(path);
+  base = base ? base + 1 : filename;
+  return snprintf(buf, size, "%s/%s-%016llx.cache", cache_dir, base,
+                  path_hash) < size ? 0 : -1;
+}
+
+/* Create directory, including any missing parent directories.
+ * Returns 0 if ok, -1 on error. */
+static int
+make_dirs(const char *dir)
+{
+  char path[256];
+  char *p;
+
+  if (snprintf(path, sizeof(path), "%s", dir) >= sizeof(path))
+    return -1;
+
+  for (p = path + 1; *p; p++) {
+    if (*p != '/') continue;
+    *p = '\0';
+    if (mkdir(path, 0755) < 0 && errno != EEXIST)
+      return -1;
+    *p = '/';
+  }
+  return (mkdir(path, 0755) < 0 && errno != EEXIST) ? -1 : 0;
+}
+
+/* Write compiled definition to cache. We write to a temporary file first,
+ * so that a concurrently starting instance never sees a partial file. */
+static void
+write_cache(const char *cache_file, const char *cache_dir, const void *block)
+{
+  const struct compiled_header *h = block;
+  char tmp_file[256];
+  FILE *f;
+  int ok;
+
+  if (make_dirs(cache_dir) < 0) {
+    xprintf("Can't create cache directory %s\n", cache_dir);
+    return;
+  }
+
+  if (snprintf(tmp_file, sizeof(tmp_file), "%s.%d", cache_file, getpid()) >=
+      sizeof(tmp_file))
+    return;
+
+  f = fopen(tmp_file, "w");
+  if (!f) return;
+  ok = fwrite(block, 1, h->size, f) == h->size;
+  ok = (fclose(f) == 0) && ok;
+
+  if (!ok || rename(tmp_file, cache_file) < 0) {
+    xprintf("Can't write cache file %s\n", cache_file);
+    unlink(tmp_file);
+  }
+}
+
+/* Load synth definition, using cache if it is up to date */
+int
+synth_def_load(struct synth_def *def, const char *filename,
+               const char *cache_dir)
+{
+  char cache_file[256];
+  char *text, *block;
+  int len, block_len;
+  unsigned long long hash;
+  int use_cache;
+
+  memset(def, 0, sizeof(*def));
+
+  text = read_file(filename, &len);
+  if (!text) {
+    xprintf("Can't read synth definition %s\n", filename);
+    return -1;
+  }
+  hash = hash_data((unsigned char *) text, len);
+
+  use_cache = cache_dir &&
+              !cache_filename(cache_file, sizeof(cache_file), cache_dir,
+                              filename);
+  if (use_cache) {
+    block = read_file(cache_file, &block_len);
+    if (block && !check_compiled(block, block_len, hash) &&
+        !setup_def(def, block)) {
+      xprintf("Loaded synth definition %s from cache\n", filename);
+      free(text);
+      return 0;
+    }
+    free(block);
+  }
+
+  block = parse(filename, text, hash);
+  free(text);
+  if (!block) return -1;
+
+  if (setup_def(def, block) < 0) {
+    free(block);
+    return -1;
+  }
+  if (use_cache)
+    write_cache(cache_file, cache_dir, block);
+
+  xprintf("Loaded synth definition %s\n", filename);
+  return 0;
+}
+
+/* Free storage associated with a loaded definition */
+void
+synth_def_free(struct synth_def *def)
+{
+  free(def->param);
+  free(def->storage);
+  memset(def, 0, sizeof(*def));
+}
+
+/************************** End of file synth_def.c *************************/
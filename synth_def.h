@@ -0,0 +1,71 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * synth_def.h - Loading of synth definition files.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _SYNTH_DEF_H_
+#define _SYNTH_DEF_H_
+
+/* Parameter flags */
+#define SYNTH_DEF_LIMITS     0x01 /* min and max are valid */
+#define SYNTH_DEF_ENUMERATED 0x02 /* values are choices rather than amounts */
+#define SYNTH_DEF_BITMAP     0x04 /* bitfield in parent parameter */
+#define SYNTH_DEF_STRING     0x08 /* string spanning several parents */
+#define SYNTH_DEF_GLOBAL     0x10 /* global (not sound) parameter */
+
+/* A parameter, as defined in the definition file */
+struct synth_def_param {
+  const char *name;
+  int flags;
+  int min;
+  int max;
+  int parent; /* bitmap/string params: index of (first) parent, else -1 */
+  int child; /* index of first child, -1 if none */
+  int bitmask; /* bitmap params: field in parent */
+  int bitshift; /* bitmap params: shift of field; string params: length */
+  int offset; /* global params: offset in global dump */
+};
+
+/* A loaded synth definition */
+struct synth_def {
+  const char *name; /* name of synth, for window title etc */
+  const char *device; /* default name of USB MIDI device */
+  const char *ui_filename; /* name of glade file with UI definition */
+  int sysex_id; /* manufacturer id */
+  int equipment_id; /* model id */
+  int sound_params; /* # parameters in a sound dump */
+  int params; /* # parameters, including bitmapped ones */
+  struct synth_def_param *param;
+  void *storage; /* strings etc, owned by the definition */
+};
+
+/* Load synth definition from filename. If cache_dir is not NULL, a
+ * precompiled copy of the definition is kept there, and used instead of
+ * parsing the file as long as the file contents are unchanged.
+ * Returns 0 if ok, -1 on error. */
+int synth_def_load(struct synth_def *def, const char *filename,
+                   const char *cache_dir);
+
+/* Free storage associated with a loaded definition */
+void synth_def_free(struct synth_def *def);
+
+#endif /* _SYNTH_DEF_H_ */
+
+/************************** End of file synth_def.h *************************/
@@ -0,0 +1,170 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * syx_file.c - Scanning of sysex files without reading them into memory.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+/* Sysex files may contain anything from a single sound dump to several
+ * whole banks. Rather than reading them, they are mapped into memory and
+ * the messages located where they are, so that even a file with a
+ * thousand sounds is indexed in about a millisecond, with the
+ * pages actually touched being read in by the kernel as needed. */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "syx_file.h"
+
+#define SYSEX 0xf0
+#define EOX 0xf7
+
+/* Map sysex file into memory */
+int
+syx_file_open(struct syx_file *file, const char *filename)
+{
+  struct stat st;
+  void *data;
+  int fd, err;
+
+  file->data = NULL;
+  file->size = 0;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0)
+    goto error;
+  if (st.st_size == 0) { /* nothing to map, but not an error */
+    close(fd);
+    return 0;
+  }
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    goto error;
+  /* We go through the file from start to end */
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  close(fd); /* the mapping stays */
+
+  file->data = data;
+  file->size = st.st_size;
+  return 0;
+
+error:
+  err = errno;
+  close(fd);
+  errno = err;
+  return -1;
+}
+
+/* Unmap sysex file */
+void
+syx_file_close(struct syx_file *file)
+{
+  if (file->data)
+    munmap((void *) file->data, file->size);
+  file->data = NULL;
+  file->size = 0;
+}
+
+/* Find next complete sysex message in file */
+int
+syx_file_next(const struct syx_file *file, size_t *pos,
+              const unsigned char **msg, size_t *len)
+{
+  const unsigned char *data = file->data;
+  const unsigned char *end = data + file->size;
+  const unsigned char *start, *p;
+
+  if (!data || *pos >= file->size)
+    return 0;
+
+  start = memchr(data + *pos, SYSEX, file->size - *pos);
+  while (start) {
+    for (p = start + 1; p < end && !(*p & 0x80); p++)
+      ;
+    if (p >= end)
+      break; /* last message cut short */
+    if (*p == EOX) {
+      *msg = start;
+      *len = p - start + 1;
+      *pos = p - data + 1;
+      return 1;
+    }
+    /* Another status byte before EOX; start over from it */
+    start = *p == SYSEX ? p : memchr(p, SYSEX, end - p);
+  }
+  *pos = file->size;
+  return 0;
+}
+
+/* Write sysex file. The data is written to a temporary file in the same
+ * directory, which is then renamed to filename, so that the file is
+ * either completely written or not changed at all, even if we crash or
+ * the disk fills up half way through. */
+int
+syx_file_write(const char *filename, const void *data, size_t size)
+{
+  const char *p = data;
+  char *tmpname;
+  int fd, res, err;
+
+  tmpname = malloc(strlen(filename) + 32);
+  if (!tmpname)
+    return -1;
+  sprintf(tmpname, "%s.tmp%d", filename, (int) getpid());
+  fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    goto error;
+  /* Normally all in one go, but writes may be cut short */
+  while (size > 0) {
+    ssize_t len = write(fd, p, size);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len < 0)
+      goto error;
+    p += len;
+    size -= len;
+  }
+  /* Make sure the data is on disk before it replaces the old file */
+  if (fsync(fd) < 0)
+    goto error;
+  res = close(fd);
+  fd = -1;
+  if (res < 0 || rename(tmpname, filename) < 0)
+    goto error;
+  free(tmpname);
+  return 0;
+
+error:
+  err = errno;
+  if (fd >= 0)
+    close(fd);
+  unlink(tmpname);
+  free(tmpname);
+  errno = err;
+  return -1;
+}
+
+/************************** End of file syx_file.c **************************/
@@ -0,0 +1,56 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * syx_file.h - Scanning of sysex files without reading them into memory.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _SYX_FILE_H_
+#define _SYX_FILE_H_
+
+#include <stddef.h>
+
+/* Sysex file, mapped into memory */
+struct syx_file {
+  const unsigned char *data;
+  size_t size;
+};
+
+/* Map sysex file into memory. Returns 0 if ok, -1 if the file could not be
+ * opened or mapped, with errno set. */
+int syx_file_open(struct syx_file *file, const char *filename);
+
+/* Unmap sysex file */
+void syx_file_close(struct syx_file *file);
+
+/* Find the next complete sysex message (F0 ... F7) starting at or after
+ * *pos, returning 1 with *msg and *len describing it and *pos advanced
+ * past it, or 0 when there are no more messages. The message is not
+ * copied; *msg points into the file's memory. Bytes outside messages,
+ * and messages cut short by another status byte, are skipped. */
+int syx_file_next(const struct syx_file *file, size_t *pos,
+                  const unsigned char **msg, size_t *len);
+
+/* Write size bytes of data to sysex file, replacing it atomically if it
+ * exists. Returns 0 if ok, -1 if the file could not be written, with
+ * errno set, in which case any existing file is left as it was. */
+int syx_file_write(const char *filename, const void *data, size_t size);
+
+#endif /* _SYX_FILE_H_ */
+
+/************************** End of file syx_file.h **************************/
@@ -0,0 +1,175 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_sysex_test.c - Test of Blofeld sysex reception.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+/* Feeds sysex messages to the Blofeld code the way the MIDI handler does,
+ * including capping them at the length registered by the receiver, and
+ * checks that they are handled. The MIDI layer is stubbed out, so no
+ * MIDI device is needed. Run from the source directory, as the
+ * synth definition is loaded from there. */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "param.h"
+#include "blofeld_params.h"
+#include "request_tracker.h"
+#include "timestamp.h"
+#include "journal.h"
+#include "midi_stub.h"
+
+#define MULD_LEN 425 /* SDATA + 416 data bytes + checksum + EOX */
+#define SNDD_LEN 392 /* SDATA + 383 data bytes + checksum + EOX */
+
+static int failures = 0;
+
+static void
+check(int ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+/* Build multi dump with given name, all other data zero */
+static void
+make_muld(unsigned char *buf, int len, const char *name)
+{
+  int i, csum = 0;
+
+  memset(buf, 0, len);
+  buf[0] = SYSEX;
+  buf[1] = 0x3e; /* Waldorf */
+  buf[2] = 0x13; /* Blofeld */
+  buf[3] = 0; /* device number */
+  buf[4] = 0x11; /* MULD */
+  buf[5] = 0x7f; /* multi edit buffer */
+  buf[6] = 0;
+  memcpy(&buf[7], name, strlen(name));
+  for (i = 7; i < len - 2; i++)
+    csum += buf[i];
+  buf[len - 2] = csum & 0x7f;
+  buf[len - 1] = EOX;
+}
+
+/* Build sound dump with all parameters set to value */
+static void
+make_sndd(unsigned char *buf, int value)
+{
+  int i, csum = 0;
+
+  buf[0] = SYSEX;
+  buf[1] = 0x3e; /* Waldorf */
+  buf[2] = 0x13; /* Blofeld */
+  buf[3] = 0; /* device number */
+  buf[4] = 0x10; /* SNDD */
+  buf[5] = 0x7f; /* sound edit buffer */
+  buf[6] = 0;
+  for (i = 7; i < SNDD_LEN - 2; i++) {
+    buf[i] = value;
+    csum += value;
+  }
+  buf[SNDD_LEN - 2] = csum & 0x7f;
+  buf[SNDD_LEN - 1] = EOX;
+}
+
+/* Count sound requests sent, as midi_stub_sent */
+static int sndr_sent;
+
+static void
+count_sndr(const unsigned char *buf, int len)
+{
+  if (len > 4 && buf[4] == 0x00) /* SNDR */
+    sndr_sent++;
+}
+
+static enum request_status multi_status;
+static int multi_done = 0;
+
+static void
+multi_request_done(int device, int bank, int buffer,
+                   enum request_status status, void *ref)
+{
+  multi_status = status;
+  multi_done++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct param_handler param_handler = { 0 };
+  unsigned char muld[MULD_LEN + 1];
+  unsigned char sndd[SNDD_LEN];
+  const struct blofeld_multi *multi;
+  long long started;
+
+  param_handler.def_filename = "./blofeld.def";
+  if (blofeld_init(&param_handler) < 0) {
+    printf("FAIL: could not load synth definition\n");
+    return 1;
+  }
+  param_handler.param_midi_init(&param_handler);
+  check(midi_stub_receiver != NULL, "sysex receiver registered");
+  check(midi_stub_max_len > MULD_LEN, "room for complete multi dump");
+
+  blofeld_get_multi(0, multi_request_done, NULL);
+  make_muld(muld, MULD_LEN, "Test Multi");
+  midi_stub_receive(muld, MULD_LEN);
+  multi = blofeld_get_multi_config();
+  check(multi->valid, "multi dump accepted");
+  check(!strncmp(multi->name, "Test Multi", 10), "multi name received");
+  check(multi_done == 1 && multi_status == REQUEST_DONE,
+        "multi request completed");
+
+  /* The multi dump triggers a request for each part. None are answered,
+   * but as the synth answers them one at a time, only the first couple
+   * should have timed out and been sent again after 700 ms. */
+  sndr_sent = 0;
+  midi_stub_sent = count_sndr;
+  started = timestamp_ms();
+  while (timestamp_ms() - started < 700) {
+    usleep(10000);
+    param_handler.param_timer();
+  }
+  check(sndr_sent <= 2, "queued part requests not resent");
+  midi_stub_sent = NULL;
+  request_cancel_all();
+
+  /* One byte too many must not be truncated into a valid dump */
+  make_muld(muld, MULD_LEN + 1, "Long Multi");
+  midi_stub_receive(muld, MULD_LEN + 1);
+  multi = blofeld_get_multi_config();
+  check(!strncmp(multi->name, "Test Multi", 10), "overlong multi rejected");
+
+  /* A file with a bad checksum is not loaded, so there's nothing to undo */
+  make_sndd(sndd, 64);
+  check(blofeld_file_sysex(sndd, SNDD_LEN, 1) == 0, "sound file loaded");
+  journal_clear();
+  make_sndd(sndd, 65);
+  sndd[SNDD_LEN - 2] ^= 1;
+  check(blofeld_file_sysex(sndd, SNDD_LEN, 1) < 0, "corrupt file rejected");
+  check(blofeld_undo(0) == 0, "corrupt file not journaled");
+
+  return failures ? 1 : 0;
+}
+
+/********************* End of file blofeld_sysex_test.c *********************/
@@ -0,0 +1,121 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * blofeld_wave_test.c - Test of WAV file reading for wavetables.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+/* Writes WAV files with various headers and checks that the wavetable
+ * upload accepts the good ones and rejects the bad ones, without reading
+ * outside its buffers in the process. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "blofeld_wave.h"
+#include "midi_stub.h"
+
+static int failures = 0;
+
+static void
+check(int ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+/* Write little endian numbers */
+static void
+put16(FILE *f, unsigned int v)
+{
+  fputc(v & 0xff, f);
+  fputc(v >> 8, f);
+}
+
+static void
+put32(FILE *f, unsigned long v)
+{
+  put16(f, v & 0xffff);
+  put16(f, v >> 16);
+}
+
+/* Write PCM WAV file with given number of channels and bits, and data_len
+ * bytes of (silent) data */
+static void
+write_wav(const char *filename, int channels, int bits, unsigned long data_len)
+{
+  FILE *f = fopen(filename, "wb");
+  unsigned long i;
+
+  if (!f) {
+    perror(filename);
+    exit(1);
+  }
+  fwrite("RIFF", 1, 4, f);
+  put32(f, 4 + 8 + 16 + 8 + data_len);
+  fwrite("WAVE", 1, 4, f);
+  fwrite("fmt ", 1, 4, f);
+  put32(f, 16);
+  put16(f, 1); /* PCM */
+  put16(f, channels);
+  put32(f, 44100);
+  put32(f, 44100UL * channels * bits / 8);
+  put16(f, channels * bits / 8);
+  put16(f, bits);
+  fwrite("data", 1, 4, f);
+  put32(f, data_len);
+  for (i = 0; i < data_len; i++)
+    fputc(0, f);
+  fclose(f);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char filename[] = "/tmp/xtor_wave_test_XXXXXX";
+  int fd = mkstemp(filename);
+
+  if (fd < 0) {
+    perror(filename);
+    return 1;
+  }
+  close(fd);
+
+  write_wav(filename, 2, 16, 2048 * 4);
+  check(blofeld_wave_upload(filename, 0, 0, 0, NULL, NULL) == 0,
+        "stereo 16 bit file accepted");
+  blofeld_wave_cancel();
+
+  /* 65535 channels of 32 bits make frames far larger than the buffer
+   * they are read into */
+  write_wav(filename, 65535, 32, 65535 * 4 * 2);
+  check(blofeld_wave_upload(filename, 0, 0, 0, NULL, NULL) < 0,
+        "file with 65535 channels rejected");
+
+  write_wav(filename, 0, 16, 2048 * 2);
+  check(blofeld_wave_upload(filename, 0, 0, 0, NULL, NULL) < 0,
+        "file with no channels rejected");
+
+  unlink(filename);
+  return failures ? 1 : 0;
+}
+
+/********************** End of file blofeld_wave_test.c *********************/
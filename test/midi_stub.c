@@ -0,0 +1,112 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * midi_stub.c - Stand-in for the MIDI layer, for tests.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+/* Implements the MIDI interface in midi.h without any MIDI device, so
+ * that the synth specific code can be tested on its own. Nothing is
+ * sent anywhere; incoming messages are fed in with midi_stub_receive(). */
+
+#include <stdio.h>
+#include "midi_stub.h"
+
+midi_sysex_receiver midi_stub_receiver;
+int midi_stub_max_len;
+void (*midi_stub_sent)(const unsigned char *buf, int len);
+
+int
+midi_send_sysex(int port, void *buf, int buflen)
+{
+  if (midi_stub_sent)
+    midi_stub_sent(buf, buflen);
+  return 0;
+}
+
+int
+midi_queue_sysex(int port, const void *buf, int buflen)
+{
+  return 0;
+}
+
+int
+midi_queue_pending(int port)
+{
+  return 0;
+}
+
+void
+midi_set_pace(int port, int bytes_per_sec)
+{
+}
+
+int
+midi_sched_start(int percent)
+{
+  return 0;
+}
+
+void
+midi_sched_stop(void)
+{
+}
+
+void
+midi_sched_tempo(int percent)
+{
+}
+
+unsigned int
+midi_sched_time(void)
+{
+  return 0;
+}
+
+int
+midi_sched_sysex(int port, void *buf, int buflen, unsigned int tick)
+{
+  return 0;
+}
+
+int
+midi_connect(int port, const char *remote_device)
+{
+  return 0;
+}
+
+void
+midi_register_sysex(int port, int sysex_id, midi_sysex_receiver receiver,
+                    int max_len)
+{
+  if (port != SYNTH_PORT) return;
+  midi_stub_receiver = receiver;
+  midi_stub_max_len = max_len;
+}
+
+void
+midi_stub_receive(void *buf, int len)
+{
+  if (!midi_stub_receiver) return;
+  if (len > midi_stub_max_len)
+    len = midi_stub_max_len;
+  midi_stub_receiver(buf, len);
+}
+
+/************************** End of file midi_stub.c *************************/
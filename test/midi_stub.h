@@ -0,0 +1,42 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * midi_stub.h - Stand-in for the MIDI layer, for tests.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+#ifndef _MIDI_STUB_H_
+#define _MIDI_STUB_H_
+
+#include "midi.h"
+
+/* Sysex receiver and max length registered for the synth port */
+extern midi_sysex_receiver midi_stub_receiver;
+extern int midi_stub_max_len;
+
+/* If set, called for each sysex message sent */
+extern void (*midi_stub_sent)(const unsigned char *buf, int len);
+
+/* Deliver sysex message to the registered receiver, truncated to the
+ * registered max length the way midi_input() does. */
+void midi_stub_receive(void *buf, int len);
+
+#endif /* _MIDI_STUB_H_ */
+
+/************************** End of file midi_stub.h *************************/
@@ -0,0 +1,32 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * timestamp.h - Monotonic time stamps for timeouts and rate measurements.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+#ifndef _TIMESTAMP_H_
+#define _TIMESTAMP_H_
+
+/* Return current time in milliseconds. The time base is arbitrary (but
+ * never jumps), so only differences between time stamps are meaningful. */
+long long timestamp_ms(void);
+
+#endif /* _TIMESTAMP_H_ */
+
+/************************** End of file timestamp.h *************************/
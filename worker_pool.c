@@ -0,0 +1,416 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * worker_pool.c - Pool of worker threads for long running jobs.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+/* Jobs such as indexing thousands of sound files would make the UI
+ * unresponsive, and MIDI go unhandled, if they were run in the main
+ * thread. Instead, they are run by a small pool of worker threads.
+ *
+ * Each worker has its own queue (a deque) of jobs. Jobs are handed out
+ * to the queues in turn as they are submitted. A worker takes jobs from
+ * the back of its own queue; when it is empty, it steals jobs from the
+ * front of the other workers' queues, so that no worker sits idle while
+ * another one has a backlog of slow jobs. The number of jobs queued in
+ * total is kept separately, so idle workers can sleep until there is
+ * something to do.
+ *
+ * When a job is done, it is put on a list of finished jobs, which is
+ * handed over to the main thread using an idle callback. The job's done
+ * function and the progress callback of its group are called from there,
+ * so the result of a job can be taken care of without any locking.
+ *
+ * Canceling a group of jobs just bumps the group's serial number; jobs
+ * submitted before that are skipped rather than run when a worker gets
+ * to them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "worker_pool.h"
+
+#include "debug.h"
+
+/* Initial size of each worker's queue */
+#define QUEUE_SIZE 64
+
+struct worker_job {
+  struct worker_job *next; /* in list of finished jobs */
+  struct worker_group *group;
+  int serial; /* group serial when submitted */
+  int canceled;
+  worker_func work;
+  worker_done_func done;
+  void *data;
+};
+
+struct worker_group {
+  struct worker_group *next;
+  int serial; /* bumped when canceled; accessed atomically */
+  int outstanding; /* # jobs whose done function has not been called */
+  int report; /* progress has changed */
+  int freed; /* free when no jobs are outstanding */
+  struct worker_progress progress;
+  worker_progress_cb cb;
+  void *ref;
+};
+
+/* Worker thread, with its queue of jobs */
+struct worker {
+  GThread *thread;
+  GMutex lock; /* for queue */
+  struct worker_job **jobs; /* ring buffer */
+  int size, first, count;
+};
+
+static struct {
+  struct worker workers[WORKER_THREADS_MAX];
+  int threads;
+  int next; /* worker to give next job to */
+  /* Waiting for jobs */
+  GMutex lock;
+  GCond cond;
+  int queued; /* # jobs in queues not yet claimed by a worker */
+  int stop;
+  /* Finished jobs, waiting to be handed to the main thread */
+  GMutex done_lock;
+  struct worker_job *done_first, *done_last;
+  int idle_added;
+  /* Main thread only */
+  struct worker_group *groups;
+} pool;
+
+/* Add job to back of worker's queue. Returns -1 if out of memory. */
+static int
+queue_push(struct worker *worker, struct worker_job *job)
+{
+  if (worker->count == worker->size) {
+    int new_size = worker->size ? worker->size * 2 : QUEUE_SIZE;
+    struct worker_job **jobs = malloc(new_size * sizeof(*jobs));
+    int i;
+
+    if (!jobs)
+      return -1;
+    for (i = 0; i < worker->count; i++)
+      jobs[i] = worker->jobs[(worker->first + i) % worker->size];
+    free(worker->jobs);
+    worker->jobs = jobs;
+    worker->size = new_size;
+    worker->first = 0;
+  }
+  worker->jobs[(worker->first + worker->count++) % worker->size] = job;
+  return 0;
+}
+
+/* Take job from back (own == 1) or front (own == 0) of worker's queue.
+ * Returns NULL if there are no jobs. */
+static struct worker_job *
+queue_take(struct worker *worker, int own)
+{
+  struct worker_job *job = NULL;
+
+  g_mutex_lock(&worker->lock);
+  if (worker->count && own)
+    job = worker->jobs[(worker->first + --worker->count) % worker->size];
+  else if (worker->count) {
+    job = worker->jobs[worker->first];
+    worker->first = (worker->first + 1) % worker->size;
+    worker->count--;
+  }
+  g_mutex_unlock(&worker->lock);
+  return job;
+}
+
+/* Wait for next job for worker. Returns NULL when the pool is stopped. */
+static struct worker_job *
+next_job(struct worker *self)
+{
+  struct worker_job *job;
+  int i = self - pool.workers;
+
+  g_mutex_lock(&pool.lock);
+  while (!pool.queued && !pool.stop)
+    g_cond_wait(&pool.cond, &pool.lock);
+  if (pool.stop) {
+    g_mutex_unlock(&pool.lock);
+    return NULL;
+  }
+  pool.queued--; /* there is a job for us in one of the queues */
+  g_mutex_unlock(&pool.lock);
+
+  job = queue_take(self, 1);
+  while (!job) { /* steal one */
+    i = (i + 1) % pool.threads;
+    job = queue_take(&pool.workers[i], 0);
+  }
+  return job;
+}
+
+/* Idle callback: call done functions of finished jobs */
+static gboolean deliver(gpointer data);
+
+/* Worker thread */
+static gpointer
+worker_main(gpointer data)
+{
+  struct worker_job *job;
+
+  while ((job = next_job(data))) {
+    if (g_atomic_int_get(&job->group->serial) != job->serial)
+      job->canceled = 1;
+    else
+      job->work(job->data);
+
+    g_mutex_lock(&pool.done_lock);
+    if (pool.done_last)
+      pool.done_last->next = job;
+    else
+      pool.done_first = job;
+    pool.done_last = job;
+    if (!pool.idle_added) {
+      pool.idle_added = 1;
+      g_idle_add(deliver, NULL);
+    }
+    g_mutex_unlock(&pool.done_lock);
+  }
+  return NULL;
+}
+
+/* Call done function of job, and free it */
+static void
+finish_job(struct worker_job *job)
+{
+  struct worker_group *group = job->group;
+
+  job->done(job->data, job->canceled);
+  group->progress.done++;
+  if (job->canceled)
+    group->progress.canceled++;
+  group->outstanding--;
+  group->report = 1;
+  free(job);
+}
+
+/* Report progress of groups which have changed, and free groups which
+ * are no longer needed. */
+static void
+report_progress(void)
+{
+  struct worker_group **p = &pool.groups;
+
+  while (*p) {
+    struct worker_group *group = *p;
+
+    if (group->report && !group->freed) {
+      group->report = 0;
+      group->progress.finished =
+        group->progress.done == group->progress.total;
+      if (group->cb)
+        group->cb(&group->progress, group->ref);
+      if (group->progress.finished)
+        memset(&group->progress, 0, sizeof(group->progress));
+    }
+    /* The callback may have freed the group */
+    if (group->freed && !group->outstanding) {
+      *p = group->next;
+      free(group);
+    } else
+      p = &group->next;
+  }
+}
+
+/* Call done functions of finished jobs */
+static gboolean
+deliver(gpointer data)
+{
+  struct worker_job *job, *next;
+
+  g_mutex_lock(&pool.done_lock);
+  job = pool.done_first;
+  pool.done_first = pool.done_last = NULL;
+  pool.idle_added = 0;
+  g_mutex_unlock(&pool.done_lock);
+
+  for (; job; job = next) {
+    next = job->next;
+    finish_job(job);
+  }
+  report_progress();
+
+  return FALSE;
+}
+
+/* Start worker threads */
+int
+worker_pool_start(int threads)
+{
+  int i;
+
+  if (pool.threads)
+    return pool.threads;
+  if (!threads)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > WORKER_THREADS_MAX)
+    threads = WORKER_THREADS_MAX;
+
+  g_mutex_init(&pool.lock);
+  g_cond_init(&pool.cond);
+  g_mutex_init(&pool.done_lock);
+  pool.stop = 0;
+  /* The threads must not start looking for jobs to steal until all the
+   * queues are there, and pool.threads is what it will be. */
+  for (i = 0; i < threads; i++)
+    g_mutex_init(&pool.workers[i].lock);
+  g_mutex_lock(&pool.lock);
+  for (i = 0; i < threads; i++) {
+    pool.workers[i].thread = g_thread_try_new("worker", worker_main,
+                                              &pool.workers[i], NULL);
+    if (!pool.workers[i].thread)
+      break;
+  }
+  pool.threads = i;
+  g_mutex_unlock(&pool.lock);
+  for (; i < threads; i++)
+    g_mutex_clear(&pool.workers[i].lock);
+
+  if (pool.threads < threads)
+    eprintf("Warning: Could only start %d of %d worker threads\n",
+            pool.threads, threads);
+  xprintf("Worker pool: %d threads\n", pool.threads);
+  return pool.threads;
+}
+
+/* Stop worker threads */
+void
+worker_pool_stop(void)
+{
+  struct worker_job *job;
+  int i, threads = pool.threads;
+
+  if (!threads)
+    return;
+
+  g_mutex_lock(&pool.lock);
+  pool.stop = 1;
+  g_cond_broadcast(&pool.cond);
+  g_mutex_unlock(&pool.lock);
+  for (i = 0; i < threads; i++)
+    g_thread_join(pool.workers[i].thread);
+
+  /* From now on, jobs are run when submitted, also by done functions */
+  pool.threads = 0;
+  deliver(NULL);
+  for (i = 0; i < threads; i++) {
+    struct worker *worker = &pool.workers[i];
+
+    while ((job = queue_take(worker, 0))) {
+      job->canceled = 1;
+      finish_job(job);
+    }
+    free(worker->jobs);
+    g_mutex_clear(&worker->lock);
+    memset(worker, 0, sizeof(*worker));
+  }
+  report_progress();
+  pool.queued = 0;
+  g_mutex_clear(&pool.lock);
+  g_cond_clear(&pool.cond);
+  g_mutex_clear(&pool.done_lock);
+}
+
+/* Create group of jobs */
+struct worker_group *
+worker_group_new(worker_progress_cb cb, void *ref)
+{
+  struct worker_group *group = calloc(1, sizeof(*group));
+
+  if (!group)
+    return NULL;
+  group->cb = cb;
+  group->ref = ref;
+  group->next = pool.groups;
+  pool.groups = group;
+  return group;
+}
+
+/* Cancel jobs in group which have not started yet */
+void
+worker_group_cancel(struct worker_group *group)
+{
+  g_atomic_int_inc(&group->serial);
+}
+
+/* Cancel jobs in group, and free it when they are done */
+void
+worker_group_free(struct worker_group *group)
+{
+  worker_group_cancel(group);
+  group->freed = 1;
+  if (!group->outstanding)
+    report_progress(); /* frees it */
+}
+
+/* Submit job */
+int
+worker_submit(struct worker_group *group, worker_func work,
+              worker_done_func done, void *data)
+{
+  struct worker_job *job = calloc(1, sizeof(*job));
+  struct worker *worker;
+
+  if (!job)
+    return -1;
+  job->group = group;
+  job->serial = g_atomic_int_get(&group->serial);
+  job->work = work;
+  job->done = done;
+  job->data = data;
+  group->outstanding++;
+  group->progress.total++;
+
+  if (!pool.threads) { /* no threads; do it now */
+    work(data);
+    finish_job(job);
+    report_progress();
+    return 0;
+  }
+
+  worker = &pool.workers[pool.next++ % pool.threads];
+  g_mutex_lock(&worker->lock);
+  if (queue_push(worker, job) < 0) {
+    g_mutex_unlock(&worker->lock);
+    group->outstanding--;
+    group->progress.total--;
+    free(job);
+    return -1;
+  }
+  g_mutex_unlock(&worker->lock);
+
+  g_mutex_lock(&pool.lock);
+  pool.queued++;
+  g_cond_signal(&pool.cond);
+  g_mutex_unlock(&pool.lock);
+  return 0;
+}
+
+/************************* End of file worker_pool.c ************************/
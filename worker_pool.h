@@ -0,0 +1,84 @@
+/****************************************************************************
+ * xtor - GTK based editor for MIDI synthesizers
+ *
+ * worker_pool.h - Pool of worker threads for long running jobs.
+ *
+ * Copyright (C) 2014  Ricard Wanderlof <ricard2013@butoba.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ ****************************************************************************/
+
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+/* Max number of worker threads */
+#define WORKER_THREADS_MAX 8
+
+/* Function doing the work of a job, run in a worker thread. It must not
+ * touch anything which the main thread might be using at the same time. */
+typedef void (*worker_func)(void *data);
+
+/* Function called in the main thread when a job is done, or if it was
+ * canceled before it got to run, in which case canceled is set. This is
+ * where the result is taken care of and the data freed. */
+typedef void (*worker_done_func)(void *data, int canceled);
+
+/* Progress of a group of jobs, passed to progress callback */
+struct worker_progress {
+  int done;     /* number of jobs done so far, including canceled ones */
+  int total;    /* total number of jobs submitted so far */
+  int canceled; /* number of jobs canceled */
+  int finished; /* set when all jobs submitted so far are done */
+};
+
+/* Progress callback, called in the main thread as jobs get done. When
+ * all jobs in a group are done, the counts start over from 0. */
+typedef void (*worker_progress_cb)(const struct worker_progress *progress,
+                                   void *ref);
+
+/* Group of jobs, whose progress is reported together, and which can be
+ * canceled together. */
+struct worker_group;
+
+/* Start threads worker threads; if threads is 0, one per CPU. Returns
+ * number of threads started. Without threads, jobs are run right away
+ * when submitted. */
+int worker_pool_start(int threads);
+
+/* Stop worker threads, after the jobs being run are done. Jobs not yet
+ * run are canceled. */
+void worker_pool_stop(void);
+
+/* Create group of jobs, with progress callback cb (which may be NULL).
+ * Returns NULL if out of memory. */
+struct worker_group *worker_group_new(worker_progress_cb cb, void *ref);
+
+/* Cancel all jobs in group which have not started running yet. Their
+ * done functions are still called, with canceled set. */
+void worker_group_cancel(struct worker_group *group);
+
+/* Cancel all jobs in group, and free it once they are done. */
+void worker_group_free(struct worker_group *group);
+
+/* Submit job to be run by the pool. Jobs are not necessarily run, or
+ * done, in the order submitted. Returns 0 if ok, or -1 if out of memory,
+ * in which case done is not called. */
+int worker_submit(struct worker_group *group, worker_func work,
+                  worker_done_func done, void *data);
+
+#endif /* _WORKER_POOL_H_ */
+
+/************************* End of file worker_pool.h ************************/
@@ -26,6 +26,7 @@
  ****************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <getopt.h>
 #include <poll.h>
 #include <string.h>
@@ -36,6 +37,11 @@
 #include "param.h"
 #include "blofeld_params.h"
 #include "blofeld_knobs.h"
+#include "blofeld_library.h"
+#include "blofeld_similar.h"
+#include "blofeld_search.h"
+#include "blofeld_archive.h"
+#include "worker_pool.h"
 #include "controller.h"
 #include "knob_mapper.h"
 #include "nocturn.h"
@@ -69,6 +75,7 @@ struct adjustor {
   const char *id; /* name of parameter, e.g. "Filter 1 Cutoff" */
   int parnum;  /* parameter number. Redundant, but practical */
   GList *widgets; /* list of widgets controlling parameter */
+  int batch; /* last batch of parameter updates this adjustor was in */
 };
 
 /* List of all adjustors, indexed by parameter number. */
@@ -231,6 +238,16 @@ on_midi_input(GIOChannel *source, GIOCondition condition, gpointer data)
   return TRUE; /* don't remove event source */
 }
 
+/* Called every PARAM_TIMER_INTERVAL ms from the main loop */
+static gboolean
+on_param_timer(gpointer data)
+{
+  param_handler->param_timer();
+  midi_output();
+
+  return TRUE; /* keep on calling us */
+}
+
 void
 on_Device_Name_activate(GtkWidget *widget, gpointer user_data)
 {
@@ -251,7 +268,7 @@ void
 on_Device_Number_changed(GtkWidget *widget, gpointer user_data)
 {
   if (!GTK_IS_SPIN_BUTTON(widget)) return;
-  device_number = gtk_spin_button_get_value(GTK_SPIN_BUTTON(widget));
+  blofeld_set_device_number(gtk_spin_button_get_value(GTK_SPIN_BUTTON(widget)));
 
   xprintf("User set device number to %d\n", device_number);
 }
@@ -428,6 +445,34 @@ param_changed(int parnum, int buffer_no, void *valptr, void *ref)
   }
 }
 
+/* Called with a batch of parameter changes, e.g. a sound dump arriving
+ * from the synth. A parameter can occur several times in a batch (for
+ * instance during automation playback); only its last value is shown,
+ * so we go through the batch backwards and skip adjustors already done. */
+static void
+params_changed(const struct param_event *events, int count, void *ref)
+{
+  static int batch = 0;
+  int i;
+
+  batch++;
+  for (i = count - 1; i >= 0; i--) {
+    const struct param_event *event = &events[i];
+    struct adjustor *adjustor;
+
+    if (event->buf_no != current_buffer_no ||
+        event->parnum < 0 || event->parnum >= param_handler->params)
+      continue;
+    adjustor = adjustors[event->parnum];
+    if (!adjustor || adjustor->batch == batch)
+      continue;
+    adjustor->batch = batch;
+    update_adjustors(adjustor, event->string ? (const void *) event->string :
+                                               (const void *) &event->value,
+                     NULL);
+  }
+}
+
 /* Called whenever a widget's value changes.
  * We send the update to the synth via MIDI, but also to other widgets with
  * same parameter name (e.g. on other editor pages or tabs.) */
@@ -1131,8 +1176,9 @@ find_widgets_id(GList *widget_list,
  * widget and all its children for a widget with the id 'id', and return
  * the widget. */
 /* Used when scanning the KeyMappings liststore and thus adding definitions
- * to our key map. */
-static GtkWidget *
+ * to our key map, as well as by synth specific UI functions that need to
+ * get hold of widgets other than the one that generated a signal. */
+GtkWidget *
 find_widget_with_id(GtkWidget *widget, const char *id)
 {
   GtkWidget *result = NULL;
@@ -1553,6 +1599,14 @@ static char *usage =
   "-c  --controller   specify controller (default beatstep)\n"
   "                   supported controllers are beatstep, nocturn\n"
   "-u  --ui           specify .glade file with synth UI definitions\n"
+  "-s  --synth_def    specify synth definition file\n"
+  "-m  --mirror       mirror edits to device number N[:MIDI device];\n"
+  "                   may be given several times\n"
+  "-l  --library      directory tree of .syx files to keep an index of\n"
+  "-p  --pack         pack sounds in .syx files given as arguments into\n"
+  "                   archive, then exit\n"
+  "-x  --unpack       unpack sounds in archive to .syx file given as\n"
+  "                   argument, then exit\n"
   "-h  --help         this list\n";
 
 /* It would be nice to have function pointers directly in list below, but
@@ -1571,6 +1625,54 @@ struct controller_init controller_initfuncs[] =
   { .name = NULL, .controller_init = NULL } /* sentinel */
 };
 
+/* Add mirror device given as N[:MIDI device] on command line */
+static int
+add_mirror(const char *arg)
+{
+  char *end;
+  long dev_no = strtol(arg, &end, 0);
+
+  if (end == arg || (*end && *end != ':') || dev_no < 0 || dev_no > 127) {
+    printf("Invalid mirror device: %s\n", arg);
+    return -1;
+  }
+  switch (blofeld_mirror_add(dev_no, *end == ':' ? end + 1 : NULL)) {
+    case 0:
+      return 0;
+    case -2:
+      printf("All mirrors must use the same MIDI device: %s\n", arg);
+      return -1;
+    default:
+      printf("Too many mirror devices\n");
+      return -1;
+  }
+}
+
+/* Pack or unpack archive, as given on the command line. Returns exit
+ * status. */
+static int
+archive_command(const char *archive, int pack, char * const *files,
+                int count, const char *def_filename)
+{
+  struct param_handler handler;
+
+  if (pack ? count < 1 : count != 1) {
+    printf(pack ? "No .syx files to pack\n" : "Expected one .syx file\n");
+    return 1;
+  }
+  /* The synth definition is needed to make sense of the dumps */
+  memset(&handler, 0, sizeof(handler));
+  handler.def_filename = def_filename;
+  if (blofeld_init(&handler) < 0) {
+    eprintf("Can't initialize synth, exiting.\n");
+    return 1;
+  }
+  if (pack)
+    return blofeld_archive_pack(archive, files, count) < 0;
+  /* Broadcast, so that the dumps can be sent to any Blofeld */
+  return blofeld_archive_unpack(archive, files[0], 0x7f) < 0;
+}
+
 /* Our main function */
 int
 main(int argc, char *argv[])
@@ -1578,6 +1680,10 @@ main(int argc, char *argv[])
   GtkBuilder *builder;
   struct polls *polls;
   const char *gladename = NULL;
+  const char *def_filename = NULL;
+  const char *library_dir = NULL;
+  const char *archive = NULL;
+  int pack = 0;
   const char *controller_name = "beatstep";
   int i, c, digit_optind = 0;
 
@@ -1587,22 +1693,35 @@ main(int argc, char *argv[])
     static struct option long_options[] = {
       { "controller", required_argument, 0, 'c' },
       { "synth_ui",   required_argument, 0, 'u' },
+      { "synth_def",  required_argument, 0, 's' },
+      { "mirror",     required_argument, 0, 'm' },
+      { "library",    required_argument, 0, 'l' },
+      { "pack",       required_argument, 0, 'p' },
+      { "unpack",     required_argument, 0, 'x' },
       { "help",       no_argument      , 0, 'h' },
       { 0,            0,                 0, 0 }
     };
 
-    c = getopt_long(argc, argv, "c:u:h", long_options, &option_index);
+    c = getopt_long(argc, argv, "c:u:s:m:l:p:x:h", long_options, &option_index);
     if (c == -1) break;
 
     switch (c) {
       case 'c': controller_name = optarg; break;
       case 'u': gladename = optarg; break;
+      case 's': def_filename = optarg; break;
+      case 'm': if (add_mirror(optarg) < 0) return 1; break;
+      case 'l': library_dir = optarg; break;
+      case 'p': archive = optarg; pack = 1; break;
+      case 'x': archive = optarg; pack = 0; break;
       case 'h': printf("%s", usage); return 0;
       case '?': return 1;
       case 0:
       default: break;
     }
   }
+  if (archive)
+    return archive_command(archive, pack, &argv[optind], argc - optind,
+                           def_filename);
   if (optind < argc) {
     printf("Unrecognized option: %s\n", argv[optind]);
     return 1;
@@ -1622,7 +1741,15 @@ main(int argc, char *argv[])
   /* Here we do a basic initialization of structures etc. */
 
   memset(param_handler, 0, sizeof(*param_handler));
-  blofeld_init(param_handler);
+  param_handler->def_filename = def_filename;
+  if (blofeld_init(param_handler) < 0) {
+    eprintf("Can't initialize synth, exiting.\n");
+    return 1;
+  }
+  /* Files are read and indexed in the background */
+  worker_pool_start(0);
+  if (library_dir && blofeld_library_open(library_dir) < 0)
+    return 1;
 
   memset(controller, 0, sizeof(*controller));
 
@@ -1717,7 +1844,10 @@ main(int argc, char *argv[])
 
   create_adjustors_list(param_handler->params, main_window);
 
-  param_handler->param_register_notify_cb(param_changed, NULL);
+  if (param_handler->param_register_batch_cb)
+    param_handler->param_register_batch_cb(params_changed, NULL);
+  else
+    param_handler->param_register_notify_cb(param_changed, NULL);
 
   controller->controller_register_notify_cb(controller_change, NULL);
   controller->controller_register_jump_button_cb(jump_button, NULL);
@@ -1727,6 +1857,10 @@ main(int argc, char *argv[])
   param_handler->param_midi_init(param_handler);
   controller->controller_midi_init(controller);
 
+  /* Parameter handler timer, for timeouts etc. */
+  if (param_handler->param_timer)
+    g_timeout_add(PARAM_TIMER_INTERVAL, on_param_timer, NULL);
+
   /* Final things we haven't done before. */
 
   block_updates = 0;
@@ -1738,6 +1872,11 @@ main(int argc, char *argv[])
   gtk_widget_show(main_window);
   gtk_main();
 
+  blofeld_library_close();
+  worker_pool_stop();
+  blofeld_similar_free();
+  blofeld_search_free();
+
   return 0;
 }
 
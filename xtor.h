@@ -35,6 +35,9 @@ extern void set_title(void); /* Set main window title from patch name, etc. */
 
 extern void invalidate_knob_mappings(GtkWidget *container);
 
+/* Find widget with given id, searching recursively from widget */
+extern GtkWidget *find_widget_with_id(GtkWidget *widget, const char *id);
+
 #endif /* _XTOR_H_ */
 
 /*************************** End of file xtor.h ***************************/